@@ -0,0 +1,74 @@
+#include "TLG.h"
+#include "byteorder.h"
+#include <string.h>
+#include <vector>
+
+//---------------------------------------------------------------------------
+// "atls" chunk
+//---------------------------------------------------------------------------
+/*
+	layout, all little endian:
+		entry count (32bit)
+		for each entry:
+			left, top, width, height, name length (32bit each)
+			name
+*/
+
+// fields of an entry before its name
+#define TVP_TLG_ATLAS_ENTRY_SIZE 20
+
+bool
+TVPTLGBuildAtlasChunk(const std::vector<tTVPTLGAtlasEntry> &entries, tTVPTLGChunk &chunk)
+{
+	memcpy(chunk.name, "atls", 4);
+	chunk.data.clear();
+	if (entries.size() > 0xffffffff) return false;
+	TVPTLGAppendInt32(chunk.data, (tjs_uint32)entries.size());
+	for (size_t i = 0; i < entries.size(); i++) {
+		const tTVPTLGAtlasEntry &entry = entries[i];
+		if (entry.name.length() > 0xffff) return false;
+		TVPTLGAppendInt32(chunk.data, entry.rect.left);
+		TVPTLGAppendInt32(chunk.data, entry.rect.top);
+		TVPTLGAppendInt32(chunk.data, entry.rect.width);
+		TVPTLGAppendInt32(chunk.data, entry.rect.height);
+		TVPTLGAppendInt32(chunk.data, (tjs_uint32)entry.name.length());
+		chunk.data.insert(chunk.data.end(), entry.name.begin(), entry.name.end());
+		// the chunk size is 32bit
+		if (chunk.data.size() > 0xffffffff) return false;
+	}
+	return true;
+}
+
+int
+TVPProbeTLGAtlas(tTJSBinaryStream *src, std::vector<tTVPTLGAtlasEntry> *entries)
+{
+	tTVPTLGChunkIterator it(src);
+	while (it.Next()) {
+		if (memcmp(it.GetChunk().name, "atls", 4)) continue;
+		const tjs_uint8 *p = (const tjs_uint8 *)it.GetData();
+		tjs_uint32 size = it.GetChunk().size;
+		if (!p || size < 4) return TLG_ERROR;
+		tjs_uint32 count = TVPTLGLoadInt32(p);
+		tjs_uint32 pos = 4;
+		// every entry takes at least its fixed fields
+		if (count > (size - pos) / TVP_TLG_ATLAS_ENTRY_SIZE) return TLG_ERROR;
+		entries->resize(count);
+		for (tjs_uint32 i = 0; i < count; i++) {
+			if (size - pos < TVP_TLG_ATLAS_ENTRY_SIZE) return TLG_ERROR;
+			tTVPTLGAtlasEntry &entry = (*entries)[i];
+			entry.rect.left = TVPTLGLoadInt32(p + pos);
+			entry.rect.top = TVPTLGLoadInt32(p + pos + 4);
+			entry.rect.width = TVPTLGLoadInt32(p + pos + 8);
+			entry.rect.height = TVPTLGLoadInt32(p + pos + 12);
+			tjs_uint32 namelen = TVPTLGLoadInt32(p + pos + 16);
+			pos += TVP_TLG_ATLAS_ENTRY_SIZE;
+			if (namelen > size - pos) return TLG_ERROR;
+			entry.name.assign((const char *)p + pos, namelen);
+			pos += namelen;
+		}
+		return pos == size ? TLG_SUCCESS : TLG_ERROR;
+	}
+	return TLG_ERROR;
+}
+
+//---------------------------------------------------------------------------
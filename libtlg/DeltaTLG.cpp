@@ -0,0 +1,413 @@
+#include "TLG.h"
+#include "byteorder.h"
+#include <string.h>
+#include <vector>
+
+extern tTJSBinaryStream *GetMemoryStream();
+
+// edge length of the tiles compared to find the changed rectangles
+#define TVP_TLG_DELTA_TILE_SIZE 16
+
+// "dlta" chunk fields before the rectangles and the name
+#define TVP_TLG_DELTA_HEADER_SIZE 32
+
+//---------------------------------------------------------------------------
+// decoded image
+//---------------------------------------------------------------------------
+/*
+	32bit pixels of a whole image, filled by TVPLoadTLG through the
+	callbacks below.
+*/
+struct tTVPTLGPixelBuffer
+{
+	tjs_uint Width;
+	tjs_uint Height;
+	std::vector<tjs_uint8> Pixels;
+
+	tTVPTLGPixelBuffer() : Width(0), Height(0) {}
+
+	tjs_uint8 * GetLine(tjs_uint y) { return &Pixels[(size_t)y * Width * 4]; }
+	const tjs_uint8 * GetLine(tjs_uint y) const { return &Pixels[(size_t)y * Width * 4]; }
+};
+
+static bool TVPTLGPixelBufferSizeCallback(void *callbackdata, tjs_uint w, tjs_uint h)
+{
+	tTVPTLGPixelBuffer *buf = (tTVPTLGPixelBuffer *)callbackdata;
+	if ((tjs_uint64)w * h > ((size_t)-1) / 4) return false;
+	try {
+		buf->Pixels.resize((size_t)w * h * 4);
+	} catch (...) {
+		return false;
+	}
+	buf->Width = w;
+	buf->Height = h;
+	return true;
+}
+
+static void * TVPTLGPixelBufferScanLineCallback(void *callbackdata, tjs_int y)
+{
+	if (y < 0) return NULL;
+	return ((tTVPTLGPixelBuffer *)callbackdata)->GetLine(y);
+}
+
+tjs_uint64 TVPTLGHashBytes(const void *data, size_t size)
+{
+	const tjs_uint8 *p = (const tjs_uint8 *)data;
+	tjs_uint64 hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static tjs_uint64 TVPTLGHashPixels(const tTVPTLGPixelBuffer &buf)
+{
+	return TVPTLGHashBytes(buf.Pixels.data(), buf.Pixels.size());
+}
+
+//---------------------------------------------------------------------------
+// "dlta" chunk
+//---------------------------------------------------------------------------
+/*
+	layout, all little endian:
+		width, height, left, top (32bit each)
+		base hash (64bit)
+		rectangle count, base name length (32bit each)
+		rectangles (left, top, width, height; 32bit each)
+		base name
+*/
+static void TVPTLGBuildDeltaChunk(const tTVPTLGDeltaInfo &info, std::vector<tjs_uint8> &out)
+{
+	TVPTLGAppendInt32(out, info.width);
+	TVPTLGAppendInt32(out, info.height);
+	TVPTLGAppendInt32(out, info.left);
+	TVPTLGAppendInt32(out, info.top);
+	TVPTLGAppendInt32(out, (tjs_uint32)info.base_hash);
+	TVPTLGAppendInt32(out, (tjs_uint32)(info.base_hash >> 32));
+	TVPTLGAppendInt32(out, (tjs_uint32)info.rects.size());
+	TVPTLGAppendInt32(out, (tjs_uint32)info.base.length());
+	for (size_t i = 0; i < info.rects.size(); i++) {
+		TVPTLGAppendInt32(out, info.rects[i].left);
+		TVPTLGAppendInt32(out, info.rects[i].top);
+		TVPTLGAppendInt32(out, info.rects[i].width);
+		TVPTLGAppendInt32(out, info.rects[i].height);
+	}
+	out.insert(out.end(), info.base.begin(), info.base.end());
+}
+
+static bool TVPTLGParseDeltaChunk(const tjs_uint8 *data, tjs_uint32 size, tTVPTLGDeltaInfo *info)
+{
+	if (size < TVP_TLG_DELTA_HEADER_SIZE) return false;
+	info->width = TVPTLGLoadInt32(data);
+	info->height = TVPTLGLoadInt32(data + 4);
+	info->left = TVPTLGLoadInt32(data + 8);
+	info->top = TVPTLGLoadInt32(data + 12);
+	info->base_hash = TVPTLGLoadInt32(data + 16) | ((tjs_uint64)TVPTLGLoadInt32(data + 20) << 32);
+	tjs_uint32 count = TVPTLGLoadInt32(data + 24);
+	tjs_uint32 namelen = TVPTLGLoadInt32(data + 28);
+	if ((tjs_uint64)count * 16 + namelen != size - TVP_TLG_DELTA_HEADER_SIZE) return false;
+	const tjs_uint8 *p = data + TVP_TLG_DELTA_HEADER_SIZE;
+	info->rects.resize(count);
+	for (tjs_uint32 i = 0; i < count; i++, p += 16) {
+		tTVPTLGRect &r = info->rects[i];
+		r.left = TVPTLGLoadInt32(p);
+		r.top = TVPTLGLoadInt32(p + 4);
+		r.width = TVPTLGLoadInt32(p + 8);
+		r.height = TVPTLGLoadInt32(p + 12);
+		// rectangles must lie on the variant
+		if (r.left > info->width || r.width > info->width - r.left ||
+			r.top > info->height || r.height > info->height - r.top) return false;
+	}
+	info->base.assign((const char *)p, namelen);
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// changed rectangles
+//---------------------------------------------------------------------------
+/*
+	compare the images tile by tile, and join the changed tiles into
+	rectangles: runs of tiles in a tile row, and runs in following tile
+	rows which cover the same columns.
+*/
+static void TVPTLGFindChangedRects(const tTVPTLGPixelBuffer &base, const tTVPTLGPixelBuffer &variant,
+								   std::vector<tTVPTLGRect> &rects)
+{
+	const tjs_uint T = TVP_TLG_DELTA_TILE_SIZE;
+	tjs_uint tw = (base.Width + T - 1) / T;
+	tjs_uint th = (base.Height + T - 1) / T;
+	std::vector<bool> changed((size_t)tw * th, false);
+	for (tjs_uint y = 0; y < base.Height; y++) {
+		const tjs_uint8 *b = base.GetLine(y);
+		const tjs_uint8 *v = variant.GetLine(y);
+		for (tjs_uint tx = 0; tx < tw; tx++) {
+			size_t index = (size_t)(y / T) * tw + tx;
+			if (changed[index]) continue;
+			tjs_uint x = tx * T;
+			tjs_uint w = base.Width - x < T ? base.Width - x : T;
+			if (memcmp(b + x * 4, v + x * 4, w * 4)) changed[index] = true;
+		}
+	}
+
+	// indices of the rectangles which end at the previous tile row
+	std::vector<size_t> open, next;
+	for (tjs_uint ty = 0; ty < th; ty++) {
+		next.clear();
+		tjs_uint y = ty * T;
+		tjs_uint h = base.Height - y < T ? base.Height - y : T;
+		for (tjs_uint tx = 0; tx < tw; ) {
+			if (!changed[(size_t)ty * tw + tx]) { tx++; continue; }
+			tjs_uint start = tx;
+			while (tx < tw && changed[(size_t)ty * tw + tx]) tx++;
+			tjs_uint x = start * T;
+			tjs_uint w = (tx * T > base.Width ? base.Width : tx * T) - x;
+			size_t found = rects.size();
+			for (size_t i = 0; i < open.size(); i++) {
+				const tTVPTLGRect &r = rects[open[i]];
+				if (r.left == x && r.width == w) { found = open[i]; break; }
+			}
+			if (found < rects.size()) {
+				rects[found].height += h;
+			} else {
+				tTVPTLGRect r = { x, y, w, h };
+				rects.push_back(r);
+			}
+			next.push_back(found);
+		}
+		open.swap(next);
+	}
+}
+
+//---------------------------------------------------------------------------
+// TVPSaveTLGDelta
+//---------------------------------------------------------------------------
+struct tTVPTLGDeltaCrop
+{
+	const tjs_uint8 *Pixels;
+	tjs_uint Stride;
+};
+
+static void * TVPTLGDeltaCropScanLine(void *callbackdata, tjs_int y)
+{
+	if (y < 0) return NULL;
+	tTVPTLGDeltaCrop *crop = (tTVPTLGDeltaCrop *)callbackdata;
+	return (void *)(crop->Pixels + (size_t)y * crop->Stride);
+}
+
+int
+TVPSaveTLGDelta(tTJSBinaryStream *dest,
+				int type,
+				int width, int height, int colors,
+				void *callbackdata,
+				tTVPGraphicScanLineCallback scanlinecallback,
+				tTJSBinaryStream *base,
+				const std::string &basename,
+				const std::map<std::string,std::string> *tags,
+				const tTVPTLGSaveOption *option)
+{
+	if (width <= 0 || width > TVP_TLG_MAX_WIDTH || height <= 0 || height > TVP_TLG_MAX_HEIGHT) {
+		return TLG_ERROR;
+	}
+	if (colors != 1 && colors != 3 && colors != 4) {
+		return TLG_ERROR;
+	}
+	if (basename.length() > 0xffff) {
+		return TLG_ERROR;
+	}
+
+	tTVPTLGPixelBuffer baseimage;
+	int ret = TVPLoadTLG(&baseimage, TVPTLGPixelBufferSizeCallback, TVPTLGPixelBufferScanLineCallback, NULL, base);
+	if (ret != TLG_SUCCESS) {
+		return TLG_ERROR;
+	}
+	if (baseimage.Width != (tjs_uint)width || baseimage.Height != (tjs_uint)height) {
+		return TLG_ERROR;
+	}
+
+	// the variant, in the layout of decoded pixels
+	tTVPTLGPixelBuffer variant;
+	if (!TVPTLGPixelBufferSizeCallback(&variant, width, height)) {
+		return TLG_ERROR;
+	}
+	for (int y = 0; y < height; y++) {
+		const tjs_uint8 *src = (const tjs_uint8 *)scanlinecallback(callbackdata, y);
+		if (src == NULL) {
+			return TLG_ABORT;
+		}
+		tjs_uint8 *d = variant.GetLine(y);
+		for (int x = 0; x < width; x++, d += 4) {
+			switch (colors) {
+			case 1: d[0] = d[1] = d[2] = src[x]; d[3] = 255; break;
+			case 3: d[0] = src[x*3]; d[1] = src[x*3+1]; d[2] = src[x*3+2]; d[3] = 255; break;
+			default: memcpy(d, src + x*4, 4); break;
+			}
+		}
+	}
+
+	tTVPTLGDeltaInfo info;
+	info.base = basename;
+	info.base_hash = TVPTLGHashPixels(baseimage);
+	info.width = width;
+	info.height = height;
+	TVPTLGFindChangedRects(baseimage, variant, info.rects);
+
+	// bounding box of the rectangles; one pixel if nothing changed
+	tjs_uint32 right = 1, bottom = 1;
+	if (!info.rects.empty()) {
+		info.left = info.top = 0xffffffff;
+		right = bottom = 0;
+		for (size_t i = 0; i < info.rects.size(); i++) {
+			const tTVPTLGRect &r = info.rects[i];
+			if (r.left < info.left) info.left = r.left;
+			if (r.top < info.top) info.top = r.top;
+			if (r.left + r.width > right) right = r.left + r.width;
+			if (r.top + r.height > bottom) bottom = r.top + r.height;
+		}
+	}
+	tjs_uint32 cropwidth = right - info.left;
+	tjs_uint32 cropheight = bottom - info.top;
+
+	// the changed pixels, with 0 outside the rectangles so that the rest
+	// of the box costs little
+	int cropcolors = colors == 4 ? 4 : 3;
+	std::vector<tjs_uint8> crop((size_t)cropwidth * cropheight * cropcolors, 0);
+	for (size_t i = 0; i < info.rects.size(); i++) {
+		const tTVPTLGRect &r = info.rects[i];
+		for (tjs_uint32 y = r.top; y < r.top + r.height; y++) {
+			const tjs_uint8 *s = variant.GetLine(y) + (size_t)r.left * 4;
+			tjs_uint8 *d = &crop[((size_t)(y - info.top) * cropwidth + (r.left - info.left)) * cropcolors];
+			if (cropcolors == 4) {
+				memcpy(d, s, (size_t)r.width * 4);
+			} else {
+				for (tjs_uint32 x = 0; x < r.width; x++, s += 4, d += 3) {
+					d[0] = s[0]; d[1] = s[1]; d[2] = s[2];
+				}
+			}
+		}
+	}
+	// the whole variant is not needed any more
+	std::vector<tjs_uint8>().swap(variant.Pixels);
+	std::vector<tjs_uint8>().swap(baseimage.Pixels);
+
+	std::vector<tTVPTLGChunk> chunks;
+	tTVPTLGSaveOption deltaoption;
+	if (option) {
+		deltaoption = *option;
+		if (option->extra_chunks) chunks = *option->extra_chunks;
+	}
+	// a preview of the box alone would be misleading, and trimming would
+	// move the box away from the position in the chunk
+	deltaoption.thumbnail_size = 0;
+	deltaoption.trim_transparent = false;
+	tTVPTLGChunk chunk;
+	memcpy(chunk.name, "dlta", 4);
+	TVPTLGBuildDeltaChunk(info, chunk.data);
+	chunks.push_back(chunk);
+	deltaoption.extra_chunks = &chunks;
+
+	tTVPTLGDeltaCrop cropsrc = { &crop[0], cropwidth * cropcolors };
+	return TVPSaveTLG(dest, type, cropwidth, cropheight, cropcolors, &cropsrc, TVPTLGDeltaCropScanLine,
+		tags, &deltaoption);
+}
+
+//---------------------------------------------------------------------------
+// TVPProbeTLGDelta / TVPLoadTLGDelta
+//---------------------------------------------------------------------------
+int
+TVPProbeTLGDelta(tTJSBinaryStream *src, tTVPTLGDeltaInfo *info)
+{
+	tTVPTLGChunkIterator it(src);
+	while (it.Next()) {
+		if (memcmp(it.GetChunk().name, "dlta", 4)) continue;
+		const char *data = it.GetData();
+		if (!data || !TVPTLGParseDeltaChunk((const tjs_uint8 *)data, it.GetChunk().size, info)) {
+			return TLG_ERROR;
+		}
+		return TLG_SUCCESS;
+	}
+	return TLG_ERROR;
+}
+
+int
+TVPLoadTLGDelta(void *callbackdata,
+				tTVPGraphicSizeCallback sizecallback,
+				tTVPGraphicScanLineCallback scanlinecallback,
+				std::map<std::string,std::string> *tags,
+				tTJSBinaryStream *src,
+				tTJSBinaryStream *base)
+{
+	if (!src->CanSeek()) {
+		// the chunks are read before the raw data
+		tTJSBinaryStream *mem = GetMemoryStream();
+		int ret;
+		try {
+			tjs_uint8 buf[4096];
+			tjs_uint size;
+			while ((size = src->Read(buf, sizeof(buf))) > 0) {
+				if (!mem->WriteBuffer(buf, size)) {
+					delete mem;
+					return TLG_ERROR;
+				}
+			}
+			ret = TVPLoadTLGDelta(callbackdata, sizecallback, scanlinecallback, tags, mem, base);
+		} catch (...) {
+			delete mem;
+			throw;
+		}
+		delete mem;
+		return ret;
+	}
+
+	tTVPTLGDeltaInfo info;
+	if (TVPProbeTLGDelta(src, &info) != TLG_SUCCESS) {
+		return TLG_ERROR;
+	}
+
+	tTVPTLGPixelBuffer image;
+	int ret = TVPLoadTLG(&image, TVPTLGPixelBufferSizeCallback, TVPTLGPixelBufferScanLineCallback, NULL, base);
+	if (ret != TLG_SUCCESS) {
+		return TLG_ERROR;
+	}
+	// the variant is only valid on the very base it was made against
+	if (image.Width != info.width || image.Height != info.height ||
+		TVPTLGHashPixels(image) != info.base_hash) {
+		return TLG_ERROR;
+	}
+
+	tTVPTLGPixelBuffer delta;
+	ret = TVPLoadTLG(&delta, TVPTLGPixelBufferSizeCallback, TVPTLGPixelBufferScanLineCallback, tags, src);
+	if (ret != TLG_SUCCESS) {
+		return ret;
+	}
+
+	// put the changed rectangles onto the base
+	for (size_t i = 0; i < info.rects.size(); i++) {
+		const tTVPTLGRect &r = info.rects[i];
+		if (r.left < info.left || r.top < info.top ||
+			r.left - info.left + (tjs_uint64)r.width > delta.Width ||
+			r.top - info.top + (tjs_uint64)r.height > delta.Height) {
+			return TLG_ERROR;
+		}
+		for (tjs_uint32 y = 0; y < r.height; y++) {
+			memcpy(image.GetLine(r.top + y) + (size_t)r.left * 4,
+				delta.GetLine(r.top - info.top + y) + (size_t)(r.left - info.left) * 4,
+				(size_t)r.width * 4);
+		}
+	}
+
+	if (sizecallback && !sizecallback(callbackdata, image.Width, image.Height)) {
+		return TLG_ABORT;
+	}
+	for (tjs_uint y = 0; y < image.Height; y++) {
+		void *line = scanlinecallback(callbackdata, y);
+		if (line == NULL) {
+			return TLG_ABORT;
+		}
+		memcpy(line, image.GetLine(y), (size_t)image.Width * 4);
+		scanlinecallback(callbackdata, -1);
+	}
+	return TLG_SUCCESS;
+}
+
+//---------------------------------------------------------------------------
@@ -12,11 +12,23 @@
 #include "tvpgl.h"
 #include <stdlib.h>
 #include <string.h>
+#include <vector>
 
+#ifdef _WIN32
+#include <malloc.h>
 #define TJSAlignedAlloc _aligned_malloc
 #define TJSAlignedDealloc _aligned_free
+#else
+static void *TJSAlignedAlloc(size_t bytes, size_t align)
+{
+	void *ptr = NULL;
+	if(align < sizeof(void*)) align = sizeof(void*);
+	if(posix_memalign(&ptr, align, bytes ? bytes : 1)) return NULL;
+	return ptr;
+}
+#define TJSAlignedDealloc free
+#endif
 
-extern "C" void TVPCreateTable(void);
 
 /*
 	TLG5:
@@ -36,6 +48,76 @@ extern "C" void TVPCreateTable(void);
 */
 
 
+//---------------------------------------------------------------------------
+// forward-only source
+//---------------------------------------------------------------------------
+/*
+	the loader skips parts of the stream by seeking forward. streams which
+	cannot seek (pipes etc.) are wrapped by this, which counts the bytes
+	read from where the loading started and skips by reading. seeking
+	backward or from the end is an error, after which reads fail.
+*/
+class tTVPTLGForwardStream : public tTJSBinaryStream
+{
+	tTJSBinaryStream *Source;
+	tjs_uint64 Position;
+	bool Failed;
+
+public:
+	tTVPTLGForwardStream(tTJSBinaryStream *source) :
+		Source(source), Position(0), Failed(false)
+	{
+	}
+
+	virtual tjs_uint64 Seek(tjs_int64 offset, tjs_int whence)
+	{
+		tjs_int64 newpos;
+		switch(whence)
+		{
+		case TJS_BS_SEEK_SET: newpos = offset; break;
+		case TJS_BS_SEEK_CUR: newpos = (tjs_int64)Position + offset; break;
+		default:              newpos = -1; break; // the end is unknown
+		}
+		if(newpos < (tjs_int64)Position)
+		{
+			Failed = true;
+			return Position;
+		}
+		tjs_uint8 buf[4096];
+		while(!Failed && Position < (tjs_uint64)newpos)
+		{
+			tjs_uint64 remain = (tjs_uint64)newpos - Position;
+			tjs_uint one = remain < sizeof(buf) ? (tjs_uint)remain : (tjs_uint)sizeof(buf);
+			if(Read(buf, one) != one) Failed = true;
+		}
+		return Position;
+	}
+
+	virtual tjs_uint Read(void *buffer, tjs_uint read_size)
+	{
+		if(Failed) return 0;
+		tjs_uint8 *p = (tjs_uint8 *)buffer;
+		tjs_uint total = 0;
+		while(total < read_size)
+		{
+			// pipes may return less than requested before the end
+			tjs_uint got = Source->Read(p + total, read_size - total);
+			if(!got) break;
+			total += got;
+		}
+		Position += total;
+		return total;
+	}
+
+	virtual tjs_uint Write(const void *buffer, tjs_uint write_size)
+	{
+		return 0;
+	}
+
+	virtual bool CanSeek() { return false; }
+};
+
+
 //---------------------------------------------------------------------------
 // TLG5 loading handler
 //---------------------------------------------------------------------------
@@ -49,19 +131,32 @@ int TVPLoadTLG5(void *callbackdata,
 	unsigned char mark[12];
 	tjs_uint32 width, height, colors, blockheight;
 	if (!src->ReadBuffer(mark, 1)) {
-		return false;
+		return TLG_ERROR;
 	}
 	colors = mark[0];
 	
 	if (!src->ReadI32LE(width) ||
 		!src->ReadI32LE(height) ||
 		!src->ReadI32LE(blockheight)) {
-		return false;
+		return TLG_ERROR;
 	}
 
 	if(colors != 3 && colors != 4) {
 		// "Unsupported color type."
-		return false;
+		return TLG_ERROR;
+	}
+
+	if (width == 0 || width > TVP_TLG_MAX_WIDTH ||
+		height == 0 || height > TVP_TLG_MAX_HEIGHT ||
+		blockheight == 0 || blockheight > TVP_TLG_MAX_HEIGHT) {
+		// "Invalid image size."
+		return TLG_ERROR;
+	}
+
+	// size of one decompressed block of one color
+	tjs_uint64 blocksize = (tjs_uint64)blockheight * width;
+	if (blocksize > (size_t)-1 - 10) {
+		return TLG_ERROR;
 	}
 
 	if (sizecallback && !sizecallback(callbackdata, width, height)) {
@@ -71,12 +166,13 @@ int TVPLoadTLG5(void *callbackdata,
 	int blockcount = (int)((height - 1) / blockheight) + 1;
 
 	// skip block size section
-	src->SetPosition(src->GetPosition() + blockcount * sizeof(tjs_uint32));
+	src->SetPosition(src->GetPosition() + (tjs_uint64)blockcount * sizeof(tjs_uint32));
 
 	// decomperss
 	tjs_uint8 *inbuf = NULL;
 	tjs_uint8 *outbuf[4];
 	tjs_uint8 *text = NULL;
+	tjs_uint8 *prevbuf = NULL; // copy of the line above
 	tjs_int r = 0;
 	for(int i = 0; i < colors; i++) outbuf[i] = NULL;
 
@@ -84,11 +180,21 @@ int TVPLoadTLG5(void *callbackdata,
 	
 	{
 		text = (tjs_uint8*)TJSAlignedAlloc(4096, 4);
-		memset(text, 0, 4096);
-
-		inbuf = (tjs_uint8*)TJSAlignedAlloc(blockheight * width + 10, 4);
+		inbuf = (tjs_uint8*)TJSAlignedAlloc((size_t)blocksize + 10, 4);
+		prevbuf = (tjs_uint8*)TJSAlignedAlloc((size_t)width * 4, 4);
 		for(tjs_int i = 0; i < colors; i++)
-			outbuf[i] = (tjs_uint8*)TJSAlignedAlloc(blockheight * width + 10, 4);
+			outbuf[i] = (tjs_uint8*)TJSAlignedAlloc((size_t)blocksize + 10, 4);
+		if (text == NULL || inbuf == NULL || prevbuf == NULL) {
+			ret = TLG_ERROR;
+			goto errend;
+		}
+		for(tjs_int i = 0; i < colors; i++) {
+			if (outbuf[i] == NULL) {
+				ret = TLG_ERROR;
+				goto errend;
+			}
+		}
+		memset(text, 0, 4096);
 
 		tjs_uint8 *prevline = NULL;
 		for(tjs_int y_blk = 0; y_blk < height; y_blk += blockheight)
@@ -97,7 +203,8 @@ int TVPLoadTLG5(void *callbackdata,
 			for(tjs_int c = 0; c < colors; c++)
 			{
 				tjs_uint32 size;
-				if (!src->ReadBuffer(mark, 1) || !src->ReadI32LE(size)) {
+				if (!src->ReadBuffer(mark, 1) || !src->ReadI32LE(size) ||
+					size > blocksize) {
 					ret = TLG_ERROR;
 					goto errend;
 				}
@@ -193,9 +300,11 @@ int TVPLoadTLG5(void *callbackdata,
 						break;
 					}
 				}
+				// the caller may reuse or change its buffer once the line is
+				// handed over; keep the line for the next one
+				memcpy(prevbuf, current_org, (size_t)width * 4);
+				prevline = prevbuf;
 				scanlinecallback(callbackdata, -1);
-
-				prevline = current_org;
 			}
 		}
 	}
@@ -203,6 +312,7 @@ int TVPLoadTLG5(void *callbackdata,
 errend:
 	if(inbuf) TJSAlignedDealloc(inbuf);
 	if(text) TJSAlignedDealloc(text);
+	if(prevbuf) TJSAlignedDealloc(prevbuf);
 	for(tjs_int i = 0; i < colors; i++)
 		if(outbuf[i]) TJSAlignedDealloc(outbuf[i]);
 
@@ -214,12 +324,32 @@ errend:
 //---------------------------------------------------------------------------
 // TLG6 loading handler
 //---------------------------------------------------------------------------
+static void TVPTLG6StoreRawValues(tjs_int8 *pixelbuf, tjs_int pixel_count,
+	const tjs_uint8 *values, bool first)
+{
+	// store values of a raw or LZSS stream into pixelbuf, as
+	// TVPTLG6DecodeGolombValues(ForFirst) do.
+	if(first)
+	{
+		// clear the other components with zero
+		for(tjs_int i = 0; i < pixel_count; i++)
+		{
+			*(tjs_uint32*)(pixelbuf + i*4) = 0;
+			pixelbuf[i*4] = (tjs_int8)values[i];
+		}
+	}
+	else
+	{
+		for(tjs_int i = 0; i < pixel_count; i++) pixelbuf[i*4] = (tjs_int8)values[i];
+	}
+}
+
 int TVPLoadTLG6(void *callbackdata,
 				 tTVPGraphicSizeCallback sizecallback,
 				 tTVPGraphicScanLineCallback scanlinecallback,
 				 tTJSBinaryStream *src)
 {
-	TVPCreateTable();
+	TVPCreateTableOnce();
 
 	unsigned char buf[12];
 
@@ -246,9 +376,9 @@ int TVPLoadTLG6(void *callbackdata,
 		return TLG_ERROR;
 	}
 
-	if (buf[3] != 0) {
-		// external golomb table (currently always zero)
-		// "External golomb bit length table is not yet supported."
+	if (buf[3] > 1) {
+		// external golomb table (0: built-in, 1: follows max_bit_length)
+		// "Unsupported external golomb bit length table"
 		return TLG_ERROR;
 	}
 
@@ -260,6 +390,34 @@ int TVPLoadTLG6(void *callbackdata,
 		return TLG_ERROR;
 	}
 
+	// read external golomb bit length table;
+	// counts of each k for each n, as 16bit little endian.
+	tTVPTLG6GolombBitLengthTable external_table;
+	const char (*golomb_table)[TVP_TLG6_GOLOMB_N_COUNT] = TVPTLG6GolombBitLengthTable;
+	if (buf[3]) {
+		tTVPTLG6GolombCompressedTable compressed;
+		for (int n = 0; n < TVP_TLG6_GOLOMB_N_COUNT; n++) {
+			for (int k = 0; k < TVP_TLG6_GOLOMB_K_COUNT; k++) {
+				tjs_uint16 count;
+				if (!src->ReadI16LE(count)) {
+					return TLG_ERROR;
+				}
+				compressed[n][k] = (short int)count;
+			}
+		}
+		if (!TVPTLG6ExpandGolombTable(external_table, compressed)) {
+			// "Invalid external golomb bit length table"
+			return TLG_ERROR;
+		}
+		golomb_table = external_table;
+	}
+
+	if (width == 0 || width > TVP_TLG_MAX_WIDTH ||
+		height == 0 || height > TVP_TLG_MAX_HEIGHT) {
+		// "Invalid image size."
+		return TLG_ERROR;
+	}
+
 	// set destination size
 	if (sizecallback && !sizecallback(callbackdata, width, height)) {
 		return TLG_ABORT;
@@ -276,6 +434,7 @@ int TVPLoadTLG6(void *callbackdata,
 	tjs_uint32 *pixelbuf = NULL; // pixel buffer
 	tjs_uint8 *filter_types = NULL;
 	tjs_uint8 *LZSS_text = NULL;
+	tjs_uint8 *LZSS_values = NULL; // decoded values of LZSS streams
 	tjs_uint32 *zeroline = NULL;
 
 	int ret = TLG_SUCCESS;
@@ -283,20 +442,23 @@ int TVPLoadTLG6(void *callbackdata,
 	// allocate memories
 	bit_pool     = (tjs_uint8 *)TJSAlignedAlloc(max_bit_length / 8 + 5, 4);
 	pixelbuf     = (tjs_uint32 *)TJSAlignedAlloc(sizeof(tjs_uint32) * width * TVP_TLG6_H_BLOCK_SIZE + 1, 4);
-	filter_types = (tjs_uint8 *)TJSAlignedAlloc(x_block_count * y_block_count, 4);
+	filter_types = (tjs_uint8 *)TJSAlignedAlloc((size_t)x_block_count * y_block_count, 4);
 	zeroline     = (tjs_uint32 *)TJSAlignedAlloc(width * sizeof(tjs_uint32), 4);
 	LZSS_text    = (tjs_uint8*)TJSAlignedAlloc(4096, 4);
+	LZSS_values  = (tjs_uint8*)TJSAlignedAlloc((size_t)width * TVP_TLG6_H_BLOCK_SIZE, 4);
 
 	if (bit_pool == NULL ||
 		pixelbuf == NULL ||
 		filter_types == NULL ||
 		zeroline == NULL ||
-		LZSS_text == NULL) {
+		LZSS_text == NULL ||
+		LZSS_values == NULL) {
 		ret = TLG_ERROR;
 		goto errend;
 	}
 	
-	// initialize zero line (virtual y=-1 line)
+	// initialize zero line (virtual y=-1 line). once the first line is
+	// decoded, it holds a copy of the line above.
 	TVPFillARGB(zeroline, width, colors==3?0xff000000:0x00000000);
 	// 0xff000000 for colors=3 makes alpha value opaque
 
@@ -324,8 +486,13 @@ int TVPLoadTLG6(void *callbackdata,
 			ret = TLG_ERROR;
 			goto errend;
 		}
-		TVPTLG5DecompressSlide(filter_types, inbuf, inbuf_size, LZSS_text, 0);
+		tjs_int filter_count = TVPTLG5DecompressSlideBounded(filter_types,
+			x_block_count * y_block_count, inbuf, inbuf_size, LZSS_text, 0);
 		TJSAlignedDealloc(inbuf);
+		if (filter_count != x_block_count * y_block_count) {
+			ret = TLG_ERROR;
+			goto errend;
+		}
 
 		// for each horizontal block group ...
 		tjs_uint32 *prevline = zeroline;
@@ -349,6 +516,11 @@ int TVPLoadTLG6(void *callbackdata,
 				// get compress method
 				int method = (bit_length >> 30)&3;
 				bit_length &= 0x3fffffff;
+				if (bit_length > max_bit_length) {
+					// bit_pool is not large enough
+					ret = TLG_ERROR;
+					goto errend;
+				}
 
 				// compute byte length
 				tjs_int byte_length = bit_length / 8;
@@ -365,18 +537,38 @@ int TVPLoadTLG6(void *callbackdata,
 				// entropy coding method;
 				// 00 means Golomb method,
 				// 01 means Gamma method (not yet suppoted),
-				// 10 means modified LZSS method (not yet supported),
-				// 11 means raw (uncompressed) data (not yet supported).
+				// 10 means modified LZSS method,
+				// 11 means raw (uncompressed) data.
 
 				switch(method)
 				{
 				case 0:
-					if(c == 0 && colors != 1)
+					if(c == 0)
 						TVPTLG6DecodeGolombValuesForFirst((tjs_int8*)pixelbuf,
-							pixel_count, bit_pool);
+							pixel_count, bit_pool, golomb_table);
 					else
 						TVPTLG6DecodeGolombValues((tjs_int8*)pixelbuf + c,
-							pixel_count, bit_pool);
+							pixel_count, bit_pool, golomb_table);
+					break;
+				case 2:
+					// each LZSS stream starts with zero filled text at r = 0
+					memset(LZSS_text, 0, 4096);
+					// the stream must yield exactly one value per pixel
+					if (TVPTLG5DecompressSlideBounded(LZSS_values, pixel_count,
+						bit_pool, byte_length, LZSS_text, 0) != pixel_count) {
+						ret = TLG_ERROR;
+						goto errend;
+					}
+					TVPTLG6StoreRawValues((tjs_int8*)pixelbuf + c, pixel_count,
+						LZSS_values, c == 0);
+					break;
+				case 3:
+					if (byte_length != pixel_count) {
+						ret = TLG_ERROR;
+						goto errend;
+					}
+					TVPTLG6StoreRawValues((tjs_int8*)pixelbuf + c, pixel_count,
+						bit_pool, c == 0);
 					break;
 				default:
 					// "Unsupported entropy coding method"
@@ -430,8 +622,22 @@ int TVPLoadTLG6(void *callbackdata,
 						pixelbuf + start, colors==3?0xff000000:0, oddskip, dir);
 				}
 
+				if(colors == 1)
+				{
+					// gray; copy the only component (in blue) to green and red.
+					// other components do not affect blue when decoding the
+					// next line, as predictors work on each component.
+					for(tjs_uint32 x = 0; x < width; x++)
+					{
+						tjs_uint32 v = curline[x] & 0xff;
+						curline[x] = 0xff000000 | (v << 16) | (v << 8) | v;
+					}
+				}
+
+				// predict from a copy; the buffer of the caller may not
+				// hold this line any more after the callback
+				memcpy(zeroline, curline, width * sizeof(tjs_uint32));
 				scanlinecallback(callbackdata, -1);
-				prevline = curline;
 			}
 		}
 	}
@@ -442,6 +648,7 @@ errend:
 	if(filter_types) TJSAlignedDealloc(filter_types);
 	if(zeroline) TJSAlignedDealloc(zeroline);
 	if(LZSS_text) TJSAlignedDealloc(LZSS_text);
+	if(LZSS_values) TJSAlignedDealloc(LZSS_values);
 	return ret;
 }
 
@@ -449,16 +656,158 @@ errend:
 
 
 
+//---------------------------------------------------------------------------
+// TLG0.0 SDS tags
+//---------------------------------------------------------------------------
+/*
+	read a decimal length followed by "term" at data[pos].
+*/
+static bool TVPTLGParseTagLength(const char *data, tjs_uint32 size, tjs_uint32 &pos,
+								 char term, tjs_uint32 &len)
+{
+	tjs_uint64 value = 0;
+	tjs_uint32 start = pos;
+	while(pos < size && data[pos] >= '0' && data[pos] <= '9') {
+		value = value * 10 + (data[pos] - '0');
+		if (value > size) return false; // longer than the chunk anyway
+		pos++;
+	}
+	if (pos == start || pos >= size || data[pos] != term) return false;
+	pos++;
+	len = (tjs_uint32)value;
+	return true;
+}
+
+bool
+TVPTLGParseTagViews(const char *data, tjs_uint32 size, std::vector<tTVPTLGTagView> &tags)
+{
+	tjs_uint32 pos = 0;
+	while(pos < size) {
+		tjs_uint32 namelen, valuelen;
+		// Malformed TLG SDS tag structure, missing colon after name length
+		if (!TVPTLGParseTagLength(data, size, pos, ':', namelen)) return false;
+		// Malformed TLG SDS tag structure, name runs over the chunk or missing equals after name
+		if (namelen >= size - pos || data[pos + namelen] != '=') return false;
+		std::string_view name(data + pos, namelen);
+		pos += namelen + 1;
+		// Malformed TLG SDS tag structure, missing colon after value length
+		if (!TVPTLGParseTagLength(data, size, pos, ':', valuelen)) return false;
+		// Malformed TLG SDS tag structure, value runs over the chunk or missing comma after a tag
+		if (valuelen >= size - pos || data[pos + valuelen] != ',') return false;
+		std::string_view value(data + pos, valuelen);
+		pos += valuelen + 1;
+
+		tags.push_back(tTVPTLGTagView(name, value));
+	}
+	return true;
+}
+
+/*
+	store the tags of a "tags" chunk into name-value pairs. pairs before a
+	malformed part are stored.
+*/
+static bool TVPTLGParseTags(const char *data, tjs_uint32 size,
+							std::map<std::string,std::string> *tags)
+{
+	std::vector<tTVPTLGTagView> views;
+	bool ret = TVPTLGParseTagViews(data, size, views);
+	for (size_t i = 0; i < views.size(); i++) {
+		// TODO: utf-8 decode
+		(*tags)[std::string(views[i].first)].assign(views[i].second.data(), views[i].second.size());
+	}
+	return ret;
+}
+
+
+//---------------------------------------------------------------------------
+// TLG0.0 SDS chunks
+//---------------------------------------------------------------------------
+tTVPTLGChunkIterator::tTVPTLGChunkIterator(tTJSBinaryStream *src) :
+	Source(src), Forward(NULL), NextPos(0), Failed(false)
+{
+	if (src->CanSeek()) {
+		src->Seek(0, TJS_BS_SEEK_SET);
+	} else {
+		Forward = new tTVPTLGForwardStream(src);
+		Source = Forward;
+	}
+	unsigned char mark[11];
+	tjs_uint32 rawlen;
+	if (!Source->ReadBuffer(mark, 11) ||
+		memcmp("TLG0.0\x00sds\x1a\x00", mark, 11) ||
+		!Source->ReadI32LE(rawlen)) {
+		Failed = true;
+		return;
+	}
+	NextPos = (tjs_uint64)rawlen + 11 + 4;
+}
+
+tTVPTLGChunkIterator::tTVPTLGChunkIterator(tTJSBinaryStream *src, tjs_uint64 pos) :
+	Source(src), Forward(NULL), NextPos(pos), Failed(false)
+{
+}
+
+tTVPTLGChunkIterator::~tTVPTLGChunkIterator()
+{
+	delete Forward;
+}
+
+bool
+tTVPTLGChunkIterator::Next()
+{
+	if (Failed) return false;
+	// skip what is left of the current chunk
+	if (Source->Seek(NextPos, TJS_BS_SEEK_SET) != NextPos) {
+		Failed = true;
+		return false;
+	}
+	tjs_uint32 size;
+	if (Source->Read(Chunk.name, 4) != 4 || !Source->ReadI32LE(size)) {
+		// end of the stream
+		return false;
+	}
+	Chunk.offset = NextPos + 8;
+	Chunk.size = size;
+	NextPos = Chunk.offset + size;
+	return true;
+}
+
+const char *
+tTVPTLGChunkIterator::GetData()
+{
+	if (Failed) return NULL;
+	// memory backed streams give the contents in place
+	tjs_uint view_size = 0;
+	const void *view = Source->GetView(Chunk.offset, view_size);
+	if (view && view_size >= Chunk.size) {
+		return (const char *)view;
+	}
+	if (Source->Seek(Chunk.offset, TJS_BS_SEEK_SET) != Chunk.offset) {
+		Failed = true;
+		return NULL;
+	}
+	Buffer.resize(Chunk.size ? Chunk.size : 1);
+	if (!Source->ReadBuffer(&Buffer[0], Chunk.size)) {
+		Failed = true;
+		return NULL;
+	}
+	return &Buffer[0];
+}
+
+
 //---------------------------------------------------------------------------
 // TLG loading handler
 //---------------------------------------------------------------------------
 static int TVPInternalLoadTLG(void *callbackdata, tTVPGraphicSizeCallback sizecallback,
 							  tTVPGraphicScanLineCallback scanlinecallback,
-							  tTJSBinaryStream *src)
+							  tTJSBinaryStream *src,
+							  const unsigned char *readmark = NULL)
 {
-	// read header
+	// read header, unless the caller already has read it
 	unsigned char mark[12];
-	if (!src->ReadBuffer(mark, 11)) {
+	if (readmark) {
+		memcpy(mark, readmark, 11);
+	} else if (!src->ReadBuffer(mark, 11)) {
 		return TLG_ERROR;
 	}
 
@@ -498,26 +847,100 @@ TVPCheckTLG(tTJSBinaryStream *src)
 }
 
 
-struct SizeInfo {
-	int width;
-	int height;
-};
+//---------------------------------------------------------------------------
+// TLG probe
+//---------------------------------------------------------------------------
+/*
+	read the header of a raw TLG5/6 stream after its 11 byte mark.
+*/
+static int TVPProbeTLGRaw(tTJSBinaryStream *src, const unsigned char *mark,
+						  tTVPTLGInfo *info)
+{
+	unsigned char buf[4];
+	if(!memcmp("TLG5.0\x00raw\x1a\x00", mark, 11))
+	{
+		info->version = 5;
+		if (!src->ReadBuffer(buf, 1) ||
+			!src->ReadI32LE(info->width) ||
+			!src->ReadI32LE(info->height) ||
+			!src->ReadI32LE(info->block_height)) {
+			return TLG_ERROR;
+		}
+		info->colors = buf[0];
+	}
+	else if(!memcmp("TLG6.0\x00raw\x1a\x00", mark, 11))
+	{
+		info->version = 6;
+		if (!src->ReadBuffer(buf, 4) ||
+			!src->ReadI32LE(info->width) ||
+			!src->ReadI32LE(info->height) ||
+			!src->ReadI32LE(info->max_bit_length)) {
+			return TLG_ERROR;
+		}
+		info->colors = buf[0];
+		info->external_golomb_table = buf[3] != 0;
+	}
+	else
+	{
+		return TLG_ERROR;
+	}
+	return TLG_SUCCESS;
+}
 
-static bool getSize(void *callbackdata, tjs_uint w, tjs_uint h)
+int
+TVPProbeTLG(tTJSBinaryStream *src, tTVPTLGInfo *info)
 {
-	SizeInfo *info = (SizeInfo*)callbackdata;
-	info->width = w;
-	info->height = h;
-	return false;
+	*info = tTVPTLGInfo();
+
+	tTVPTLGForwardStream forward(src);
+	if (src->CanSeek()) {
+		src->Seek(0, TJS_BS_SEEK_SET); // rewind
+	} else {
+		// the chunks can be reached only by reading through the raw data
+		src = &forward;
+	}
+
+	unsigned char mark[12];
+	if (!src->ReadBuffer(mark, 11)) {
+		return TLG_ERROR;
+	}
+
+	if(memcmp("TLG0.0\x00sds\x1a\x00", mark, 11))
+	{
+		return TVPProbeTLGRaw(src, mark, info);
+	}
+
+	info->sds = true;
+	tjs_uint rawlen;
+	if (!src->ReadI32LE(rawlen) || !src->ReadBuffer(mark, 11)) {
+		return TLG_ERROR;
+	}
+	info->raw_size = rawlen;
+	int ret = TVPProbeTLGRaw(src, mark, info);
+	if (ret != TLG_SUCCESS) {
+		return ret;
+	}
+
+	tTVPTLGChunkIterator it(src, (tjs_uint64)rawlen + 11 + 4);
+	while (it.Next()) {
+		info->chunks.push_back(it.GetChunk());
+		if (!memcmp(it.GetChunk().name, "tags", 4)) {
+			const char *data = it.GetData();
+			if (!data || !TVPTLGParseTags(data, it.GetChunk().size, &info->tags)) {
+				return TLG_ERROR;
+			}
+		}
+	}
+	return it.HasError() ? TLG_ERROR : TLG_SUCCESS;
 }
 
 bool
 TVPGetInfoTLG(tTJSBinaryStream *src, int *width, int *height)
 {
-	SizeInfo size;
-	if (TVPLoadTLG(&size, getSize, NULL, NULL, src) == TLG_ABORT) {
-		if (width) { *width = size.width; }
-		if (height) { *height = size.height; }
+	tTVPTLGInfo info;
+	if (TVPProbeTLG(src, &info) == TLG_SUCCESS) {
+		if (width) { *width = info.width; }
+		if (height) { *height = info.height; }
 		return true;
 	}
 	return false;
@@ -530,7 +953,13 @@ TVPLoadTLG(void *callbackdata,
 		   std::map<std::string,std::string> *tags,
 		   tTJSBinaryStream *src)
 {
-	src->Seek(0, TJS_BS_SEEK_SET); // rewind
+	tTVPTLGForwardStream forward(src);
+	if (src->CanSeek()) {
+		src->Seek(0, TJS_BS_SEEK_SET); // rewind
+	} else {
+		// read from the current position, skipping instead of seeking
+		src = &forward;
+	}
 	// read header
 	unsigned char mark[12];
 	if (!src->ReadBuffer(mark, 11)) {
@@ -560,99 +989,70 @@ TVPLoadTLG(void *callbackdata,
 			return ret;
 		}
 		
-		// seek to meta info data point
-		src->Seek(rawlen + 11 + 4, TJS_BS_SEEK_SET);
-
 		// read tag data
-
-		bool check = true;
-
-		while(check) {
-			char chunkname[4];
-			if(4 != src->Read(chunkname, 4)) break;
-			// cannot read more
-			tjs_uint chunksize;
-
-			if (!src->ReadI32LE(chunksize)) {
-				break;
-			}
-
-			if(!memcmp(chunkname, "tags", 4))
-			{
-				// tag information
-				char *tag = NULL;
-				std::string name;
-				std::string value;
-
-				tag = new char [chunksize + 1];
-				if (!src->ReadBuffer(tag, chunksize)) {
-					break;
-				}
-				tag[chunksize] = 0;
-
-				if (tags) {
-
-					const char *tagp = tag;
-					const char *tagp_lim = tag + chunksize;
-					while(tagp < tagp_lim) {
-						tjs_uint namelen = 0;
-						while(*tagp >= '0' && *tagp <= '9') {
-							namelen = namelen * 10 + *tagp - '0', tagp++;
-						}
-						if (*tagp != ':') {
-							// Malformed TLG SDS tag structure, missing colon after name length
-							check = false;
-							break;
-						}
-						tagp ++;
-						name = std::string(tagp, namelen);
-						tagp += namelen;
-						if(*tagp != '=') {
-							// Malformed TLG SDS tag structure, missing equals after name
-							check = false;
-							break;
-						}
-						tagp++;
-						tjs_uint valuelen = 0;
-						while(*tagp >= '0' && *tagp <= '9')
-							valuelen = valuelen * 10 + *tagp - '0', tagp++;
-						if(*tagp != ':') {
-							// Malformed TLG SDS tag structure, missing colon after value length
-							check = false;
-							break;
-						}
-						tagp++;
-						value = std::string(tagp, valuelen);
-						tagp += valuelen;
-						if(*tagp != ',') {
-							// Malformed TLG SDS tag structure, missing comma after a tag
-							check = false;
-							break;
-						}
-						tagp++;
-						
-						// insert into name-value pairs ... TODO: utf-8 decode
-						(*tags)[name] = value;
+		if (tags) {
+			tTVPTLGChunkIterator it(src, (tjs_uint64)rawlen + 11 + 4);
+			while (it.Next()) {
+				if (!memcmp(it.GetChunk().name, "tags", 4)) {
+					const char *data = it.GetData();
+					if (!data || !TVPTLGParseTags(data, it.GetChunk().size, tags)) {
+						break;
 					}
 				}
-				if(tag) delete [] tag;
 			}
-			else
-			{
-				// skip the chunk
-				src->SetPosition(src->GetPosition() + chunksize);
-			}
-		} // while
+		}
 
 		return ret;
 	}
 	else
 	{
-		src->Seek(0, TJS_BS_SEEK_SET); // rewind
-
 		// try to load TLG raw data
-		return TVPInternalLoadTLG(callbackdata, sizecallback, scanlinecallback, src);
+		return TVPInternalLoadTLG(callbackdata, sizecallback, scanlinecallback, src, mark);
+	}
+}
+
+int
+TVPLoadTLGThumbnail(void *callbackdata,
+					tTVPGraphicSizeCallback sizecallback,
+					tTVPGraphicScanLineCallback scanlinecallback,
+					tTJSBinaryStream *src,
+					bool *thumbnail)
+{
+	if (thumbnail) *thumbnail = false;
+
+	if (!src->CanSeek()) {
+		// the image itself is needed if there is no thumbnail
+		std::vector<tjs_uint8> data;
+		tjs_uint8 buf[4096];
+		tjs_uint size;
+		while ((size = src->Read(buf, sizeof(buf))) > 0) {
+			data.insert(data.end(), buf, buf + size);
+		}
+		if (data.empty()) {
+			return TLG_ERROR;
+		}
+		tTJSMemoryReadStream mem(&data[0], data.size());
+		return TVPLoadTLGThumbnail(callbackdata, sizecallback, scanlinecallback, &mem, thumbnail);
+	}
+
+	{
+		// a file without sds simply has no chunk
+		tTVPTLGChunkIterator it(src);
+		while (it.Next()) {
+			if (!memcmp(it.GetChunk().name, "thmb", 4)) {
+				const char *data = it.GetData();
+				if (!data) {
+					break;
+				}
+				tTJSMemoryReadStream thumbsrc(data, it.GetChunk().size);
+				if (thumbnail) *thumbnail = true;
+				return TVPLoadTLG(callbackdata, sizecallback, scanlinecallback, NULL, &thumbsrc);
+			}
+		}
 	}
+
+	// no thumbnail; decode the image itself
+	return TVPLoadTLG(callbackdata, sizecallback, scanlinecallback, NULL, src);
 }
 
 //---------------------------------------------------------------------------
@@ -1,8 +1,638 @@
 #include "TLG.h"
+#include "byteorder.h"
 #include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
 
-extern int SaveTLG5(tTJSBinaryStream *out, int width, int height, int colors, void *callback, tTVPGraphicScanLineCallback scanlinecallback);
-extern int SaveTLG6(tTJSBinaryStream *out, int width, int height, int colors, void *callback, tTVPGraphicScanLineCallback scanlinecallback);
+extern int SaveTLG5(tTJSBinaryStream *out, int width, int height, int colors, void *callback, tTVPGraphicScanLineCallback scanlinecallback, const tTVPTLGSaveOption *option);
+extern int SaveTLG6(tTJSBinaryStream *out, int width, int height, int colors, void *callback, tTVPGraphicScanLineCallback scanlinecallback, const tTVPTLGSaveOption *option);
+extern tTJSBinaryStream *GetMemoryStream();
+
+//---------------------------------------------------------------------------
+// content analysis
+//---------------------------------------------------------------------------
+
+// count of lines kept by scanline sources below
+#define TVP_TLG_LINE_CACHE_LINES 16
+
+/*
+	scanline source which replaces the color of fully transparent pixels
+	(alpha = 0) with the predicted value from the neighboring pixels, so
+	that the residual of the color is zero there. the prediction is the
+	one of the saver: MED for TLG6, and left + upper - upper left for
+	TLG5 (which makes its delta zero). pixels out of the image are zero,
+	as savers do. lines depend on the normalized line above, so they are
+	made from the top in order.
+*/
+struct tTVPTLGNormalizedSource
+{
+	void *callback;
+	tTVPGraphicScanLineCallback scanlinecallback;
+	int width;
+	bool med; // true for TLG6 (MED), false for TLG5
+	tjs_int nexty; // next line to normalize
+	tjs_int cachey[TVP_TLG_LINE_CACHE_LINES];
+	unsigned char *cache;
+};
+
+static bool
+TVPTLGNormalizeLine(tTVPTLGNormalizedSource *src, tjs_int y)
+{
+	const unsigned char *in = (const unsigned char *)src->scanlinecallback(src->callback, y);
+	if (in == NULL) {
+		return false;
+	}
+
+	int linebytes = src->width * 4;
+	unsigned char *out = src->cache + (y % TVP_TLG_LINE_CACHE_LINES) * linebytes;
+	const unsigned char *upper = y > 0 ?
+		src->cache + ((y - 1) % TVP_TLG_LINE_CACHE_LINES) * linebytes : NULL;
+	memcpy(out, in, linebytes);
+
+	for (int x = 0; x < src->width; x++) {
+		unsigned char *p = out + x * 4;
+		if (p[3] != 0) continue;
+		for (int c = 0; c < 3; c++) {
+			int a = x > 0 ? p[c - 4] : 0;
+			int b = upper ? upper[x * 4 + c] : 0;
+			int d = (x > 0 && upper) ? upper[x * 4 + c - 4] : 0;
+			int v;
+			if (src->med) {
+				int min_a_b = a > b ? b : a;
+				int max_a_b = a < b ? b : a;
+				if (d >= max_a_b)
+					v = min_a_b;
+				else if (d < min_a_b)
+					v = max_a_b;
+				else
+					v = a + b - d;
+			} else {
+				v = a + b - d;
+			}
+			p[c] = (unsigned char)v;
+		}
+	}
+
+	src->cachey[y % TVP_TLG_LINE_CACHE_LINES] = y;
+	return true;
+}
+
+static void *
+TVPTLGNormalizedScanLine(void *callbackdata, tjs_int y)
+{
+	tTVPTLGNormalizedSource *src = (tTVPTLGNormalizedSource *)callbackdata;
+	if (y < 0) {
+		return NULL;
+	}
+
+	int slot = y % TVP_TLG_LINE_CACHE_LINES;
+	if (src->cachey[slot] != y) {
+		// a line already dropped from the cache; start over from the top
+		if (y < src->nexty) src->nexty = 0;
+		for (; src->nexty <= y; src->nexty++) {
+			if (!TVPTLGNormalizeLine(src, src->nexty)) {
+				return NULL;
+			}
+		}
+	}
+	return src->cache + slot * src->width * 4;
+}
+
+/*
+	finds the least color count which can represent the image.
+	an alpha channel which is all 255 is dropped (4 -> 3), and if B, G and
+	R are equal for every pixel the image is saved as 8bit gray (-> 1).
+	gray is only tried when "allowgray" (TLG5 does not support gray).
+*/
+static int
+TVPTLGAnalyzeColors(int width, int height, int colors,
+					void *callback,
+					tTVPGraphicScanLineCallback scanlinecallback,
+					bool allowgray, int &reduced)
+{
+	bool opaque = colors == 4;
+	bool gray = allowgray && colors >= 3;
+	for (int y = 0; y < height && (opaque || gray); y++) {
+		const unsigned char *line = (const unsigned char *)scanlinecallback(callback, y);
+		if (line == NULL) {
+			return TLG_ABORT;
+		}
+		for (int x = 0; x < width; x++, line += colors) {
+			if (opaque && line[3] != 255) opaque = false;
+			if (gray && (line[0] != line[1] || line[1] != line[2])) gray = false;
+		}
+	}
+
+	reduced = colors;
+	if (colors == 4 && opaque) reduced = 3;
+	if (gray && (colors == 3 || opaque)) reduced = 1;
+	return TLG_SUCCESS;
+}
+
+/*
+	scanline source which returns lines of the reduced color count.
+	savers ask the same line more than once and need the previous line
+	to stay valid, so converted lines are kept in a small cache indexed
+	by y.
+*/
+
+struct tTVPTLGReducedSource
+{
+	void *callback;
+	tTVPGraphicScanLineCallback scanlinecallback;
+	int width;
+	int srccolors;
+	int colors;
+	tjs_int cachey[TVP_TLG_LINE_CACHE_LINES];
+	unsigned char *cache;
+};
+
+static void *
+TVPTLGReducedScanLine(void *callbackdata, tjs_int y)
+{
+	tTVPTLGReducedSource *src = (tTVPTLGReducedSource *)callbackdata;
+	if (y < 0) {
+		return NULL;
+	}
+
+	int slot = y % TVP_TLG_LINE_CACHE_LINES;
+	unsigned char *line = src->cache + slot * src->width * src->colors;
+	if (src->cachey[slot] != y) {
+		const unsigned char *in = (const unsigned char *)src->scanlinecallback(src->callback, y);
+		if (in == NULL) {
+			return NULL;
+		}
+		unsigned char *p = line;
+		for (int x = 0; x < src->width; x++, in += src->srccolors) {
+			for (int c = 0; c < src->colors; c++) *(p++) = in[c];
+		}
+		src->cachey[slot] = y;
+	}
+	return line;
+}
+
+static int
+TVPSaveTLGReduced(int (*saveproc)(tTJSBinaryStream *, int, int, int, void *, tTVPGraphicScanLineCallback, const tTVPTLGSaveOption *),
+				 bool allowgray,
+				 tTJSBinaryStream *dest,
+				 int width, int height, int colors,
+				 void *callback,
+				 tTVPGraphicScanLineCallback scanlinecallback,
+				 const tTVPTLGSaveOption *option)
+{
+	int reduced = colors;
+	if (option->analyze_content) {
+		int ret = TVPTLGAnalyzeColors(width, height, colors, callback, scanlinecallback, allowgray, reduced);
+		if (ret != TLG_SUCCESS) {
+			return ret;
+		}
+	}
+	if (reduced == colors) {
+		return saveproc(dest, width, height, colors, callback, scanlinecallback, option);
+	}
+
+	tTVPTLGReducedSource src;
+	src.callback = callback;
+	src.scanlinecallback = scanlinecallback;
+	src.width = width;
+	src.srccolors = colors;
+	src.colors = reduced;
+	for (int i = 0; i < TVP_TLG_LINE_CACHE_LINES; i++) src.cachey[i] = -1;
+	src.cache = new unsigned char[(size_t)TVP_TLG_LINE_CACHE_LINES * width * reduced];
+	// the line cache is not for several threads
+	tTVPTLGSaveOption serialoption = *option;
+	serialoption.tlg6_parallel = NULL;
+	int ret;
+	try {
+		ret = saveproc(dest, width, height, reduced, &src, TVPTLGReducedScanLine, &serialoption);
+	} catch (...) {
+		delete [] src.cache;
+		throw;
+	}
+	delete [] src.cache;
+	return ret;
+}
+
+static int
+TVPSaveTLGStream(int (*saveproc)(tTJSBinaryStream *, int, int, int, void *, tTVPGraphicScanLineCallback, const tTVPTLGSaveOption *),
+				 bool allowgray,
+				 tTJSBinaryStream *dest,
+				 int width, int height, int colors,
+				 void *callback,
+				 tTVPGraphicScanLineCallback scanlinecallback,
+				 const tTVPTLGSaveOption *option)
+{
+	if (!option->normalize_transparent || colors != 4) {
+		return TVPSaveTLGReduced(saveproc, allowgray, dest, width, height, colors, callback, scanlinecallback, option);
+	}
+
+	tTVPTLGNormalizedSource src;
+	src.callback = callback;
+	src.scanlinecallback = scanlinecallback;
+	src.width = width;
+	src.med = saveproc == SaveTLG6;
+	src.nexty = 0;
+	for (int i = 0; i < TVP_TLG_LINE_CACHE_LINES; i++) src.cachey[i] = -1;
+	src.cache = new unsigned char[(size_t)TVP_TLG_LINE_CACHE_LINES * width * 4];
+	// lines are normalized from the top, one after another
+	tTVPTLGSaveOption serialoption = *option;
+	serialoption.tlg6_parallel = NULL;
+	int ret;
+	try {
+		ret = TVPSaveTLGReduced(saveproc, allowgray, dest, width, height, colors, &src, TVPTLGNormalizedScanLine, &serialoption);
+	} catch (...) {
+		delete [] src.cache;
+		throw;
+	}
+	delete [] src.cache;
+	return ret;
+}
+
+//---------------------------------------------------------------------------
+// trimming
+//---------------------------------------------------------------------------
+
+/*
+	finds the bounding box of the pixels whose alpha is not 0. the box of
+	a fully transparent image is its top left pixel.
+*/
+static int
+TVPTLGFindOpaqueBounds(int width, int height,
+					   void *callback,
+					   tTVPGraphicScanLineCallback scanlinecallback,
+					   int &left, int &top, int &right, int &bottom)
+{
+	left = width;
+	top = height;
+	right = bottom = 0;
+	for (int y = 0; y < height; y++) {
+		const unsigned char *line = (const unsigned char *)scanlinecallback(callback, y);
+		if (line == NULL) {
+			return TLG_ABORT;
+		}
+		int x0 = 0;
+		while (x0 < width && line[x0 * 4 + 3] == 0) x0++;
+		if (x0 == width) continue;
+		int x1 = width;
+		while (line[(x1 - 1) * 4 + 3] == 0) x1--;
+		if (x0 < left) left = x0;
+		if (x1 > right) right = x1;
+		if (y < top) top = y;
+		bottom = y + 1;
+	}
+	if (left >= right) {
+		left = top = 0;
+		right = bottom = 1;
+	}
+	return TLG_SUCCESS;
+}
+
+/*
+	scanline source which returns the lines of a box of another source
+*/
+struct tTVPTLGTrimmedSource
+{
+	void *callback;
+	tTVPGraphicScanLineCallback scanlinecallback;
+	int left;
+	int top;
+};
+
+static void *
+TVPTLGTrimmedScanLine(void *callbackdata, tjs_int y)
+{
+	tTVPTLGTrimmedSource *src = (tTVPTLGTrimmedSource *)callbackdata;
+	if (y < 0) {
+		return NULL;
+	}
+	unsigned char *line = (unsigned char *)src->scanlinecallback(src->callback, y + src->top);
+	return line ? line + src->left * 4 : NULL;
+}
+
+/*
+	add the offset of the box to the "LEFT" and "TOP" tags, and write the
+	size before trimming if asked and not given yet
+*/
+static void
+TVPTLGAdjustTrimTags(std::map<std::string,std::string> &tags,
+					 int left, int top, int width, int height, bool sizetags)
+{
+	static const char * const names[2] = { "LEFT", "TOP" };
+	int offsets[2] = { left, top };
+	for (int i = 0; i < 2; i++) {
+		std::map<std::string,std::string>::iterator it = tags.find(names[i]);
+		if (it == tags.end()) {
+			if (offsets[i]) tags[names[i]] = std::to_string(offsets[i]);
+		} else {
+			it->second = std::to_string(strtol(it->second.c_str(), NULL, 10) + offsets[i]);
+		}
+	}
+	if (sizetags) {
+		if (!tags.count("ORIGINAL_WIDTH")) tags["ORIGINAL_WIDTH"] = std::to_string(width);
+		if (!tags.count("ORIGINAL_HEIGHT")) tags["ORIGINAL_HEIGHT"] = std::to_string(height);
+	}
+}
+
+//---------------------------------------------------------------------------
+// thumbnail
+//---------------------------------------------------------------------------
+
+/*
+	preview image of "colors" (3 or 4) bytes per pixel
+*/
+struct tTVPTLGThumbnail
+{
+	int width;
+	int height;
+	int colors;
+	std::vector<unsigned char> pixels;
+};
+
+static void * TVPTLGThumbnailScanLine(void *callbackdata, tjs_int y)
+{
+	tTVPTLGThumbnail *thumb = (tTVPTLGThumbnail *)callbackdata;
+	if (y < 0) return NULL;
+	return &thumb->pixels[(size_t)y * thumb->width * thumb->colors];
+}
+
+/*
+	shrink the image to fit in size x size, keeping the aspect ratio, by
+	averaging the box of source pixels of each preview pixel. colors are
+	weighted by alpha so that hidden colors under transparent pixels do
+	not bleed. gray images are expanded to 3 colors as TLG5 has no gray.
+*/
+static int
+TVPTLGMakeThumbnail(int width, int height, int colors,
+					void *callback,
+					tTVPGraphicScanLineCallback scanlinecallback,
+					int size, tTVPTLGThumbnail &thumb)
+{
+	if (width >= height) {
+		thumb.width = width < size ? width : size;
+		thumb.height = (int)(((tjs_int64)height * thumb.width + width / 2) / width);
+	} else {
+		thumb.height = height < size ? height : size;
+		thumb.width = (int)(((tjs_int64)width * thumb.height + height / 2) / height);
+	}
+	if (thumb.width < 1) thumb.width = 1;
+	if (thumb.height < 1) thumb.height = 1;
+	thumb.colors = colors == 4 ? 4 : 3;
+	thumb.pixels.resize((size_t)thumb.width * thumb.height * thumb.colors);
+
+	// preview column of each source column
+	std::vector<int> column(width);
+	for (int x = 0; x < width; x++) column[x] = (int)((tjs_int64)x * thumb.width / width);
+
+	// sums of B, G, R (multiplied by alpha for 4 colors) and alpha
+	std::vector<tjs_uint64> sums((size_t)thumb.width * 4);
+	std::vector<tjs_uint32> counts(thumb.width);
+	int ty = 0;
+	for (int y = 0; y < height; y++) {
+		const unsigned char *line = (const unsigned char *)scanlinecallback(callback, y);
+		if (line == NULL) {
+			return TLG_ABORT;
+		}
+		for (int x = 0; x < width; x++, line += colors) {
+			tjs_uint64 *sum = &sums[(size_t)column[x] * 4];
+			switch (colors) {
+			case 1:
+				sum[0] += line[0]; sum[1] += line[0]; sum[2] += line[0];
+				break;
+			case 3:
+				sum[0] += line[0]; sum[1] += line[1]; sum[2] += line[2];
+				break;
+			default:
+				sum[0] += line[0] * line[3]; sum[1] += line[1] * line[3];
+				sum[2] += line[2] * line[3]; sum[3] += line[3];
+				break;
+			}
+			counts[column[x]]++;
+		}
+
+		// the last source line of the preview line finishes it
+		int nextty = (int)((tjs_int64)(y + 1) * thumb.height / height);
+		if (nextty == ty && y != height - 1) continue;
+		unsigned char *out = &thumb.pixels[(size_t)ty * thumb.width * thumb.colors];
+		for (int tx = 0; tx < thumb.width; tx++, out += thumb.colors) {
+			tjs_uint64 *sum = &sums[(size_t)tx * 4];
+			tjs_uint64 n = counts[tx];
+			if (thumb.colors == 3) {
+				for (int c = 0; c < 3; c++) out[c] = (unsigned char)((sum[c] + n / 2) / n);
+			} else {
+				tjs_uint64 a = sum[3];
+				for (int c = 0; c < 3; c++) out[c] = a ? (unsigned char)((sum[c] + a / 2) / a) : 0;
+				out[3] = (unsigned char)((a + n / 2) / n);
+			}
+		}
+		memset(&sums[0], 0, sums.size() * sizeof(tjs_uint64));
+		memset(&counts[0], 0, counts.size() * sizeof(tjs_uint32));
+		ty = nextty;
+	}
+	return TLG_SUCCESS;
+}
+
+/*
+	make the contents of a "thmb" chunk: a TLG5 stream of the preview
+*/
+static int
+TVPTLGSaveThumbnail(int width, int height, int colors,
+					void *callback,
+					tTVPGraphicScanLineCallback scanlinecallback,
+					int size, std::vector<unsigned char> &data)
+{
+	tTVPTLGThumbnail thumb;
+	int ret = TVPTLGMakeThumbnail(width, height, colors, callback, scanlinecallback, size, thumb);
+	if (ret != TLG_SUCCESS) {
+		return ret;
+	}
+	tTJSBinaryStream *mem = GetMemoryStream();
+	try {
+		tTVPTLGSaveOption option;
+		ret = SaveTLG5(mem, thumb.width, thumb.height, thumb.colors, &thumb, TVPTLGThumbnailScanLine, &option);
+		if (ret == TLG_SUCCESS) {
+			data.resize((size_t)mem->GetPosition());
+			mem->SetPosition(0);
+			if (!mem->ReadBuffer(&data[0], data.size())) {
+				ret = TLG_ERROR;
+			}
+		}
+	} catch (...) {
+		delete mem;
+		throw;
+	}
+	delete mem;
+	return ret;
+}
+
+//---------------------------------------------------------------------------
+// TLG0.0 SDS
+//---------------------------------------------------------------------------
+
+// size of the copy buffer of TVPTLGCopyRange
+#define TVP_TLG_COPY_BUFFER_SIZE (64*1024)
+
+/*
+	contents of a "tags" chunk
+*/
+static std::string TVPTLGBuildTags(const std::map<std::string,std::string> &tags)
+{
+	std::stringstream ss;
+	std::map<std::string,std::string>::const_iterator it = tags.begin();
+	while (it != tags.end()) {
+		ss << it->first.length() << ":" << it->first << "=" << it->second.length() << ":" << it->second << ",";
+		it++;
+	}
+	return ss.str();
+}
+
+/*
+	copy "size" bytes at "pos" of src to dest
+*/
+static bool TVPTLGCopyRange(tTJSBinaryStream *dest, tTJSBinaryStream *src, tjs_uint64 pos, tjs_uint64 size)
+{
+	tjs_uint64 end = pos + size;
+	// memory backed sources are written from their storage
+	tjs_uint view_size;
+	const void *view;
+	while (pos < end && (view = src->GetView(pos, view_size)) != NULL && view_size) {
+		if (view_size > end - pos) view_size = (tjs_uint)(end - pos);
+		if (!dest->WriteBuffer(view, view_size)) return false;
+		pos += view_size;
+	}
+	if (pos == end) return true;
+
+	if (src->Seek(pos, TJS_BS_SEEK_SET) != pos) return false;
+	std::vector<char> buf(TVP_TLG_COPY_BUFFER_SIZE);
+	while (pos < end) {
+		tjs_uint one = end - pos > buf.size() ? (tjs_uint)buf.size() : (tjs_uint)(end - pos);
+		if (!src->ReadBuffer(&buf[0], one) || !dest->WriteBuffer(&buf[0], one)) return false;
+		pos += one;
+	}
+	return true;
+}
+
+/*
+	write a chunk of a TLG0.0 sds
+*/
+static bool TVPTLGWriteChunk(tTJSBinaryStream *dest, const char *name, const void *data, tjs_uint32 size)
+{
+	unsigned char header[8];
+	memcpy(header, name, 4);
+	TVPTLGStoreInt32(header + 4, size);
+	tTJSBinaryStreamVec vecs[2];
+	vecs[0].buffer = header;
+	vecs[0].size = sizeof(header);
+	vecs[1].buffer = data;
+	vecs[1].size = size;
+	return dest->WriteVBuffer(vecs, size ? 2 : 1);
+}
+
+/**
+ * TLG画像のタグの書き換え
+ */
+int
+TVPRewriteTLGTags(tTJSBinaryStream *dest, tTJSBinaryStream *src,
+				  const std::map<std::string,std::string> *tags)
+{
+	if (!src->CanSeek()) {
+		// chunks are located by seeking; keep the whole source in memory
+		tTJSBinaryStream *mem = GetMemoryStream();
+		int ret;
+		try {
+			std::vector<char> buf(TVP_TLG_COPY_BUFFER_SIZE);
+			tjs_uint size;
+			while ((size = src->Read(&buf[0], (tjs_uint)buf.size())) > 0) {
+				if (!mem->WriteBuffer(&buf[0], size)) {
+					delete mem;
+					return TLG_ERROR;
+				}
+			}
+			ret = TVPRewriteTLGTags(dest, mem, tags);
+		} catch (...) {
+			delete mem;
+			throw;
+		}
+		delete mem;
+		return ret;
+	}
+
+	// locate the raw TLG stream
+	unsigned char mark[11];
+	src->Seek(0, TJS_BS_SEEK_SET);
+	if (!src->ReadBuffer(mark, 11)) {
+		return TLG_ERROR;
+	}
+	bool sds = !memcmp("TLG0.0\x00sds\x1a\x00", mark, 11);
+	tjs_uint64 rawpos, rawlen;
+	if (sds) {
+		tjs_uint32 len;
+		if (!src->ReadI32LE(len)) {
+			return TLG_ERROR;
+		}
+		rawpos = 11 + 4;
+		rawlen = len;
+	} else if (!memcmp("TLG5.0\x00raw\x1a\x00", mark, 11) ||
+			   !memcmp("TLG6.0\x00raw\x1a\x00", mark, 11)) {
+		rawpos = 0;
+		rawlen = src->Seek(0, TJS_BS_SEEK_END);
+		if (rawlen > 0xffffffff) {
+			return TLG_ERROR;
+		}
+	} else {
+		return TLG_ERROR;
+	}
+
+	std::string s;
+	if (tags) {
+		s = TVPTLGBuildTags(*tags);
+		if (s.length() > 0xffffffff) {
+			return TLG_ERROR;
+		}
+	}
+
+	if (!sds && s.empty()) {
+		// nothing to wrap
+		return TVPTLGCopyRange(dest, src, 0, rawlen) ? TLG_SUCCESS : TLG_ERROR;
+	}
+
+	unsigned char header[15];
+	memcpy(header, "TLG0.0\x00sds\x1a\x00", 11);
+	TVPTLGStoreInt32(header + 11, (tjs_uint32)rawlen);
+	if (!dest->WriteBuffer(header, sizeof(header)) ||
+		!TVPTLGCopyRange(dest, src, rawpos, rawlen)) {
+		return TLG_ERROR;
+	}
+
+	// keep the other chunks, putting the new tags where the old ones were
+	bool written = false;
+	if (sds) {
+		tTVPTLGChunkIterator it(src, rawpos + rawlen);
+		while (it.Next()) {
+			const tTVPTLGChunkInfo &chunk = it.GetChunk();
+			if (!memcmp(chunk.name, "tags", 4)) {
+				if (!written && !s.empty() &&
+					!TVPTLGWriteChunk(dest, "tags", s.c_str(), (tjs_uint32)s.length())) {
+					return TLG_ERROR;
+				}
+				written = true;
+				continue;
+			}
+			const char *data = it.GetData();
+			if (!data || !TVPTLGWriteChunk(dest, chunk.name, data, chunk.size)) {
+				return TLG_ERROR;
+			}
+		}
+		if (it.HasError()) {
+			return TLG_ERROR;
+		}
+	}
+	if (!written && !s.empty() &&
+		!TVPTLGWriteChunk(dest, "tags", s.c_str(), (tjs_uint32)s.length())) {
+		return TLG_ERROR;
+	}
+	return TLG_SUCCESS;
+}
 
 //---------------------------------------------------------------------------
 
@@ -16,6 +646,7 @@ extern int SaveTLG6(tTJSBinaryStream *out, int width, int height, int colors, vo
  * @param callbackdata コールバック用データ
  * @param scanlinecallback セーブデータ通知用コールバック(データが入っているアドレスを渡す)
  * @param tags 保存するタグ情報
+ * @param option 保存オプション(NULL で既定値)
  * @return 0:成功 1:中断 -1:エラー
  */
 int
@@ -24,65 +655,148 @@ TVPSaveTLG(tTJSBinaryStream *dest,
 		   int width, int height, int colors,
 		   void *callback,
 		   tTVPGraphicScanLineCallback scanlinecallback,
-		   const std::map<std::string,std::string> *tags)
+		   const std::map<std::string,std::string> *tags,
+		   const tTVPTLGSaveOption *option)
 {
-	int (*saveproc)(tTJSBinaryStream *, int, int, int, void *, tTVPGraphicScanLineCallback);
+	int (*saveproc)(tTJSBinaryStream *, int, int, int, void *, tTVPGraphicScanLineCallback, const tTVPTLGSaveOption *);
+	tTVPTLGSaveOption defaultoption;
+	if (option == NULL) {
+		option = &defaultoption;
+	}
+
+	if (width <= 0 || width > TVP_TLG_MAX_WIDTH || height <= 0 || height > TVP_TLG_MAX_HEIGHT) {
+		return TLG_ERROR;
+	}
+
+	if (option->trim_transparent && colors == 4) {
+		int left, top, right, bottom;
+		int ret = TVPTLGFindOpaqueBounds(width, height, callback, scanlinecallback, left, top, right, bottom);
+		if (ret != TLG_SUCCESS) {
+			return ret;
+		}
+		std::map<std::string,std::string> trimmedtags;
+		if (tags) trimmedtags = *tags;
+		TVPTLGAdjustTrimTags(trimmedtags, left, top, width, height, option->trim_size_tags);
+		tTVPTLGTrimmedSource src;
+		src.callback = callback;
+		src.scanlinecallback = scanlinecallback;
+		src.left = left;
+		src.top = top;
+		tTVPTLGSaveOption trimmedoption = *option;
+		trimmedoption.trim_transparent = false;
+		return TVPSaveTLG(dest, type, right - left, bottom - top, colors, &src, TVPTLGTrimmedScanLine,
+			&trimmedtags, &trimmedoption);
+	}
 
 	saveproc = (type == 0) ? SaveTLG5 : SaveTLG6;
+	bool allowgray = type != 0;
 	
-	// if no tags given, simply write TLG stream
-	if (tags == NULL || tags->size() == 0) {
-		return saveproc(dest, width, height, colors, callback, scanlinecallback);
+	// if no tags nor chunks given, simply write TLG stream
+	bool hastags = tags != NULL && tags->size() != 0;
+	bool haschunks = option->extra_chunks != NULL && !option->extra_chunks->empty();
+	if (!hastags && !option->thumbnail_size && !haschunks) {
+		return TVPSaveTLGStream(saveproc, allowgray, dest, width, height, colors, callback, scanlinecallback, option);
 	}
 
 	// タグありTLGファイルの処理
-	
-	// write TLG0.0 Structured Data Stream header
-	if (!dest->WriteBuffer("TLG0.0\x00sds\x1a\x00", 11)) {
-		return TLG_ERROR;
+
+	std::string s;
+	if (hastags) {
+		s = TVPTLGBuildTags(*tags);
+		if (s.length() > 0xffffffff) {
+			return TLG_ERROR;
+		}
 	}
 
-	tjs_uint64 rawlenpos = dest->GetPosition();
-	if (!dest->WriteBuffer("0000", 4)) {
-		return TLG_ERROR;
+	std::vector<unsigned char> thumbnail;
+	if (option->thumbnail_size) {
+		int ret = TVPTLGSaveThumbnail(width, height, colors, callback, scanlinecallback,
+			option->thumbnail_size > 0x10000 ? 0x10000 : (int)option->thumbnail_size, thumbnail);
+		if (ret != TLG_SUCCESS) {
+			return ret;
+		}
 	}
 
-	// write raw TLG stream
+	// TLG0.0 Structured Data Stream header and raw data size
+	unsigned char header[15];
+	memcpy(header, "TLG0.0\x00sds\x1a\x00", 11);
+	memset(header + 11, '0', 4);
+
+	tTJSBinaryStreamVec vecs[1];
 	int ret;
-	if ((ret = saveproc(dest, width, height, colors, callback, scanlinecallback)) != TLG_SUCCESS) {
-		return ret;
-	}
+	if (!dest->CanSeek()) {
+		// the raw data size cannot be patched afterwards; keep the raw TLG
+		// stream in memory and write everything once its size is known
+		tTJSBinaryStream *raw = GetMemoryStream();
+		try {
+			ret = TVPSaveTLGStream(saveproc, allowgray, raw, width, height, colors, callback, scanlinecallback, option);
+			tjs_uint64 rawlen = raw->GetPosition();
+			if (ret == TLG_SUCCESS && rawlen > 0xffffffff) {
+				// the raw data size field is 32bit
+				ret = TLG_ERROR;
+			}
+			if (ret == TLG_SUCCESS) {
+				TVPTLGStoreInt32(header + 11, (tjs_uint32)rawlen);
+				vecs[0].buffer = header;
+				vecs[0].size = sizeof(header);
+				if (!dest->WriteVBuffer(vecs, 1) || !dest->CopyFrom(raw, 0)) {
+					ret = TLG_ERROR;
+				}
+			}
+		} catch (...) {
+			delete raw;
+			throw;
+		}
+		delete raw;
+		if (ret != TLG_SUCCESS) {
+			return ret;
+		}
+	} else {
+		tjs_uint64 rawlenpos = dest->GetPosition() + 11;
+		if (!dest->WriteBuffer(header, sizeof(header))) {
+			return TLG_ERROR;
+		}
 
-	// write raw data size
-	tjs_uint64 pos_save = dest->GetPosition();
-	dest->SetPosition(rawlenpos);
-	int size = (int)(pos_save - rawlenpos - 4);
+		// write raw TLG stream
+		if ((ret = TVPSaveTLGStream(saveproc, allowgray, dest, width, height, colors, callback, scanlinecallback, option)) != TLG_SUCCESS) {
+			return ret;
+		}
 
-	if (!dest->WriteInt32(size)) {
-		return TLG_ERROR;
+		// write raw data size
+		tjs_uint64 pos_save = dest->GetPosition();
+		dest->SetPosition(rawlenpos);
+		tjs_uint64 rawlen = pos_save - rawlenpos - 4;
+		if (rawlen > 0xffffffff) {
+			return TLG_ERROR;
+		}
+
+		if (!dest->WriteInt32((tjs_uint32)rawlen)) {
+			return TLG_ERROR;
+		}
+		dest->SetPosition(pos_save);
 	}
-	dest->SetPosition(pos_save);
 
-	// write "tags" chunk name
-	if (!dest->WriteBuffer("tags", 4)) {
+	// write tag chunk
+	if (hastags && !TVPTLGWriteChunk(dest, "tags", s.c_str(), (tjs_uint32)s.length())) {
 		return TLG_ERROR;
 	}
 
-	// build tag chunk data
-	std::stringstream ss;
-	std::map<std::string,std::string>::const_iterator it = tags->begin();
-	while (it != tags->end()) {
-		ss << it->first.length() << ":" << it->first << "=" << it->second.length() << ":" << it->second << ",";
-		it++;
+	// write thumbnail chunk
+	if (!thumbnail.empty() &&
+		!TVPTLGWriteChunk(dest, "thmb", &thumbnail[0], (tjs_uint32)thumbnail.size())) {
+		return TLG_ERROR;
 	}
 
-	std::string s = ss.str();
-
-	// write tag chunk
-	if (!dest->WriteInt32(s.length()) ||
-		!dest->WriteBuffer(s.c_str(), s.length())) {
-		return TLG_ERROR;
+	// write other chunks
+	if (haschunks) {
+		for (size_t i = 0; i < option->extra_chunks->size(); i++) {
+			const tTVPTLGChunk &chunk = (*option->extra_chunks)[i];
+			if (chunk.data.size() > 0xffffffff ||
+				!TVPTLGWriteChunk(dest, chunk.name, chunk.data.empty() ? NULL : &chunk.data[0], (tjs_uint32)chunk.data.size())) {
+				return TLG_ERROR;
+			}
+		}
 	}
-	
+
 	return TLG_SUCCESS;
 }
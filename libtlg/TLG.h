@@ -16,6 +16,9 @@
 #include "stream.h"
 #include <string>
 #include <map>
+#include <vector>
+#include <string_view>
+#include <string.h>
 
 //---------------------------------------------------------------------------
 // Graphic Loading Handler Type
@@ -47,6 +50,346 @@ typedef void * (*tTVPGraphicScanLineCallback)(void *callbackdata, tjs_int y);
 #define TLG_ERROR  (-1)
 
 
+//---------------------------------------------------------------------------
+// image size limits
+//---------------------------------------------------------------------------
+
+// lines and row groups are indexed with 32bit ints, whole images with
+// 64bit sizes. images larger than these are rejected by savers and loaders.
+#define TVP_TLG_MAX_WIDTH  0x1000000
+#define TVP_TLG_MAX_HEIGHT 0x40000000
+
+
+//---------------------------------------------------------------------------
+// save options
+//---------------------------------------------------------------------------
+
+/*
+	TLG6 golomb bit length table, in compressed form.
+	for each n (0..3: position in the group of 4 values), the count of
+	"a"s (sum of recent absolute errors, 0..1023) assigned to each golomb
+	bit length k (0..8), in order of k. each row must sum to 1024.
+*/
+struct tTVPTLG6GolombTable
+{
+	short int Counts[4][9];
+};
+
+/*
+	runs task(taskdata, 0) .. task(taskdata, count - 1) and returns when all
+	of them have finished. the tasks may run on other threads at the same
+	time.
+*/
+typedef void (*tTVPTLGTaskProc)(void *taskdata, tjs_int index);
+typedef void (*tTVPTLGParallelCallback)(void *callbackdata, tjs_int count, tTVPTLGTaskProc task, void *taskdata);
+
+/*
+	statistics to train a TLG6 golomb bit length table.
+	total code bits of the values seen at each (n, a), for each k.
+*/
+struct tTVPTLG6GolombStatistics
+{
+	tjs_uint64 Bits[4][1024][9];
+
+	tTVPTLG6GolombStatistics() { Clear(); }
+	void Clear() { memset(Bits, 0, sizeof(Bits)); }
+};
+
+/*
+	entropy coding method selection of TLG6 row groups.
+*/
+enum tTVPTLG6EntropyMode
+{
+	/*
+		golomb only. other TLG6 decoders support only this.
+	*/
+	temGolomb,
+
+	/*
+		the smallest one of golomb, LZSS and raw for each stream.
+	*/
+	temSmallest,
+
+	/*
+		weigh the decoding cost of each method as well as the size;
+		LZSS and raw streams are chosen unless golomb is clearly smaller.
+	*/
+	temFastDecode
+};
+
+/*
+	a chunk to be written to a TLG0.0 structured data stream.
+*/
+struct tTVPTLGChunk
+{
+	char name[4];
+	std::vector<tjs_uint8> data;
+};
+
+/*
+	optional parameters of TVPSaveTLG.
+	a default constructed option gives the same output as passing no option.
+*/
+struct tTVPTLGSaveOption
+{
+	/*
+		TLG6: write compressed row groups directly to the destination
+		instead of holding the whole compressed image in memory.
+		max_bit_length and the filter types are filled in afterwards; the
+		filter types are stored as LZSS literals then, so that their size is
+		known before the row groups are written.
+		if the destination cannot seek, row groups are spilled to a
+		temporary file and copied after the header.
+	*/
+	bool tlg6_direct_output;
+
+	/*
+		TLG6: how to choose the entropy coding method of each row group
+		stream. streams other than golomb need a decoder of this library.
+	*/
+	tTVPTLG6EntropyMode tlg6_entropy;
+
+	/*
+		TLG6: golomb bit length table to encode with; NULL for the built-in
+		table. a given table is stored in the file as an external golomb
+		table.
+	*/
+	const tTVPTLG6GolombTable *tlg6_golomb_table;
+
+	/*
+		TLG6: train a golomb bit length table from the image itself, and
+		store it as an external golomb table. prediction residuals of the
+		whole image are held in memory until the table is made.
+		overrides tlg6_golomb_table.
+	*/
+	bool tlg6_train_golomb_table;
+
+	/*
+		TLG6: if not NULL, statistics of the image are added to this, so
+		that a table can be trained over many images with
+		TVPTLG6TrainGolombTable.
+	*/
+	tTVPTLG6GolombStatistics *tlg6_golomb_statistics;
+
+	/*
+		scan the image before saving and save with the least color count
+		which represents it: an alpha channel which is all 255 is dropped,
+		and images whose B, G and R are all equal are saved as gray (TLG6
+		only). the scanline callback is asked for every line once more.
+	*/
+	bool analyze_content;
+
+	/*
+		for 4 colors: replace the color of fully transparent pixels (alpha
+		= 0) with the value the saver predicts from the neighbors, so that
+		it costs nothing. the color under such pixels is not kept.
+	*/
+	bool normalize_transparent;
+
+	/*
+		if not 0, a preview of the image which fits in this many pixels
+		wide and high is stored in a "thmb" chunk of the structured data
+		stream, as a TLG5 stream. pixels are averaged box by box (weighted
+		by alpha); the scanline callback is asked for every line once more.
+		TVPLoadTLGThumbnail reads it.
+	*/
+	tjs_uint thumbnail_size;
+
+	/*
+		chunks written to the structured data stream after the tags and
+		the thumbnail, such as the "dlta" chunk of TVPSaveTLGDelta. NULL
+		for none.
+	*/
+	const std::vector<tTVPTLGChunk> *extra_chunks;
+
+	/*
+		for 4 colors: save only the bounding box of the pixels whose alpha
+		is not 0. the offset of the box is added to the "LEFT" and "TOP"
+		tags (written if the offset is not 0), so that the engine places
+		the image where it was. the scanline callback is asked for every
+		line once more.
+	*/
+	bool trim_transparent;
+
+	/*
+		with trim_transparent: also write the size before trimming to the
+		"ORIGINAL_WIDTH" and "ORIGINAL_HEIGHT" tags, unless they are given.
+	*/
+	bool trim_size_tags;
+
+	/*
+		TLG6: if not NULL, the image is split into bands of row groups
+		which are predicted and entropy coded through this callback, each
+		into its own memory stream; the bands are written in order, so the
+		output is the same as without it. the scanline callback is then
+		called from several threads at once and must return any line at
+		any time, such as the lines of an image held in memory. not used
+		with tlg6_direct_output, tlg6_train_golomb_table,
+		tlg6_golomb_statistics, normalize_transparent or a color count
+		reduced by analyze_content.
+	*/
+	tTVPTLGParallelCallback tlg6_parallel;
+	void *tlg6_parallel_data;
+
+	tTVPTLGSaveOption() :
+		tlg6_direct_output(false),
+		tlg6_entropy(temGolomb),
+		tlg6_golomb_table(NULL),
+		tlg6_train_golomb_table(false),
+		tlg6_golomb_statistics(NULL),
+		analyze_content(false),
+		normalize_transparent(false),
+		thumbnail_size(0),
+		extra_chunks(NULL),
+		trim_transparent(false),
+		trim_size_tags(false),
+		tlg6_parallel(NULL),
+		tlg6_parallel_data(NULL)
+	{
+	}
+};
+
+
+//---------------------------------------------------------------------------
+// probe results
+//---------------------------------------------------------------------------
+
+/*
+	a chunk following the raw data in a TLG0.0 structured data stream.
+*/
+struct tTVPTLGChunkInfo
+{
+	char name[4];
+	tjs_uint64 offset; // offset of the chunk contents from the stream start
+	tjs_uint32 size;
+};
+
+/*
+	name and value of a tag, pointing into the contents of a "tags" chunk.
+*/
+typedef std::pair<std::string_view, std::string_view> tTVPTLGTagView;
+
+/*
+	walks the chunks following the raw data of a TLG0.0 structured data
+	stream. chunks are visited in file order; contents not asked for are
+	skipped by seeking (by reading on streams which cannot seek).
+*/
+class tTVPTLGChunkIterator
+{
+	tTJSBinaryStream *Source;
+	tTJSBinaryStream *Forward; // owned wrapper of a stream which cannot seek
+	tjs_uint64 NextPos;
+	bool Failed;
+	tTVPTLGChunkInfo Chunk;
+	std::vector<char> Buffer;
+
+public:
+	/*
+		read the sds header from the start of "src" (the current position
+		if it cannot seek). HasError() is true if src is not an sds.
+	*/
+	tTVPTLGChunkIterator(tTJSBinaryStream *src);
+
+	/*
+		start at the first chunk at "pos". src must be able to reach pos by
+		Seek(pos, TJS_BS_SEEK_SET).
+	*/
+	tTVPTLGChunkIterator(tTJSBinaryStream *src, tjs_uint64 pos);
+
+	~tTVPTLGChunkIterator();
+
+	/*
+		move to the next chunk. false at the end of the stream or on error.
+	*/
+	bool Next();
+
+	const tTVPTLGChunkInfo & GetChunk() const { return Chunk; }
+
+	/*
+		contents of the current chunk, GetChunk().size bytes. points into the
+		memory of the stream when the stream gives a view of it (GetView),
+		otherwise into a buffer of the iterator reused for later chunks.
+		valid until the next call of Next(). NULL on a read error.
+	*/
+	const char * GetData();
+
+	bool HasError() const { return Failed; }
+
+private:
+	tTVPTLGChunkIterator(const tTVPTLGChunkIterator &);
+	void operator=(const tTVPTLGChunkIterator &);
+};
+
+/*
+	header information of a TLG image, read by TVPProbeTLG.
+*/
+struct tTVPTLGInfo
+{
+	int version; // 5 or 6
+	int colors;
+	tjs_uint32 width;
+	tjs_uint32 height;
+	tjs_uint32 block_height; // TLG5 only
+	tjs_uint32 max_bit_length; // TLG6 only
+	bool external_golomb_table; // TLG6 only
+	bool sds; // wrapped in a TLG0.0 structured data stream
+	tjs_uint32 raw_size; // size of the raw data in the sds; 0 without sds
+	std::map<std::string,std::string> tags;
+	std::vector<tTVPTLGChunkInfo> chunks;
+
+	tTVPTLGInfo() :
+		version(0), colors(0), width(0), height(0), block_height(0),
+		max_bit_length(0), external_golomb_table(false), sds(false),
+		raw_size(0)
+	{
+	}
+};
+
+
+/*
+	a rectangle on an image.
+*/
+struct tTVPTLGRect
+{
+	tjs_uint32 left;
+	tjs_uint32 top;
+	tjs_uint32 width;
+	tjs_uint32 height;
+};
+
+/*
+	contents of the "dlta" chunk of a delta image, written by
+	TVPSaveTLGDelta. the raw TLG stream of a delta image holds the bounding
+	box of the changed rectangles; pixels of the box outside the rectangles
+	are 0. to show the variant, copy the rectangles from the decoded raw
+	stream (at left, top) onto the decoded base image.
+*/
+struct tTVPTLGDeltaInfo
+{
+	std::string base; // name of the base image
+	tjs_uint64 base_hash; // 64bit FNV-1a of the decoded 32bit pixels of the base
+	tjs_uint32 width; // size of the base and the variant
+	tjs_uint32 height;
+	tjs_uint32 left; // position of the raw image on the variant
+	tjs_uint32 top;
+	std::vector<tTVPTLGRect> rects; // changed rectangles, in variant coordinates
+
+	tTVPTLGDeltaInfo() :
+		base_hash(0), width(0), height(0), left(0), top(0)
+	{
+	}
+};
+
+/*
+	placement of a sub-image in an atlas image, stored in the "atls" chunk.
+*/
+struct tTVPTLGAtlasEntry
+{
+	std::string name;
+	tTVPTLGRect rect;
+};
+
+
 //---------------------------------------------------------------------------
 // functions
 //---------------------------------------------------------------------------
@@ -54,6 +397,7 @@ typedef void * (*tTVPGraphicScanLineCallback)(void *callbackdata, tjs_int y);
 /**
  * src 読み込み元ストリーム
  * TLG画像かどうかの判定
+ * シークできないストリームでは先頭に戻れないため、判定に読んだ分は消費される
  */
 bool
 TVPCheckTLG(tTJSBinaryStream *src);
@@ -67,6 +411,28 @@ TVPCheckTLG(tTJSBinaryStream *src);
 extern bool
 TVPGetInfoTLG(tTJSBinaryStream *src, int *width, int *height);
 
+/**
+ * TLG画像のヘッダ情報・タグ・チャンク一覧の取得
+ * 画素データは読まずに sds のチャンクまでシークする
+ * (シークできないストリームでは読み飛ばす)
+ * @param src 読み込み元ストリーム
+ * @param info 情報格納先
+ * @return 0:成功 -1:エラー
+ */
+extern int
+TVPProbeTLG(tTJSBinaryStream *src, tTVPTLGInfo *info);
+
+/**
+ * "tags" チャンクの内容をタグの名前と値に分解する
+ * 名前と値は data を直接指す(コピーしない)
+ * @param data チャンクの内容
+ * @param size チャンクのサイズ
+ * @param tags 分解したタグの追加先
+ * @return 形式が不正なら false(それまでのタグは追加される)
+ */
+extern bool
+TVPTLGParseTagViews(const char *data, tjs_uint32 size, std::vector<tTVPTLGTagView> &tags);
+
 /**
  * TLG画像のロード
  * @param dest 読み込み元ストリーム
@@ -75,6 +441,7 @@ TVPGetInfoTLG(tTJSBinaryStream *src, int *width, int *height);
  * @param scanlinecallback ロードデータ格納用コールバック
  * @param tags 読み込んだタグ情報の格納先
  * @return 0:成功 1:中断 -1:エラー
+ * シークできないストリーム(CanSeek() が false)は現在位置から前方にのみ読み進める
  */
 extern int
 TVPLoadTLG(void *callbackdata,
@@ -83,6 +450,24 @@ TVPLoadTLG(void *callbackdata,
 		   std::map<std::string,std::string> *tags,
 		   tTJSBinaryStream *src);
 
+/**
+ * TLG画像のサムネイルのロード
+ * "thmb" チャンク(tTVPTLGSaveOption::thumbnail_size で保存したもの)があればそれだけを読み、
+ * 無ければ画像全体をロードする
+ * @param callbackdata
+ * @param sizecallback サイズ情報格納用コールバック
+ * @param scanlinecallback ロードデータ格納用コールバック
+ * @param src 読み込み元ストリーム(シークできなければ全体をメモリに読み込む)
+ * @param thumbnail サムネイルを読んだら true, 画像全体を読んだら false の格納先(NULL 可)
+ * @return 0:成功 1:中断 -1:エラー
+ */
+extern int
+TVPLoadTLGThumbnail(void *callbackdata,
+					tTVPGraphicSizeCallback sizecallback,
+					tTVPGraphicScanLineCallback scanlinecallback,
+					tTJSBinaryStream *src,
+					bool *thumbnail = NULL);
+
 /**
  * TLG画像のセーブ
  * @param dest 格納先ストリーム
@@ -93,6 +478,7 @@ TVPLoadTLG(void *callbackdata,
  * @param callbackdata コールバック用データ
  * @param scanlinecallback セーブデータ通知用コールバック(データが入っているアドレスを渡す)
  * @param tags 保存するタグ情報
+ * @param option 保存オプション(NULL で既定値)
  * @return 0:成功 1:中断 -1:エラー
  */
 extern int
@@ -101,6 +487,115 @@ TVPSaveTLG(tTJSBinaryStream *dest,
 		   int width, int height, int colors,
 		   void *callbackdata,
 		   tTVPGraphicScanLineCallback scanlinecallback,
-		   const std::map<std::string,std::string> *tags);
+		   const std::map<std::string,std::string> *tags,
+		   const tTVPTLGSaveOption *option = NULL);
+
+/**
+ * TLG画像のタグの書き換え
+ * 画素データ(raw TLG5/6 ストリーム)と tags 以外のチャンクは再エンコードせずにそのままコピーする
+ * sds でない TLG5/6 画像は、タグがあれば sds で包む
+ * @param dest 格納先ストリーム
+ * @param src 読み込み元ストリーム(シークできなければ全体をメモリに読み込む)
+ * @param tags 新しいタグ情報(NULL または空ならタグチャンクを書かない)
+ * @return 0:成功 -1:エラー
+ */
+extern int
+TVPRewriteTLGTags(tTJSBinaryStream *dest, tTJSBinaryStream *src,
+				  const std::map<std::string,std::string> *tags);
+
+/**
+ * 差分TLG画像のセーブ
+ * ベース画像と比べて変化した矩形だけを、その外接矩形の画像として保存し、
+ * ベース画像の名前と矩形を "dlta" チャンクに書く
+ * @param dest 格納先ストリーム
+ * @param type 種別 0:TLG5 1:TLG6
+ * @param width 画像横幅(ベース画像と同じであること)
+ * @param height 画像縦幅(ベース画像と同じであること)
+ * @param colors 色数指定 1:8bitグレー 3:RGB 4:RGBA
+ * @param callbackdata コールバック用データ
+ * @param scanlinecallback セーブデータ通知用コールバック
+ * @param base ベース画像(TLG)の読み込み元ストリーム
+ * @param basename "dlta" チャンクに書くベース画像の名前
+ * @param tags 保存するタグ情報
+ * @param option 保存オプション(NULL で既定値, thumbnail_size は無視する)
+ * @return 0:成功 1:中断 -1:エラー
+ */
+extern int
+TVPSaveTLGDelta(tTJSBinaryStream *dest,
+				int type,
+				int width, int height, int colors,
+				void *callbackdata,
+				tTVPGraphicScanLineCallback scanlinecallback,
+				tTJSBinaryStream *base,
+				const std::string &basename,
+				const std::map<std::string,std::string> *tags,
+				const tTVPTLGSaveOption *option = NULL);
+
+/**
+ * 差分TLG画像の "dlta" チャンクの読み込み
+ * @param src 読み込み元ストリーム
+ * @param info 情報格納先
+ * @return 0:成功 -1:エラー(差分画像でない場合も含む)
+ */
+extern int
+TVPProbeTLGDelta(tTJSBinaryStream *src, tTVPTLGDeltaInfo *info);
+
+/**
+ * 差分TLG画像のロード
+ * ベース画像をデコードし、変化した矩形を重ねた画像を返す
+ * @param callbackdata
+ * @param sizecallback サイズ情報格納用コールバック
+ * @param scanlinecallback ロードデータ格納用コールバック
+ * @param tags 読み込んだタグ情報の格納先
+ * @param src 差分画像の読み込み元ストリーム(シークできなければ全体をメモリに読み込む)
+ * @param base ベース画像の読み込み元ストリーム
+ * @return 0:成功 1:中断 -1:エラー(ベース画像が保存時と異なる場合も含む)
+ */
+extern int
+TVPLoadTLGDelta(void *callbackdata,
+				tTVPGraphicSizeCallback sizecallback,
+				tTVPGraphicScanLineCallback scanlinecallback,
+				std::map<std::string,std::string> *tags,
+				tTJSBinaryStream *src,
+				tTJSBinaryStream *base);
+
+/**
+ * 64bit FNV-1a ハッシュの計算
+ * 差分画像の基準画像やパックのメンバーの照合に使う
+ * @param data データ
+ * @param size データのバイト数
+ * @return ハッシュ値
+ */
+extern tjs_uint64
+TVPTLGHashBytes(const void *data, size_t size);
+
+/**
+ * アトラス画像の "atls" チャンクの作成
+ * tTVPTLGSaveOption::extra_chunks に加えて保存する
+ * @param entries 部分画像の名前と位置
+ * @param chunk 作成したチャンクの格納先
+ * @return false:名前が長すぎる、または部分画像が多すぎる
+ */
+extern bool
+TVPTLGBuildAtlasChunk(const std::vector<tTVPTLGAtlasEntry> &entries, tTVPTLGChunk &chunk);
+
+/**
+ * アトラス画像の "atls" チャンクの読み込み
+ * 位置は画像の大きさと照合しないので、使う側で確かめること
+ * @param src 読み込み元ストリーム
+ * @param entries 部分画像の名前と位置の格納先
+ * @return 0:成功 -1:エラー(アトラス画像でない場合も含む)
+ */
+extern int
+TVPProbeTLGAtlas(tTJSBinaryStream *src, std::vector<tTVPTLGAtlasEntry> *entries);
+
+/**
+ * TLG6 ゴロム符号ビット長テーブルの作成
+ * @param stats 統計情報(tTVPTLGSaveOption::tlg6_golomb_statistics で収集したもの)
+ * @param table 作成したテーブルの格納先
+ */
+extern void
+TVPTLG6TrainGolombTable(const tTVPTLG6GolombStatistics *stats,
+						tTVPTLG6GolombTable *table);
 
 #endif
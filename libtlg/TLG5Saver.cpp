@@ -1,10 +1,42 @@
 //---------------------------------------------------------------------------
 
-#include "tlg.h"
+#include "TLG.h"
+#include "byteorder.h"
 #include "slide.h"
+#include <string.h>
+#include <vector>
 
 #define BLOCK_HEIGHT 4
 
+// compressed blocks are gathered into segments of (at least) this size and
+// the whole stream is written with one vectored write at the end, so the
+// count of writes does not depend on the image height.
+#define TLG5_SEGMENT_SIZE (1024*1024)
+
+// size of the header before the block size table
+#define TLG5_HEADER_SIZE 24
+
+struct tTLG5Segment
+{
+	unsigned char *data;
+	long used;
+	long capacity;
+};
+
+static unsigned char * TLG5ReserveSegment(std::vector<tTLG5Segment> &segments, long need)
+{
+	// returns a place where "need" bytes can be put
+	if(segments.empty() || segments.back().capacity - segments.back().used < need)
+	{
+		tTLG5Segment seg;
+		seg.capacity = need > TLG5_SEGMENT_SIZE ? need : TLG5_SEGMENT_SIZE;
+		seg.data = new unsigned char[seg.capacity];
+		seg.used = 0;
+		segments.push_back(seg);
+	}
+	return segments.back().data + segments.back().used;
+}
+
 /**
  * TLG5画像の保存
  * @param out 出力先
@@ -13,34 +45,28 @@
  * @param colors 色数指定 1/3/4
  * @param callback コールバック用パラメータ
  * @param scanlinecallback 行データを返すコールバック。NULL を返すと中断される。1つ前に渡したバッファは有効である必要がある
+ * @param option 保存オプション。TLG5 には該当するものがないので使用しない
  */
 int
 SaveTLG5(tTJSBinaryStream *out,
 		 int width, int height, int colors,
 		 void *callbackdata,
-		 tTVPGraphicScanLineCallback scanlinecallback)
+		 tTVPGraphicScanLineCallback scanlinecallback,
+		 const tTVPTLGSaveOption * /* option */)
 {
 	int ret = TLG_SUCCESS;
 
-	// header
-	if (!out->WriteBuffer("TLG5.0\x00raw\x1a\x00", 11) ||
-		!out->WriteBuffer(&colors, 1) ||
-		!out->WriteInt32(width) ||
-		!out->WriteInt32(height) ||
-		!out->WriteInt32(BLOCK_HEIGHT)) {
-		return TLG_ERROR;
-	}
-
 	int blockcount = (int)((height - 1) / BLOCK_HEIGHT) + 1;
 
 	// buffers/compressors
 	SlideCompressor * compressor = NULL;
 	unsigned char *cmpinbuf[4];
-	unsigned char *cmpoutbuf[4];
 	for(int i = 0; i < colors; i++)
-		cmpinbuf[i] = cmpoutbuf[i] = NULL;
+		cmpinbuf[i] = NULL;
 	long written[4];
-	int *blocksizes;
+	unsigned char *header = NULL; // header and block size table
+	std::vector<tTLG5Segment> segments;
+	std::vector<tTJSBinaryStreamVec> vecs;
 
 	// allocate buffers/compressors
 	try
@@ -48,22 +74,18 @@ SaveTLG5(tTJSBinaryStream *out,
 		compressor = new SlideCompressor();
 		for(int i = 0; i < colors; i++)
 		{
-			cmpinbuf[i] = new unsigned char [width * BLOCK_HEIGHT];
-			cmpoutbuf[i] = new unsigned char [width * BLOCK_HEIGHT * 9 / 4];
+			cmpinbuf[i] = new unsigned char [(size_t)width * BLOCK_HEIGHT];
 			written[i] = 0;
 		}
-		blocksizes = new int[blockcount];
+		header = new unsigned char[TLG5_HEADER_SIZE + (size_t)blockcount * 4];
 
-		tjs_uint64 blocksizepos = out->GetPosition();
-		// write block size header
-		// (later fill this)
-		for(int i = 0; i < blockcount; i++)
-		{
-			if(!out->WriteBuffer("    ", 4)) {
-				ret = TLG_ERROR;
-				goto errend;
-			}
-		}
+		// header
+		memcpy(header, "TLG5.0\x00raw\x1a\x00", 11);
+		header[11] = (unsigned char)colors;
+		TVPTLGStoreInt32(header + 12, width);
+		TVPTLGStoreInt32(header + 16, height);
+		TVPTLGStoreInt32(header + 20, BLOCK_HEIGHT);
+		// block size table follows; filled as blocks are compressed
 
 		//
 		int block = 0;
@@ -131,54 +153,57 @@ SaveTLG5(tTJSBinaryStream *out,
 				}
 			}
 
-			// compress buffer and write to the file
+			// compress buffer into the output segment
 
 			// LZSS
-			int blocksize = 0;
+			// width is limited to TVP_TLG_MAX_WIDTH, so this fits in 32bit
+			tjs_uint32 blocksize = 0;
 			for(int c = 0; c < colors; c++)
 			{
 				long wrote = 0;
+				unsigned char *p = TLG5ReserveSegment(segments,
+					1 + 4 + width * BLOCK_HEIGHT * 9 / 4);
 				compressor->Store();
 				compressor->Encode(cmpinbuf[c], inp,
-					cmpoutbuf[c], wrote);
+					p + 5, wrote);
+				long len;
 				if(wrote < inp)
 				{
-					if (!out->WriteBuffer("\x00", 1) ||
-						!out->WriteInt32(wrote) ||
-						!out->WriteBuffer(cmpoutbuf[c], wrote)) {
-						ret = TLG_ERROR;
-						goto errend;
-					}
-					blocksize += wrote + 4 + 1;
+					p[0] = 0;
+					len = wrote;
 				}
 				else
 				{
 					compressor->Restore();
-					if (!out->WriteBuffer("\x01", 1) ||
-						!out->WriteInt32(inp) ||
-						!out->WriteBuffer(cmpinbuf[c], inp)) {
-						ret = TLG_ERROR;
-						goto errend;
-					}
-					blocksize += inp + 4 + 1;
+					p[0] = 1;
+					memcpy(p + 5, cmpinbuf[c], inp);
+					len = inp;
 				}
+				TVPTLGStoreInt32(p + 1, len);
+				segments.back().used += len + 4 + 1;
+				blocksize += len + 4 + 1;
 				written[c] += wrote;
 			}
 
-			blocksizes[block] = blocksize;
+			TVPTLGStoreInt32(header + TLG5_HEADER_SIZE + (size_t)block * 4, blocksize);
 		}
 
-		// write block sizes
-		tjs_uint64 pos_save = out->GetPosition();
-		out->SetPosition(blocksizepos);
-		for(int i = 0; i < blockcount; i++)
+		// write the header, the block size table and all blocks at once
+		tTJSBinaryStreamVec vec;
+		vec.buffer = header;
+		vec.size = TLG5_HEADER_SIZE + (tjs_uint)blockcount * 4;
+		vecs.push_back(vec);
+		for(size_t i = 0; i < segments.size(); i++)
 		{
-			if (!out->WriteInt32(blocksizes[i])) {
-				ret = TLG_ERROR;
-				goto errend;
-			}
+			vec.buffer = segments[i].data;
+			vec.size = segments[i].used;
+			vecs.push_back(vec);
+		}
+		if(!out->WriteVBuffer(&vecs[0], (tjs_int)vecs.size()))
+		{
+			ret = TLG_ERROR;
+			goto errend;
 		}
-		out->SetPosition(pos_save);
 
 		// deallocate buffers/compressors
 	}
@@ -186,19 +211,19 @@ SaveTLG5(tTJSBinaryStream *out,
 	{
 		for(int i = 0; i < colors; i++)	{
 			if(cmpinbuf[i]) delete [] cmpinbuf[i];
-			if(cmpoutbuf[i]) delete [] cmpoutbuf[i];
 		}
 		if(compressor) delete compressor;
-		if(blocksizes) delete [] blocksizes;
+		if(header) delete [] header;
+		for(size_t i = 0; i < segments.size(); i++) delete [] segments[i].data;
 		throw;
 	}
 
 errend:
 	for(int i = 0; i < colors; i++)	{
 		if(cmpinbuf[i]) delete [] cmpinbuf[i];
-		if(cmpoutbuf[i]) delete [] cmpoutbuf[i];
 	}
 	if(compressor) delete compressor;
-	if(blocksizes) delete [] blocksizes;
+	if(header) delete [] header;
+	for(size_t i = 0; i < segments.size(); i++) delete [] segments[i].data;
 	return ret;
 }
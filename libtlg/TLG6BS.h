@@ -1,92 +1,219 @@
-//---------------------------------------------------------------------------
 #ifndef TLG6BS_H
 #define TLG6BS_H
 
-#include <vector>
+#include <string.h>
 #include "stream.h"
 
 // TLG6.0 bitstream output implementation
 
+// the golomb encoder gives up the unary part and stores the count as 8 bits
+// when the zeros would reach this byte count
+#define GOLOMB_GIVE_UP_BYTES 4
+
+// gamma codes of values below this are taken from the precomputed table
+#define TLG6_GAMMA_TABLE_SIZE 1024
+
+// golomb codes whose unary part is shorter than this are taken from the
+// precomputed table. the give-up point is never reached below this count,
+// whatever the current bit position is.
+#define TLG6_GOLOMB_TABLE_Q_LIMIT (GOLOMB_GIVE_UP_BYTES*8-8)
+
+// maximum value of golomb k
+#define TLG6_GOLOMB_MAX_K 8
+
+
+//---------------------------------------------------------------------------
+// precomputed code tables
+//---------------------------------------------------------------------------
+struct TLG6BitStreamTables
+{
+	// gamma code of v: code bits (LSB first) in lower 24 bits, length in upper 8 bits
+	tjs_uint32 Gamma[TLG6_GAMMA_TABLE_SIZE];
+
+	// golomb code of m with k: m>>k zeros, a terminating 1 and lower k bits of m.
+	// length is (m>>k) + 1 + k. only valid when (m>>k) < TLG6_GOLOMB_TABLE_Q_LIMIT.
+	tjs_uint32 Golomb[TLG6_GOLOMB_MAX_K+1][256];
+
+	TLG6BitStreamTables()
+	{
+		Gamma[0] = 0;
+		for(int v = 1; v < TLG6_GAMMA_TABLE_SIZE; v++)
+		{
+			int cnt = 0;
+			for(int t = v >> 1; t; t >>= 1) cnt++;
+			tjs_uint32 code = (1 << cnt) | ((v & ((1 << cnt) - 1)) << (cnt + 1));
+			Gamma[v] = code | ((cnt * 2 + 1) << 24);
+		}
 
+		for(int k = 0; k <= TLG6_GOLOMB_MAX_K; k++)
+		{
+			for(int m = 0; m < 256; m++)
+			{
+				int q = m >> k;
+				if(q < TLG6_GOLOMB_TABLE_Q_LIMIT)
+					Golomb[k][m] = ((((tjs_uint32)m & ((1 << k) - 1)) << 1) | 1) << q;
+				else
+					Golomb[k][m] = 0;
+			}
+		}
+	}
+
+	static const TLG6BitStreamTables & Get()
+	{
+		static const TLG6BitStreamTables tables;
+		return tables;
+	}
+};
+
+
+//---------------------------------------------------------------------------
+// TLG6BitStream
+//---------------------------------------------------------------------------
+/*
+	bits are gathered LSB first into a 64-bit accumulator. every PutBits
+	stores the whole accumulator to the buffer and advances by the count of
+	completed bytes, so no bit is written one at a time and PutBits itself
+	has no branch. this needs a slack of 8 bytes after the last byte
+	written; callers must Reserve() the space before putting bits.
+*/
 class TLG6BitStream
 {
 	int BufferBitPos; // bit position of output buffer
 	long BufferBytePos; // byte position of output buffer
 	tTJSBinaryStream * OutStream; // output stream
-	std::vector<unsigned char> Buffer; // output buffer
+	unsigned char * Buffer; // output buffer
 	long BufferCapacity; // output buffer capacity
+	tjs_uint64 Accum; // bits not yet completed to a byte
+	const TLG6BitStreamTables * Tables;
 
 public:
 	TLG6BitStream(tTJSBinaryStream * outstream) :
-		OutStream(outstream),
 		BufferBitPos(0),
 		BufferBytePos(0),
-		BufferCapacity(0)
+		OutStream(outstream),
+		Buffer(NULL),
+		BufferCapacity(0),
+		Accum(0),
+		Tables(&TLG6BitStreamTables::Get())
 	{
 	}
 
 	~TLG6BitStream()
 	{
 		Flush();
+		delete [] Buffer;
 	}
 
 public:
 	int GetBitPos() const { return BufferBitPos; }
 	long GetBytePos() const { return BufferBytePos; }
 
-	void Flush()
+	static long GetMaxGolombByteLength(long count)
+	{
+		// upper bound of bytes written by CompressValuesGolomb for "count" values.
+		// a value takes at most GOLOMB_GIVE_UP_BYTES*8+8+TLG6_GOLOMB_MAX_K bits
+		// and run length gamma codes take at most 1.5 bits per value.
+		return (count * (GOLOMB_GIVE_UP_BYTES*8+8+TLG6_GOLOMB_MAX_K+2)) / 8 + 1;
+	}
+
+	void Reserve(long bytes)
+	{
+		// make sure "bytes" more bytes can be put without checking the capacity
+		long need = BufferBytePos + bytes + 8 + 1;
+		if(need <= BufferCapacity) return;
+		unsigned char *newbuf = new unsigned char[need];
+		if(Buffer)
+		{
+			memcpy(newbuf, Buffer, BufferBytePos + 1);
+			delete [] Buffer;
+		}
+		Buffer = newbuf;
+		BufferCapacity = need;
+	}
+
+	bool Flush()
 	{
+		bool ret = true;
 		if((BufferBitPos || BufferBytePos))
 		{
 			if(BufferBitPos) BufferBytePos ++;
-			OutStream->Write(&Buffer[0], BufferBytePos);
+			ret = OutStream->WriteBuffer(Buffer, BufferBytePos);
 			BufferBytePos = 0;
 			BufferBitPos = 0;
+			Accum = 0;
 		}
-		BufferCapacity = 0;
+		return ret;
+	}
+
+	void Discard()
+	{
+		// drop the bits put since the last flush
+		BufferBytePos = 0;
+		BufferBitPos = 0;
+		Accum = 0;
 	}
 
 	long GetBitLength() const { return BufferBytePos * 8 + BufferBitPos; }
 
-	void Put1Bit(bool b)
+	void PutBits(tjs_uint64 v, int n)
 	{
-		if(BufferBytePos == BufferCapacity)
-		{
-			// need more bytes
-			long org_cap = BufferCapacity;
-			BufferCapacity += 0x1000;
-			Buffer.resize(BufferCapacity);
-			memset(&Buffer[0] + org_cap, 0, BufferCapacity - org_cap);
-		}
+		// put lower "n" bits of "v"; v must not have bits above n.
+		// n must not be larger than 56.
+		Accum |= v << BufferBitPos;
+		BufferBitPos += n;
+		unsigned char *p = Buffer + BufferBytePos;
+#if TJS_HOST_IS_BIG_ENDIAN
+		for(int i = 0; i < 8; i++) p[i] = (unsigned char)(Accum >> (i*8));
+#else
+		memcpy(p, &Accum, 8);
+#endif
+		int bytes = BufferBitPos >> 3;
+		BufferBytePos += bytes;
+		Accum >>= bytes << 3;
+		BufferBitPos &= 7;
+	}
 
-		if(b) Buffer[BufferBytePos] |= 1 << BufferBitPos;
-		BufferBitPos ++;
-		if(BufferBitPos == 8)
-		{
-			BufferBitPos = 0;
-			BufferBytePos ++;
-		}
+	void Put1Bit(bool b)
+	{
+		PutBits(b ? 1 : 0, 1);
 	}
 
 	void PutGamma(int v)
 	{
 		// Put a gamma code.
 		// v must be larger than 0.
-		int t = v;
-		t >>= 1;
-		int cnt = 0;
-		while(t)
+		if(v < TLG6_GAMMA_TABLE_SIZE)
 		{
-			Put1Bit(0);
-			t >>= 1;
-			cnt ++;
+			tjs_uint32 code = Tables->Gamma[v];
+			PutBits(code & 0xffffff, code >> 24);
+			return;
 		}
-		Put1Bit(1);
-		while(cnt--)
+
+		int cnt = 0;
+		for(int t = v >> 1; t; t >>= 1) cnt++;
+		PutBits((tjs_uint64)1 << cnt, cnt + 1);
+		PutBits(v & ((1 << cnt) - 1), cnt);
+	}
+
+	void PutGolomb(int m, int k)
+	{
+		// Put a golomb code of m (0 <= m < 256) with bit length k.
+		// when the zeros of unary part would reach GOLOMB_GIVE_UP_BYTES
+		// bytes boundary, the zeros are stopped there and m >> k is stored
+		// as 8 bits instead of the terminating 1.
+		int q = m >> k;
+		if(q < TLG6_GOLOMB_TABLE_Q_LIMIT)
 		{
-			Put1Bit(v&1);
-			v >>= 1;
+			PutBits(Tables->Golomb[k][m], q + 1 + k);
+			return;
 		}
+
+		tjs_uint64 low = m & ((1 << k) - 1);
+		int limit = GOLOMB_GIVE_UP_BYTES*8 - BufferBitPos;
+		if(q < limit)
+			PutBits(((low << 1) | 1) << q, q + 1 + k);
+		else
+			PutBits((((low << 8) | (q & 0xff))) << limit, limit + 8 + k);
 	}
 
 	void PutInterleavedGamma(int v)
@@ -100,13 +227,12 @@ public:
 		//  <=31 :           1x0x0x0x0
 		// and so on.
 		// v must be larger than 0.
-		
+
 		v --;
 		while(v)
 		{
 			v >>= 1;
-			Put1Bit(0);
-			Put1Bit(v&1);
+			PutBits((v&1) << 1, 2);
 		}
 		Put1Bit(1);
 	}
@@ -143,11 +269,7 @@ public:
 		// Put signed value into the bit pool, as length of "len".
 		// v must not be zero. abs(v) must be less than 257.
 		if(v > 0) v--;
-		while(len --)
-		{
-			Put1Bit(v&1);
-			v >>= 1;
-		}
+		PutValue(v, len);
 	}
 
 	static int GetNonzeroSignedBitLength(int v)
@@ -171,11 +293,14 @@ public:
 	void PutValue(long v, int len)
 	{
 		// put value "v" as length of "len"
-		while(len --)
+		tjs_uint64 t = (tjs_uint64)v;
+		while(len > 32)
 		{
-			Put1Bit(v&1);
-			v >>= 1;
+			PutBits(t & 0xffffffff, 32);
+			t >>= 32;
+			len -= 32;
 		}
+		PutBits(t & (((tjs_uint64)1 << len) - 1), len);
 	}
 
 };
@@ -1,17 +1,16 @@
  //---------------------------------------------------------------------------
 
-#include "tlg.h"
+#include "TLG.h"
 #include "slide.h"
 
 #include "TLG6BS.h"
 
-extern tTJSBinaryStream *GetMemoryStream();
-
 // Table for 'k' (predicted bit length) of golomb encoding
 // tvpgl.c にあるものを参照
-#define TVP_TLG6_GOLOMB_N_COUNT 4
-extern "C" char TVPTLG6GolombBitLengthTable[TVP_TLG6_GOLOMB_N_COUNT*2*128][TVP_TLG6_GOLOMB_N_COUNT];
-extern "C" void TVPCreateTable(void);
+#include "tvpgl.h"
+
+extern tTJSBinaryStream *GetMemoryStream();
+extern tTJSBinaryStream *GetTemporaryStream();
 
 #define MAX_COLOR_COMPONENTS 4
 
@@ -249,11 +248,13 @@ extern "C" void TVPCreateTable(void);
 #ifdef WRITE_VSTXT
 FILE *vstxt = fopen("vs.txt", "wt");
 #endif
-#define GOLOMB_GIVE_UP_BYTES 4
-void CompressValuesGolomb(TLG6BitStream &bs, char *buf, int size)
+void CompressValuesGolomb(TLG6BitStream &bs, char *buf, int size,
+	const tTVPTLG6GolombBitLengthTable table)
 {
 	// golomb encoding, -- http://oku.edu.mie-u.ac.jp/~okumura/compression/golomb/
 
+	bs.Reserve(TLG6BitStream::GetMaxGolombByteLength(size));
+
 	// run-length golomb method
 	bs.PutValue(buf[0]?1:0, 1); // initial value state
 
@@ -288,33 +289,9 @@ void CompressValuesGolomb(TLG6BitStream &bs, char *buf, int size)
 #ifdef WRITE_VSTXT
 				fprintf(vstxt, "%d ", e);
 #endif
-				int k = TVPTLG6GolombBitLengthTable[a][n];
+				int k = table[a][n];
 				int m = ((e >= 0) ? 2*e : -2*e-1) - 1;
-				int store_limit = bs.GetBytePos() + GOLOMB_GIVE_UP_BYTES;
-				bool put1 = true;
-				for(int c = (m >> k); c > 0; c--)
-				{
-					if(store_limit == bs.GetBytePos())
-					{
-						bs.PutValue(m >> k, 8);
-#ifdef WRITE_VSTXT
-						fprintf(vstxt, "[ %d ] ", m>>k);
-#endif
-						put1 = false;
-						break;
-					}
-					bs.Put1Bit(0);
-				}
-				if(store_limit == bs.GetBytePos())
-				{
-					bs.PutValue(m >> k, 8);
-#ifdef WRITE_VSTXT
-					fprintf(vstxt, "[ %d ] ", m>>k);
-#endif
-					put1 = false;
-				}
-				if(put1) bs.Put1Bit(1);
-				bs.PutValue(m, k);
+				bs.PutGolomb(m, k);
 				a += (m>>1);
 				if (--n < 0) {
 					a >>= 1; n = TVP_TLG6_GOLOMB_N_COUNT - 1;
@@ -338,6 +315,82 @@ void CompressValuesGolomb(TLG6BitStream &bs, char *buf, int size)
 	if(count) bs.PutGamma(count);
 }
 //---------------------------------------------------------------------------
+static void GatherGolombStatistics(tTVPTLG6GolombStatistics *stats, const char *buf, int size)
+{
+	// add code bits of each k for the non-zero values in buf, at (n, a) where
+	// CompressValuesGolomb would encode them. a and n do not depend on the
+	// table, so the statistics are valid for any table.
+	int n = TVP_TLG6_GOLOMB_N_COUNT - 1;
+	int a = 0;
+
+	for(int i = 0; i < size; i++)
+	{
+		int e = buf[i];
+		if(!e) continue;
+		int m = ((e >= 0) ? 2*e : -2*e-1) - 1;
+		tjs_uint64 *bits = stats->Bits[n][a];
+		for(int k = 0; k < TVP_TLG6_GOLOMB_K_COUNT; k++)
+		{
+			int unexp_bits = (m>>k);
+			if(unexp_bits >= (GOLOMB_GIVE_UP_BYTES*8-8/2))
+				unexp_bits = (GOLOMB_GIVE_UP_BYTES*8-8/2)+8;
+			bits[k] += unexp_bits + 1 + k;
+		}
+		a += (m>>1);
+		if (--n < 0) {
+			a >>= 1; n = TVP_TLG6_GOLOMB_N_COUNT - 1;
+		}
+	}
+}
+//---------------------------------------------------------------------------
+void TVPTLG6TrainGolombTable(const tTVPTLG6GolombStatistics *stats,
+	tTVPTLG6GolombTable *table)
+{
+	// for each n, find non-decreasing k over a which minimizes the total
+	// code bits, by dynamic programming over (a, k). the table can only
+	// express k which does not decrease as a grows.
+	// costs are doubled and a deviation from the built-in table costs
+	// one, so that "a"s never seen (or ties) follow the built-in table.
+	TVPCreateTableOnce();
+
+	unsigned char (*from)[TVP_TLG6_GOLOMB_K_COUNT] =
+		new unsigned char[TVP_TLG6_GOLOMB_A_COUNT][TVP_TLG6_GOLOMB_K_COUNT];
+
+	for(int n = 0; n < TVP_TLG6_GOLOMB_N_COUNT; n++)
+	{
+		// cost[k]: least cost of a = 0 .. current, ending with k
+		tjs_uint64 cost[TVP_TLG6_GOLOMB_K_COUNT];
+		for(int k = 0; k < TVP_TLG6_GOLOMB_K_COUNT; k++) cost[k] = 0;
+
+		for(int a = 0; a < TVP_TLG6_GOLOMB_A_COUNT; a++)
+		{
+			int builtin = TVPTLG6GolombBitLengthTable[a][n];
+			tjs_uint64 min = 0;
+			int mink = 0;
+			for(int k = 0; k < TVP_TLG6_GOLOMB_K_COUNT; k++)
+			{
+				if(k == 0 || cost[k] < min) min = cost[k], mink = k;
+				from[a][k] = (unsigned char)mink;
+				cost[k] = min + stats->Bits[n][a][k] * 2 +
+					(k == builtin ? 0 : 1);
+			}
+		}
+
+		int k = 0;
+		for(int i = 1; i < TVP_TLG6_GOLOMB_K_COUNT; i++)
+			if(cost[i] < cost[k]) k = i;
+
+		for(int i = 0; i < TVP_TLG6_GOLOMB_K_COUNT; i++) table->Counts[n][i] = 0;
+		for(int a = TVP_TLG6_GOLOMB_A_COUNT - 1; a >= 0; a--)
+		{
+			table->Counts[n][k] ++;
+			k = from[a][k];
+		}
+	}
+
+	delete [] from;
+}
+//---------------------------------------------------------------------------
 class TryCompressGolomb
 {
 	int TotalBits; // total bit count
@@ -741,6 +794,45 @@ int DetectColorFilter(unsigned char *b, unsigned char *g, unsigned char *r, int
 	return f;
 #endif
 }
+//---------------------------------------------------------------------------
+static int TLG6IsFlatBlock(void *callbackdata,
+	tTVPGraphicScanLineCallback scanlinecallback, int colors,
+	int x, int xlim, int y, int ylim)
+{
+	// returns 1 when the block and the pixels above and to the left of it,
+	// which the predictors refer to, are all the same color. every residual
+	// of both MED and average is zero for such a block. pixels out of the
+	// image are taken as zero. returns -1 when the callback aborted.
+	static const unsigned char zero[MAX_COLOR_COMPONENTS] = { 0 };
+	const unsigned char *ref;
+	const unsigned char *scan;
+
+	if(y >= 1)
+	{
+		scan = (const unsigned char *)scanlinecallback(callbackdata, y - 1);
+		if(scan == NULL) return -1;
+		ref = scan + (x > 0 ? x - 1 : x) * colors;
+		if(x == 0 && memcmp(ref, zero, colors)) return 0;
+		for(int xx = x; xx < xlim; xx++)
+			if(memcmp(scan + xx * colors, ref, colors)) return 0;
+	}
+	else
+	{
+		ref = zero;
+	}
+
+	for(int yy = y; yy < ylim; yy++)
+	{
+		scan = (const unsigned char *)scanlinecallback(callbackdata, yy);
+		if(scan == NULL) return -1;
+		if(x > 0 && memcmp(scan + (x - 1) * colors, ref, colors)) return 0;
+		for(int xx = x; xx < xlim; xx++)
+			if(memcmp(scan + xx * colors, ref, colors)) return 0;
+	}
+
+	return 1;
+}
+
 //---------------------------------------------------------------------------
 
 static void TLG6InitializeColorFilterCompressor(SlideCompressor &c)
@@ -763,6 +855,467 @@ static void TLG6InitializeColorFilterCompressor(SlideCompressor &c)
 	c.Encode(code, 4096, dum, dumlen);
 }
 
+//---------------------------------------------------------------------------
+static long TLG6GetLiteralFilterTypesLength(long count)
+{
+	// LZSS stream made only of literals; a flag byte precedes every 8 literals
+	return count + (count + 7) / 8;
+}
+
+static bool TLG6WriteLiteralFilterTypes(tTJSBinaryStream *out, const unsigned char *filtertypes, long count)
+{
+	// write filter types as a LZSS stream which consists only of literals.
+	// its length does not depend on the content, so the space can be
+	// reserved before the filter types are known.
+	long outlen = TLG6GetLiteralFilterTypesLength(count);
+	unsigned char *outbuf = new unsigned char[outlen];
+	unsigned char *p = outbuf;
+	for(long i = 0; i < count; i++)
+	{
+		if(!(i & 7)) *(p++) = 0; // flags; all literals
+		*(p++) = filtertypes[i];
+	}
+	bool ret = out->WriteInt32(outlen) && out->WriteBuffer(outbuf, outlen);
+	delete [] outbuf;
+	return ret;
+}
+
+static bool TLG6WritePadding(tTJSBinaryStream *out, long size)
+{
+	// write "size" bytes of zero (to be overwritten later)
+	unsigned char zero[4096];
+	memset(zero, 0, sizeof(zero));
+	while(size > 0)
+	{
+		long one = size < (long)sizeof(zero) ? size : (long)sizeof(zero);
+		if(!out->WriteBuffer(zero, one)) return false;
+		size -= one;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------
+// entropy coding methods of row group streams
+// (two most significant bits of the bit length)
+#define TLG6_METHOD_GOLOMB 0
+#define TLG6_METHOD_GAMMA 1
+#define TLG6_METHOD_LZSS 2
+#define TLG6_METHOD_RAW 3
+
+// rough decoding cost per value of each method, in the same unit as the
+// stream size (bits). only temFastDecode takes this into account.
+static const int TLG6MethodDecodeCost[4] = { 3, 3, 1, 0 };
+
+static int TLG6SelectEntropyMethod(tTVPTLG6EntropyMode mode,
+	long count, long golombbits, long lzssbytes)
+{
+	// select the method of the least cost among golomb, LZSS and raw.
+	int weight = mode == temFastDecode ? 1 : 0;
+
+	int method = TLG6_METHOD_GOLOMB;
+	long mincost = golombbits +
+		count * TLG6MethodDecodeCost[TLG6_METHOD_GOLOMB] * weight;
+
+	long cost = lzssbytes * 8 +
+		count * TLG6MethodDecodeCost[TLG6_METHOD_LZSS] * weight;
+	if(cost < mincost) method = TLG6_METHOD_LZSS, mincost = cost;
+
+	// raw is preferred when tied; it is the fastest to decode
+	cost = count * 8 +
+		count * TLG6MethodDecodeCost[TLG6_METHOD_RAW] * weight;
+	if(cost <= mincost) method = TLG6_METHOD_RAW;
+
+	return method;
+}
+
+//---------------------------------------------------------------------------
+#define TLG6_GOLOMB_TABLE_BYTES (TVP_TLG6_GOLOMB_N_COUNT*TVP_TLG6_GOLOMB_K_COUNT*2)
+
+static bool TLG6WriteGolombTable(tTJSBinaryStream *out, const tTVPTLG6GolombTable &table)
+{
+	// external golomb table; counts as 16bit little endian, n major
+	unsigned char buf[TLG6_GOLOMB_TABLE_BYTES];
+	unsigned char *p = buf;
+	for(int n = 0; n < TVP_TLG6_GOLOMB_N_COUNT; n++)
+	{
+		for(int k = 0; k < TVP_TLG6_GOLOMB_K_COUNT; k++)
+		{
+			*(p++) = table.Counts[n][k] & 0xff;
+			*(p++) = (table.Counts[n][k] >> 8) & 0xff;
+		}
+	}
+	return out->WriteBuffer(buf, TLG6_GOLOMB_TABLE_BYTES);
+}
+
+//---------------------------------------------------------------------------
+/*
+	predict and color filter the blocks of the row group from y to ylim.
+	the values of each color component are stored to rg_buf and the filter
+	type of each block to filtertypes. buf is a work area of
+	W_BLOCK_SIZE * H_BLOCK_SIZE * 3 bytes for each color component.
+	returns the count of values of each component, or -1 if the scanline
+	callback gave no line.
+*/
+static int TLG6FilterRowGroup(void *callbackdata,
+	tTVPGraphicScanLineCallback scanlinecallback,
+	int width, int colors, int y, int ylim,
+	unsigned char * const *buf, char * const *rg_buf,
+	unsigned char *filtertypes)
+{
+	int gwp = 0;
+	int xp = 0;
+	for(int x = 0; x < width; x += W_BLOCK_SIZE, xp++)
+	{
+		int xlim = x + W_BLOCK_SIZE;
+		if(xlim > width) xlim = width;
+		int bw = xlim - x;
+
+		int flat = TLG6IsFlatBlock(callbackdata, scanlinecallback,
+			colors, x, xlim, y, ylim);
+		if(flat < 0)
+		{
+			return -1;
+		}
+		if(flat)
+		{
+			// all residuals are zero; skip the filter search, which
+			// would end with the average method and no color filter.
+			int count = bw * (ylim - y);
+			for(int c = 0; c < colors; c++)
+				memset(rg_buf[c] + gwp, 0, count);
+			filtertypes[xp] = (0<<1) + 1;
+			gwp += count;
+			continue;
+		}
+
+		int p0size; // size of MED method (p=0)
+		int minp = 0; // most efficient method (0:MED, 1:AVG)
+		int ft; // filter type
+		int wp; // write point
+		for(int p = 0; p < 2; p++)
+		{
+			int dbofs = (p+1) * (H_BLOCK_SIZE * W_BLOCK_SIZE);
+
+			// do med(when p=0) or take average of upper and left pixel(p=1)
+			for(int c = 0; c < colors; c++)
+			{
+				const unsigned char * prev = NULL;
+				const unsigned char * current = NULL;
+
+				int wp = 0;
+				for(int yy = y; yy < ylim; yy++)
+				{
+					const unsigned char *scan = (const unsigned char *)scanlinecallback(callbackdata, yy);
+					if (scan == NULL) {
+						return -1;
+					}
+
+					const unsigned char * sl = x*colors + c + scan;
+
+					const unsigned char * usl;
+					if(yy >= 1) {
+						scan = (const unsigned char *)scanlinecallback(callbackdata, yy-1);
+						if (scan == NULL) {
+							return -1;
+						}
+						usl = x*colors + c + scan;
+					} else
+						usl = NULL;
+					for(int xx = x; xx < xlim; xx++)
+					{
+						unsigned char pa = xx > 0 ? sl[-colors] : 0;
+						unsigned char pb = usl ? *usl : 0;
+						unsigned char px = *sl;
+
+						unsigned char py;
+
+//								py = 0;
+						if(p == 0)
+						{
+							unsigned char pc = (xx > 0 && usl) ? usl[-colors] : 0;
+							unsigned char min_a_b = pa>pb?pb:pa;
+							unsigned char max_a_b = pa<pb?pb:pa;
+
+							if(pc >= max_a_b)
+								py = min_a_b;
+							else if(pc < min_a_b)
+								py = max_a_b;
+							else
+								py = pa + pb - pc;
+						}
+						else
+						{
+							py = (pa+pb+1)>>1;
+						}
+						
+						buf[c][wp] = (unsigned char)(px - py);
+
+						wp++;
+						sl += colors;
+						if(usl) usl += colors;
+					}
+				}
+			}
+
+			// reordering
+			// Transfer the data into block_buf (block buffer).
+			// Even lines are stored forward (left to right),
+			// Odd lines are stored backward (right to left).
+
+			wp = 0;
+			for(int yy = y; yy < ylim; yy++)
+			{
+				int ofs;
+				if(!(xp&1))
+					ofs = (yy - y)*bw;
+				else
+					ofs = (ylim - yy - 1) * bw;
+				bool dir; // false for forward, true for backward
+				if(!((ylim-y)&1))
+				{
+					// vertical line count per block is even
+					dir = ((yy&1) ^ (xp&1)) != 0;
+				}
+				else
+				{
+					// otherwise;
+					if(xp & 1)
+					{
+						dir = (yy&1);
+					}
+					else
+					{
+						dir = ((yy&1) ^ (xp&1)) != 0;
+					}
+				}
+
+				if(!dir)
+				{
+					// forward
+					for(int xx = 0; xx < bw; xx++)
+					{
+						for(int c = 0; c < colors; c++)
+							buf[c][wp + dbofs] =
+							buf[c][ofs + xx];
+						wp++;
+					}
+				}
+				else
+				{
+					// backward
+					for(int xx = bw - 1; xx >= 0; xx--)
+					{
+						for(int c = 0; c < colors; c++)
+							buf[c][wp + dbofs] =
+							buf[c][ofs + xx];
+						wp++;
+					}
+				}
+			}
+		}
+
+
+		for(int p = 0; p < 2; p++)
+		{
+			int dbofs = (p+1) * (H_BLOCK_SIZE * W_BLOCK_SIZE);
+			// detect color filter
+			int size = 0;
+			int ft_;
+			if(colors >= 3)
+				ft_ = DetectColorFilter(
+					buf[0] + dbofs,
+					buf[1] + dbofs,
+					buf[2] + dbofs, wp, size);
+			else
+			{
+				// no color filter for gray; only compare MED and average
+				TryCompressGolomb bc;
+				size = (bc.Try((char *)buf[0] + dbofs, wp), bc.Flush());
+				ft_ = 0;
+			}
+
+			// select efficient mode of p (MED or average)
+			if(p == 0)
+			{
+				p0size = size;
+				ft = ft_;
+			}
+			else
+			{
+				if(p0size >= size)
+					minp = 1, ft = ft_;
+			}
+		}
+
+		// Apply most efficient color filter / prediction method
+		wp = 0;
+		int dbofs = (minp + 1)  * (H_BLOCK_SIZE * W_BLOCK_SIZE);
+		for(int yy = y; yy < ylim; yy++)
+		{
+			for(int xx = 0; xx < bw; xx++)
+			{
+				for(int c = 0; c < colors; c++)
+					rg_buf[c][gwp + wp] = buf[c][wp + dbofs];
+				wp++;
+			}
+		}
+
+		ApplyColorFilter(rg_buf[0] + gwp,
+			rg_buf[1] + gwp, rg_buf[2] + gwp, wp, ft);
+
+		filtertypes[xp] = (ft<<1) + minp;
+//				ftfreq[ft]++;
+		gwp += wp;
+	}
+	return gwp;
+}
+
+//---------------------------------------------------------------------------
+static int TLG6CompressRowGroup(TLG6BitStream &bs, tTJSBinaryStream *out,
+	char * const *values, int colors, int count,
+	const tTVPTLG6GolombBitLengthTable table,
+	const tTVPTLGSaveOption *option,
+	SlideCompressor *lzss, unsigned char *lzssbuf,
+	long &max_bit_length)
+{
+	// entropy code and write the streams of a row group;
+	// "count" values for each color component.
+	for(int c = 0; c < colors; c++)
+	{
+		int method;
+		CompressValuesGolomb(bs, values[c], count, table);
+		method = TLG6_METHOD_GOLOMB;
+		long bitlength = bs.GetBitLength();
+		const unsigned char *data = NULL; // stream data other than golomb
+		if(option->tlg6_entropy != temGolomb)
+		{
+			// each LZSS stream starts from the initial state,
+			// so that streams are decoded independently.
+			long lzsslen;
+			lzss->Reset();
+			lzss->Encode((const unsigned char *)values[c], count,
+				lzssbuf, lzsslen);
+			method = TLG6SelectEntropyMethod(option->tlg6_entropy,
+				count, bitlength, lzsslen);
+			if(method == TLG6_METHOD_LZSS)
+				data = lzssbuf, bitlength = lzsslen * 8;
+			else if(method == TLG6_METHOD_RAW)
+				data = (const unsigned char *)values[c], bitlength = count * 8;
+		}
+		if(bitlength & 0xc0000000) {
+			// "SaveTLG6: Too large bit length (given image may be too large)"
+			return TLG_ERROR;
+		}
+		// two most significant bits of bitlength are
+		// entropy coding method;
+		// 00 means Golomb method,
+		// 01 means Gamma method (implemented but not used),
+		// 10 means modified LZSS method,
+		// 11 means raw (uncompressed) data.
+		if(max_bit_length < bitlength) max_bit_length = bitlength;
+		tjs_uint32 header = (tjs_uint32)bitlength | ((tjs_uint32)method << 30);
+		if(!out->WriteInt32((long)header))
+			return TLG_ERROR;
+		if(data)
+		{
+			bs.Discard();
+			if(!out->WriteBuffer(data, bitlength / 8))
+				return TLG_ERROR;
+		}
+		else if(!bs.Flush())
+		{
+			return TLG_ERROR;
+		}
+	}
+	return TLG_SUCCESS;
+}
+
+//---------------------------------------------------------------------------
+// bands of row groups coded in parallel
+//---------------------------------------------------------------------------
+#define TLG6_BAND_GROUPS 8 // row groups in a band
+
+struct tTLG6Band
+{
+	tTJSBinaryStream *stream; // compressed row groups of the band
+	long max_bit_length;
+	int ret;
+};
+
+struct tTLG6BandContext
+{
+	void *callbackdata;
+	tTVPGraphicScanLineCallback scanlinecallback;
+	int width;
+	int height;
+	int colors;
+	int w_block_count;
+	const char (*table)[TVP_TLG6_GOLOMB_N_COUNT];
+	const tTVPTLGSaveOption *option;
+	unsigned char *filtertypes; // of the whole image
+	tTLG6Band *bands;
+};
+
+static void TLG6CompressBand(void *data, tjs_int index)
+{
+	// runs on a thread of option->tlg6_parallel; every buffer is its own
+	tTLG6BandContext *ctx = (tTLG6BandContext *)data;
+	tTLG6Band &band = ctx->bands[index];
+	int width = ctx->width;
+	int colors = ctx->colors;
+	unsigned char *buf[MAX_COLOR_COMPONENTS] = { NULL };
+	char *rg_buf[MAX_COLOR_COMPONENTS] = { NULL };
+	SlideCompressor *lzss = NULL;
+	unsigned char *lzssbuf = NULL;
+
+	band.ret = TLG_SUCCESS;
+	try
+	{
+		TLG6BitStream bs(band.stream);
+		bs.Reserve(TLG6BitStream::GetMaxGolombByteLength(H_BLOCK_SIZE * width));
+		for(int c = 0; c < colors; c++)
+		{
+			buf[c] = new unsigned char [W_BLOCK_SIZE * H_BLOCK_SIZE * 3];
+			rg_buf[c] = new char [(size_t)H_BLOCK_SIZE * width];
+		}
+		if(ctx->option->tlg6_entropy != temGolomb)
+		{
+			lzss = new SlideCompressor();
+			lzssbuf = new unsigned char [TLG6GetLiteralFilterTypesLength(H_BLOCK_SIZE * width)];
+		}
+
+		int ystart = index * TLG6_BAND_GROUPS * H_BLOCK_SIZE;
+		int yend = ystart + TLG6_BAND_GROUPS * H_BLOCK_SIZE;
+		if(yend > ctx->height) yend = ctx->height;
+		for(int y = ystart; y < yend && band.ret == TLG_SUCCESS; y += H_BLOCK_SIZE)
+		{
+			int ylim = y + H_BLOCK_SIZE;
+			if(ylim > yend) ylim = yend;
+			int count = TLG6FilterRowGroup(ctx->callbackdata, ctx->scanlinecallback,
+				width, colors, y, ylim, buf, rg_buf,
+				ctx->filtertypes + (size_t)(y / H_BLOCK_SIZE) * ctx->w_block_count);
+			if(count < 0)
+				band.ret = TLG_ABORT;
+			else
+				band.ret = TLG6CompressRowGroup(bs, band.stream, rg_buf, colors, count,
+					ctx->table, ctx->option, lzss, lzssbuf, band.max_bit_length);
+		}
+	}
+	catch(...)
+	{
+		// exceptions must not leave the task
+		band.ret = TLG_ERROR;
+	}
+
+	for(int c = 0; c < MAX_COLOR_COMPONENTS; c++)
+	{
+		if(buf[c]) delete [] buf[c];
+		if(rg_buf[c]) delete [] rg_buf[c];
+	}
+	if(lzss) delete lzss;
+	if(lzssbuf) delete [] lzssbuf;
+}
+
 //---------------------------------------------------------------------------
 // int ftfreq[256] = {0};
 
@@ -774,12 +1327,14 @@ static void TLG6InitializeColorFilterCompressor(SlideCompressor &c)
  * @param colors 色数指定 1/3/4
  * @param callback コールバック用パラメータ
  * @param scanlinecallback 行データを返すコールバック。NULL を返すと中断される。1つ前に渡したバッファは有効である必要がある
+ * @param option 保存オプション
  */
 int
 SaveTLG6(tTJSBinaryStream *out,
 		 int width, int height, int colors,
 		 void *callbackdata,
-		 tTVPGraphicScanLineCallback scanlinecallback)
+		 tTVPGraphicScanLineCallback scanlinecallback,
+		 const tTVPTLGSaveOption *option)
 {
 	int ret = TLG_SUCCESS;
 
@@ -787,7 +1342,24 @@ SaveTLG6(tTJSBinaryStream *out,
 	FILE *vs = fopen("vs.bin", "wb");
 #endif
 
-	TVPCreateTable();
+	TVPCreateTableOnce();
+
+	// golomb bit length table
+	bool train = option->tlg6_train_golomb_table;
+	tTVPTLG6GolombTable golombtable; // compressed form; stored when external
+	tTVPTLG6GolombBitLengthTable customtable;
+	const char (*table)[TVP_TLG6_GOLOMB_N_COUNT] = TVPTLG6GolombBitLengthTable;
+	int external = (train || option->tlg6_golomb_table) ? 1 : 0;
+	if(!train && option->tlg6_golomb_table)
+	{
+		golombtable = *option->tlg6_golomb_table;
+		if(!TVPTLG6ExpandGolombTable(customtable, golombtable.Counts))
+		{
+			// "SaveTLG6: Invalid golomb bit length table"
+			return TLG_ERROR;
+		}
+		table = customtable;
+	}
 
 	// output stream header
 	int n = 0;
@@ -795,7 +1367,7 @@ SaveTLG6(tTJSBinaryStream *out,
 		!out->WriteBuffer(&colors, 1) ||
 		!out->WriteBuffer(&n, 1) || // data flag (0)
 		!out->WriteBuffer(&n, 1) || // color type (0)
-		!out->WriteBuffer(&n, 1) || // external golomb table (0)
+		!out->WriteBuffer(&external, 1) || // external golomb table
 		!out->WriteInt32(width) ||
 		!out->WriteInt32(height)) {
 		return TLG_ERROR;
@@ -803,298 +1375,253 @@ SaveTLG6(tTJSBinaryStream *out,
 
 	// compress
 	long max_bit_length = 0;
+	int w_block_count = (int)((width - 1) / W_BLOCK_SIZE) + 1;
+	int h_block_count = (int)((height - 1) / H_BLOCK_SIZE) + 1;
 
 	unsigned char *buf[MAX_COLOR_COMPONENTS];
 	for(int i = 0; i < MAX_COLOR_COMPONENTS; i++) buf[i] = NULL;
 	char *block_buf[MAX_COLOR_COMPONENTS];
 	for(int i = 0; i < MAX_COLOR_COMPONENTS; i++) block_buf[i] = NULL;
 	unsigned char *filtertypes = NULL;
-	tTJSBinaryStream *memstream = NULL;
+	tTJSBinaryStream *memstream = NULL; // holds row groups until the filter types are written
+	tTJSBinaryStream *rowstream = NULL; // where row groups go; memstream or out
+	tjs_uint64 headerpos = 0; // position of max_bit_length when rowstream is out
+	SlideCompressor *lzss = NULL; // compressor for LZSS row group streams
+	unsigned char *lzssbuf = NULL; // output of lzss
+	tTVPTLG6GolombStatistics *stats = NULL; // statistics of the image, for training
+	tTLG6Band *bands = NULL; // bands compressed in parallel
+	int bandcount = 0;
 
 	try
 	{
-		memstream = GetMemoryStream();
+		if(option->tlg6_direct_output && out->CanSeek())
+		{
+			// reserve max_bit_length and filter types, and put row groups
+			// directly after them.
+			headerpos = out->GetPosition();
+			long ftlen = TLG6GetLiteralFilterTypesLength(w_block_count * h_block_count);
+			if(!TLG6WritePadding(out, 4 + (external ? TLG6_GOLOMB_TABLE_BYTES : 0) + 4 + ftlen))
+			{
+				ret = TLG_ERROR;
+				goto errend;
+			}
+			rowstream = out;
+		}
+		else
+		{
+			memstream = option->tlg6_direct_output ?
+				GetTemporaryStream() : GetMemoryStream();
+			if(!memstream)
+			{
+				ret = TLG_ERROR;
+				goto errend;
+			}
+			rowstream = memstream;
+		}
 
-		TLG6BitStream bs(memstream);
+		TLG6BitStream bs(rowstream);
+		bs.Reserve(TLG6BitStream::GetMaxGolombByteLength(H_BLOCK_SIZE * width));
 		
 		// allocate buffer
+		// when training the golomb table, block_buf holds the whole image
+		// because row groups are entropy coded after the table is made.
 		for(int c = 0; c < colors; c++)
 		{
 			buf[c] = new unsigned char [W_BLOCK_SIZE * H_BLOCK_SIZE * 3];
-			block_buf[c] = new char [H_BLOCK_SIZE * width];
+			block_buf[c] = new char [(size_t)(train ? height : H_BLOCK_SIZE) * width];
+		}
+		if(train) stats = new tTVPTLG6GolombStatistics();
+		filtertypes = new unsigned char [(size_t)w_block_count * h_block_count];
+		if(option->tlg6_entropy != temGolomb)
+		{
+			// LZSS output is never longer than a stream made only of literals
+			lzss = new SlideCompressor();
+			lzssbuf = new unsigned char [TLG6GetLiteralFilterTypesLength(H_BLOCK_SIZE * width)];
 		}
-		int w_block_count = (int)((width - 1) / W_BLOCK_SIZE) + 1;
-		int h_block_count = (int)((height - 1) / H_BLOCK_SIZE) + 1;
-		filtertypes = new unsigned char [w_block_count * h_block_count];
 
 		int fc = 0;
-		for(int y = 0; y < height; y += H_BLOCK_SIZE)
+		if(option->tlg6_parallel && !train && !option->tlg6_golomb_statistics &&
+			!option->tlg6_direct_output && h_block_count > TLG6_BAND_GROUPS)
 		{
-			int ylim = y + H_BLOCK_SIZE;
-			if(ylim > height) ylim = height;
-			int gwp = 0;
-			int xp = 0;
-			for(int x = 0; x < width; x += W_BLOCK_SIZE, xp++)
+			// bands are compressed into streams of their own, which are
+			// copied in order in place of memstream
+			bandcount = (h_block_count - 1) / TLG6_BAND_GROUPS + 1;
+			bands = new tTLG6Band[bandcount];
+			for(int i = 0; i < bandcount; i++) bands[i].stream = NULL;
+			for(int i = 0; i < bandcount; i++)
+			{
+				bands[i].stream = GetMemoryStream();
+				bands[i].max_bit_length = 0;
+				bands[i].ret = TLG_ERROR;
+			}
+			tTLG6BandContext ctx;
+			ctx.callbackdata = callbackdata;
+			ctx.scanlinecallback = scanlinecallback;
+			ctx.width = width;
+			ctx.height = height;
+			ctx.colors = colors;
+			ctx.w_block_count = w_block_count;
+			ctx.table = table;
+			ctx.option = option;
+			ctx.filtertypes = filtertypes;
+			ctx.bands = bands;
+			option->tlg6_parallel(option->tlg6_parallel_data, bandcount, TLG6CompressBand, &ctx);
+			for(int i = 0; i < bandcount; i++)
 			{
-				int xlim = x + W_BLOCK_SIZE;
-				if(xlim > width) xlim = width;
-				int bw = xlim - x;
-
-				int p0size; // size of MED method (p=0)
-				int minp = 0; // most efficient method (0:MED, 1:AVG)
-				int ft; // filter type
-				int wp; // write point
-				for(int p = 0; p < 2; p++)
+				if(bands[i].ret != TLG_SUCCESS)
 				{
-					int dbofs = (p+1) * (H_BLOCK_SIZE * W_BLOCK_SIZE);
-
-					// do med(when p=0) or take average of upper and left pixel(p=1)
-					for(int c = 0; c < colors; c++)
-					{
-						const unsigned char * prev = NULL;
-						const unsigned char * current = NULL;
-
-						int wp = 0;
-						for(int yy = y; yy < ylim; yy++)
-						{
-							const unsigned char *scan = (const unsigned char *)scanlinecallback(callbackdata, yy);
-							if (scan == NULL) {
-								ret = TLG_ABORT;
-								goto errend;
-							}
-
-							const unsigned char * sl = x*colors + c + scan;
-
-							const unsigned char * usl;
-							if(yy >= 1) {
-								scan = (const unsigned char *)scanlinecallback(callbackdata, yy-1);
-								if (scan == NULL) {
-									ret = TLG_ABORT;
-									goto errend;
-								}
-								usl = x*colors + c + scan;
-							} else
-								usl = NULL;
-							for(int xx = x; xx < xlim; xx++)
-							{
-								unsigned char pa = xx > 0 ? sl[-colors] : 0;
-								unsigned char pb = usl ? *usl : 0;
-								unsigned char px = *sl;
-
-								unsigned char py;
-
-//								py = 0;
-								if(p == 0)
-								{
-									unsigned char pc = (xx > 0 && usl) ? usl[-colors] : 0;
-									unsigned char min_a_b = pa>pb?pb:pa;
-									unsigned char max_a_b = pa<pb?pb:pa;
-
-									if(pc >= max_a_b)
-										py = min_a_b;
-									else if(pc < min_a_b)
-										py = max_a_b;
-									else
-										py = pa + pb - pc;
-								}
-								else
-								{
-									py = (pa+pb+1)>>1;
-								}
-								
-								buf[c][wp] = (unsigned char)(px - py);
-
-								wp++;
-								sl += colors;
-								if(usl) usl += colors;
-							}
-						}
-					}
-
-					// reordering
-					// Transfer the data into block_buf (block buffer).
-					// Even lines are stored forward (left to right),
-					// Odd lines are stored backward (right to left).
-
-					wp = 0;
-					for(int yy = y; yy < ylim; yy++)
-					{
-						int ofs;
-						if(!(xp&1))
-							ofs = (yy - y)*bw;
-						else
-							ofs = (ylim - yy - 1) * bw;
-						bool dir; // false for forward, true for backward
-						if(!((ylim-y)&1))
-						{
-							// vertical line count per block is even
-							dir = ((yy&1) ^ (xp&1)) != 0;
-						}
-						else
-						{
-							// otherwise;
-							if(xp & 1)
-							{
-								dir = (yy&1);
-							}
-							else
-							{
-								dir = ((yy&1) ^ (xp&1)) != 0;
-							}
-						}
-
-						if(!dir)
-						{
-							// forward
-							for(int xx = 0; xx < bw; xx++)
-							{
-								for(int c = 0; c < colors; c++)
-									buf[c][wp + dbofs] =
-									buf[c][ofs + xx];
-								wp++;
-							}
-						}
-						else
-						{
-							// backward
-							for(int xx = bw - 1; xx >= 0; xx--)
-							{
-								for(int c = 0; c < colors; c++)
-									buf[c][wp + dbofs] =
-									buf[c][ofs + xx];
-								wp++;
-							}
-						}
-					}
+					ret = bands[i].ret;
+					goto errend;
 				}
-
-
-				for(int p = 0; p < 2; p++)
+				if(max_bit_length < bands[i].max_bit_length)
+					max_bit_length = bands[i].max_bit_length;
+			}
+			fc = w_block_count * h_block_count;
+		}
+		else
+		{
+			for(int y = 0; y < height; y += H_BLOCK_SIZE)
+			{
+				int ylim = y + H_BLOCK_SIZE;
+				if(ylim > height) ylim = height;
+				char *rg_buf[MAX_COLOR_COMPONENTS] = { NULL }; // values of this row group
+				for(int c = 0; c < colors; c++)
+					rg_buf[c] = block_buf[c] + (train ? (size_t)y * width : 0);
+				int gwp = TLG6FilterRowGroup(callbackdata, scanlinecallback,
+					width, colors, y, ylim, buf, rg_buf, filtertypes + fc);
+				if(gwp < 0)
 				{
-					int dbofs = (p+1) * (H_BLOCK_SIZE * W_BLOCK_SIZE);
-					// detect color filter
-					int size = 0;
-					int ft_;
-					if(colors >= 3)
-						ft_ = DetectColorFilter(
-							buf[0] + dbofs,
-							buf[1] + dbofs,
-							buf[2] + dbofs, wp, size);
-					else
-						ft_ = 0;
-
-					// select efficient mode of p (MED or average)
-					if(p == 0)
-					{
-						p0size = size;
-						ft = ft_;
-					}
-					else
-					{
-						if(p0size >= size)
-							minp = 1, ft = ft_;
-					}
+					ret = TLG_ABORT;
+					goto errend;
 				}
+				fc += w_block_count;
 
-				// Apply most efficient color filter / prediction method
-				wp = 0;
-				int dbofs = (minp + 1)  * (H_BLOCK_SIZE * W_BLOCK_SIZE);
-				for(int yy = y; yy < ylim; yy++)
+				for(int c = 0; c < colors; c++)
 				{
-					for(int xx = 0; xx < bw; xx++)
-					{
-						for(int c = 0; c < colors; c++)
-							block_buf[c][gwp + wp] = buf[c][wp + dbofs];
-						wp++;
-					}
+					if(stats)
+						GatherGolombStatistics(stats, rg_buf[c], gwp);
+					if(option->tlg6_golomb_statistics)
+						GatherGolombStatistics(option->tlg6_golomb_statistics, rg_buf[c], gwp);
+#ifdef WRITE_ENTROPY_VALUES
+					fwrite(rg_buf[c], 1, gwp, vs);
+#endif
 				}
 
-				ApplyColorFilter(block_buf[0] + gwp,
-					block_buf[1] + gwp, block_buf[2] + gwp, wp, ft);
-
-				filtertypes[fc++] = (ft<<1) + minp;
-//				ftfreq[ft]++;
-				gwp += wp;
+				// compress values (entropy coding)
+				if(!train)
+				{
+					ret = TLG6CompressRowGroup(bs, rowstream, rg_buf, colors, gwp,
+						table, option, lzss, lzssbuf, max_bit_length);
+					if(ret != TLG_SUCCESS) goto errend;
+				}
 			}
+		}
 
-			// compress values (entropy coding)
-			for(int c = 0; c < colors; c++)
+		if(train)
+		{
+			// make the table from the whole image, then compress all row groups
+			TVPTLG6TrainGolombTable(stats, &golombtable);
+			if(!TVPTLG6ExpandGolombTable(customtable, golombtable.Counts))
 			{
-				int method;
-				CompressValuesGolomb(bs, block_buf[c], gwp);
-				method = 0;
-#ifdef WRITE_ENTROPY_VALUES
-				fwrite(block_buf[c], 1, gwp, vs);
-#endif
-				long bitlength = bs.GetBitLength();
-				if(bitlength & 0xc0000000) {
-					// "SaveTLG6: Too large bit length (given image may be too large)"
-					ret = TLG_ERROR;
-					goto errend;
-				}
-				// two most significant bits of bitlength are
-				// entropy coding method;
-				// 00 means Golomb method,
-				// 01 means Gamma method (implemented but not used),
-				// 10 means modified LZSS method (not yet implemented),
-				// 11 means raw (uncompressed) data (not yet implemented).
-				if(max_bit_length < bitlength) max_bit_length = bitlength;
-				bitlength |= (method << 30);
-				memstream->WriteInt32(bitlength);
-				bs.Flush();
+				ret = TLG_ERROR;
+				goto errend;
 			}
+			table = customtable;
 
+			for(int y = 0; y < height; y += H_BLOCK_SIZE)
+			{
+				int ylim = y + H_BLOCK_SIZE;
+				if(ylim > height) ylim = height;
+				char *rg_buf[MAX_COLOR_COMPONENTS];
+				for(int c = 0; c < colors; c++)
+					rg_buf[c] = block_buf[c] + (size_t)y * width;
+				ret = TLG6CompressRowGroup(bs, rowstream, rg_buf, colors,
+					(ylim - y) * width, table, option, lzss, lzssbuf, max_bit_length);
+				if(ret != TLG_SUCCESS) goto errend;
+			}
 		}
 
 
-		// write max bit length
-		if (!out->WriteInt32(max_bit_length)) {
-			ret = TLG_ERROR;
-			goto errend;
+		if(rowstream == out)
+		{
+			// fill max bit length and filter types reserved before the row groups
+			tjs_uint64 pos_save = out->GetPosition();
+			out->SetPosition(headerpos);
+			if (!out->WriteInt32(max_bit_length) ||
+				(external && !TLG6WriteGolombTable(out, golombtable)) ||
+				!TLG6WriteLiteralFilterTypes(out, filtertypes, fc)) {
+				ret = TLG_ERROR;
+				goto errend;
+			}
+			out->SetPosition(pos_save);
 		}
-
-		// output filter types
+		else
 		{
-			SlideCompressor comp;
-			TLG6InitializeColorFilterCompressor(comp);
-			unsigned char *outbuf = new unsigned char[fc * 2];
-			try
-			{
-				long outlen;
-				comp.Encode(filtertypes, fc, outbuf, outlen);
-				if (!out->WriteInt32(outlen) ||
-					!out->WriteBuffer(outbuf, outlen)) {
-					ret = TLG_ERROR;
-					goto errend;
-				}
+			// write max bit length (and external golomb table)
+			if (!out->WriteInt32(max_bit_length) ||
+				(external && !TLG6WriteGolombTable(out, golombtable))) {
+				ret = TLG_ERROR;
+				goto errend;
 			}
-			catch(...)
+
+			// output filter types
 			{
+				SlideCompressor comp;
+				TLG6InitializeColorFilterCompressor(comp);
+				unsigned char *outbuf = new unsigned char[fc * 2];
+				try
+				{
+					long outlen;
+					comp.Encode(filtertypes, fc, outbuf, outlen);
+					if (!out->WriteInt32(outlen) ||
+						!out->WriteBuffer(outbuf, outlen)) {
+						ret = TLG_ERROR;
+					}
+				}
+				catch(...)
+				{
+					delete [] outbuf;
+					throw;
+				}
 				delete [] outbuf;
-				throw;
-			}
-			delete [] outbuf;
+				if(ret != TLG_SUCCESS) goto errend;
 /*
-			FILE *f = fopen("ft.txt", "wt");
-			int n = 0;
-			for(int y = 0; y < h_block_count; y++)
+				FILE *f = fopen("ft.txt", "wt");
+				int n = 0;
+				for(int y = 0; y < h_block_count; y++)
+				{
+					for(int x = 0; x < w_block_count; x++)
+					{
+						int t = filtertypes[n++];
+						char b;
+						if(t & 1) b = 'A'; else b = 'M';
+						t >>= 1;
+						fprintf(f, "%c%x", b, t);
+					}
+					fprintf(f, "\n");
+				}
+				fclose(f);
+*/
+			}
+
+			// copy memory (or temporary) stream to output stream
+			if(bands)
 			{
-				for(int x = 0; x < w_block_count; x++)
+				for(int i = 0; i < bandcount; i++)
 				{
-					int t = filtertypes[n++];
-					char b;
-					if(t & 1) b = 'A'; else b = 'M';
-					t >>= 1;
-					fprintf(f, "%c%x", b, t);
+					if(!out->CopyFrom(bands[i].stream, 0))
+					{
+						ret = TLG_ERROR;
+						goto errend;
+					}
 				}
-				fprintf(f, "\n");
 			}
-			fclose(f);
-*/
+			else if(!out->CopyFrom(memstream, 0))
+			{
+				ret = TLG_ERROR;
+				goto errend;
+			}
 		}
-
-		// copy memory stream to output stream
-		out->CopyFrom(memstream, 0);
 	}
 	catch(...)
 	{
@@ -1104,7 +1631,16 @@ SaveTLG6(tTJSBinaryStream *out,
 			if(block_buf[i]) delete [] (block_buf[i]);
 		}
 		if(filtertypes) delete [] filtertypes;
+		if(lzss) delete lzss;
+		if(lzssbuf) delete [] lzssbuf;
+		if(stats) delete stats;
 		if(memstream) delete memstream;
+		if(bands)
+		{
+			for(int i = 0; i < bandcount; i++)
+				if(bands[i].stream) delete bands[i].stream;
+			delete [] bands;
+		}
 		throw;
 	}
 errend:
@@ -1114,7 +1650,16 @@ errend:
 		if(block_buf) delete [] (block_buf[i]);
 	}
 	if(filtertypes) delete [] filtertypes;
+	if(lzss) delete lzss;
+	if(lzssbuf) delete [] lzssbuf;
+	if(stats) delete stats;
 	if(memstream) delete memstream;
+	if(bands)
+	{
+		for(int i = 0; i < bandcount; i++)
+			if(bands[i].stream) delete bands[i].stream;
+		delete [] bands;
+	}
 
 #ifdef WRITE_ENTROPY_VALUES
 	fclose(vs);
@@ -0,0 +1,43 @@
+#ifndef __TLGBYTEORDER
+#define __TLGBYTEORDER
+
+#include "tjs.h"
+#include <stddef.h>
+#include <vector>
+
+//---------------------------------------------------------------------------
+// little endian fields of headers and chunks
+//---------------------------------------------------------------------------
+static inline void TVPTLGStoreInt32(tjs_uint8 *p, tjs_uint32 v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+static inline tjs_uint32 TVPTLGLoadInt32(const tjs_uint8 *p)
+{
+	return (tjs_uint32)p[0] | ((tjs_uint32)p[1] << 8) | ((tjs_uint32)p[2] << 16) | ((tjs_uint32)p[3] << 24);
+}
+
+static inline void TVPTLGStoreInt64(tjs_uint8 *p, tjs_uint64 v)
+{
+	TVPTLGStoreInt32(p, (tjs_uint32)v);
+	TVPTLGStoreInt32(p + 4, (tjs_uint32)(v >> 32));
+}
+
+static inline tjs_uint64 TVPTLGLoadInt64(const tjs_uint8 *p)
+{
+	return (tjs_uint64)TVPTLGLoadInt32(p) | ((tjs_uint64)TVPTLGLoadInt32(p + 4) << 32);
+}
+
+// appends v to a chunk being built
+static inline void TVPTLGAppendInt32(std::vector<tjs_uint8> &out, tjs_uint32 v)
+{
+	size_t pos = out.size();
+	out.resize(pos + 4);
+	TVPTLGStoreInt32(&out[pos], v);
+}
+
+#endif
@@ -1,79 +1,164 @@
 #include "stream.h"
-#include <windows.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <vector>
+
+// size of one storage chunk
+#define TVP_MEMSTREAM_CHUNK_SIZE (64*1024)
+
+// maximum count of free chunks kept for later streams
+#define TVP_MEMSTREAM_POOL_LIMIT 256
+
+/**
+ * 解放されたチャンクを次のストリームで再利用するためのプール
+ */
+class tMemoryStreamChunkPool
+{
+public:
+	~tMemoryStreamChunkPool() {
+		for (size_t i = 0; i < chunks.size(); i++) free(chunks[i]);
+	}
+
+	tjs_uint8 *Allocate() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!chunks.empty()) {
+				tjs_uint8 *chunk = chunks.back();
+				chunks.pop_back();
+				return chunk;
+			}
+		}
+		return (tjs_uint8*)malloc(TVP_MEMSTREAM_CHUNK_SIZE);
+	}
+
+	void Release(tjs_uint8 *chunk) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (chunks.size() < TVP_MEMSTREAM_POOL_LIMIT) {
+				chunks.push_back(chunk);
+				return;
+			}
+		}
+		free(chunk);
+	}
+
+	static tMemoryStreamChunkPool & Get() {
+		static tMemoryStreamChunkPool pool;
+		return pool;
+	}
+
+private:
+	std::mutex mutex;
+	std::vector<tjs_uint8*> chunks;
+};
 
 /**
  * 完全オンメモリ動作するストリーム
+ *
+ * 固定長のチャンクを連ねて保持するので、伸長時に既存の内容はコピーされない。
  */
 class tMemoryStream : public tTJSBinaryStream
 {
 public:
 	// コンストラクタ
-	tMemoryStream() : hBuffer(0), stream(0) {
-		hBuffer = ::GlobalAlloc(GMEM_MOVEABLE, 0);
-		if (hBuffer) {
-			::CreateStreamOnHGlobal(hBuffer, FALSE, &stream);
-		}
+	tMemoryStream() : size(0), position(0) {
 	}
 
 	// デストラクタ
 	~tMemoryStream() {
-		if (stream) {
-			stream->Release();
-			stream = 0;
-		}
-		if (hBuffer) {
-			::GlobalFree(hBuffer);
-			hBuffer = 0;
-		}
+		tMemoryStreamChunkPool &pool = tMemoryStreamChunkPool::Get();
+		for (size_t i = 0; i < chunks.size(); i++) pool.Release(chunks[i]);
 	}
 
 	virtual tjs_uint64 Seek(tjs_int64 offset, tjs_int whence) {
-		if (stream) {
-			DWORD origin;
-			switch(whence) {
-			case TJS_BS_SEEK_SET:			origin = STREAM_SEEK_SET;		break;
-			case TJS_BS_SEEK_CUR:			origin = STREAM_SEEK_CUR;		break;
-			case TJS_BS_SEEK_END:			origin = STREAM_SEEK_END;		break;
-			default:						origin = STREAM_SEEK_SET;		break;
-			}
-			
-			LARGE_INTEGER ofs;
-			ULARGE_INTEGER newpos;
-			
-			ofs.QuadPart = offset;
-			
-			if (SUCCEEDED(stream->Seek(ofs, origin, &newpos))) {
-				return newpos.QuadPart;
-			}
+		tjs_int64 newpos;
+		switch(whence) {
+		case TJS_BS_SEEK_CUR:			newpos = (tjs_int64)position + offset;	break;
+		case TJS_BS_SEEK_END:			newpos = (tjs_int64)size + offset;		break;
+		default:						newpos = offset;						break;
 		}
-		return 0;
+		// seeking beyond the end is allowed; the gap is zero-filled on write
+		if (newpos >= 0) position = (tjs_uint64)newpos;
+		return position;
 	}
 
 	virtual tjs_uint Read(void *buffer, tjs_uint read_size) {
-		if (stream) {
-			ULONG cb = read_size;
-			ULONG read;
-			if (SUCCEEDED(stream->Read(buffer, cb, &read))) {
-				return read;
-			}
+		if (position >= size) return 0;
+		if (read_size > size - position) read_size = (tjs_uint)(size - position);
+		tjs_uint8 *dest = (tjs_uint8*)buffer;
+		tjs_uint remain = read_size;
+		while (remain) {
+			size_t index = (size_t)(position / TVP_MEMSTREAM_CHUNK_SIZE);
+			tjs_uint offset = (tjs_uint)(position % TVP_MEMSTREAM_CHUNK_SIZE);
+			tjs_uint one = TVP_MEMSTREAM_CHUNK_SIZE - offset;
+			if (one > remain) one = remain;
+			memcpy(dest, chunks[index] + offset, one);
+			dest += one;
+			position += one;
+			remain -= one;
 		}
-		return 0;
+		return read_size;
 	}
 
 	virtual tjs_uint Write(const void *buffer, tjs_uint write_size) {
-		if (stream) {
-			ULONG cb = write_size;
-			ULONG written;
-			if (SUCCEEDED(stream->Write(buffer, cb, &written))) {
-				return written;
-			}
+		if (!write_size) return 0;
+		tjs_uint64 end = position + write_size;
+		if (!Extend(end)) return 0;
+		const tjs_uint8 *src = (const tjs_uint8*)buffer;
+		tjs_uint remain = write_size;
+		while (remain) {
+			size_t index = (size_t)(position / TVP_MEMSTREAM_CHUNK_SIZE);
+			tjs_uint offset = (tjs_uint)(position % TVP_MEMSTREAM_CHUNK_SIZE);
+			tjs_uint one = TVP_MEMSTREAM_CHUNK_SIZE - offset;
+			if (one > remain) one = remain;
+			memcpy(chunks[index] + offset, src, one);
+			src += one;
+			position += one;
+			remain -= one;
 		}
-		return 0;
+		return write_size;
+	}
+
+	virtual const void *GetView(tjs_uint64 pos, tjs_uint &view_size) {
+		// the view never crosses a chunk boundary
+		if (pos >= size) { view_size = 0; return 0; }
+		size_t index = (size_t)(pos / TVP_MEMSTREAM_CHUNK_SIZE);
+		tjs_uint offset = (tjs_uint)(pos % TVP_MEMSTREAM_CHUNK_SIZE);
+		view_size = TVP_MEMSTREAM_CHUNK_SIZE - offset;
+		if (view_size > size - pos) view_size = (tjs_uint)(size - pos);
+		return chunks[index] + offset;
 	}
 
 private:
-	HGLOBAL hBuffer;
-	IStream *stream;
+	bool Extend(tjs_uint64 end) {
+		// make the stream "end" bytes long
+		if (end <= size) return true;
+		tMemoryStreamChunkPool &pool = tMemoryStreamChunkPool::Get();
+		size_t need = (size_t)((end + TVP_MEMSTREAM_CHUNK_SIZE - 1) / TVP_MEMSTREAM_CHUNK_SIZE);
+		while (chunks.size() < need) {
+			tjs_uint8 *chunk = pool.Allocate();
+			if (!chunk) return false;
+			chunks.push_back(chunk);
+		}
+		// bytes between the old end and the current position were skipped by
+		// a seek; clear them as pooled chunks hold data of an earlier stream
+		tjs_uint64 pos = size;
+		while (pos < position) {
+			size_t index = (size_t)(pos / TVP_MEMSTREAM_CHUNK_SIZE);
+			tjs_uint offset = (tjs_uint)(pos % TVP_MEMSTREAM_CHUNK_SIZE);
+			tjs_uint one = TVP_MEMSTREAM_CHUNK_SIZE - offset;
+			if (one > position - pos) one = (tjs_uint)(position - pos);
+			memset(chunks[index] + offset, 0, one);
+			pos += one;
+		}
+		size = end;
+		return true;
+	}
+
+	std::vector<tjs_uint8*> chunks;
+	tjs_uint64 size;
+	tjs_uint64 position;
 };
 
 tTJSBinaryStream *
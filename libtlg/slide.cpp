@@ -4,8 +4,18 @@
 //---------------------------------------------------------------------------
 SlideCompressor::SlideCompressor()
 {
+	Reset();
+}
+//---------------------------------------------------------------------------
+SlideCompressor::~SlideCompressor()
+{
+}
+//---------------------------------------------------------------------------
+void SlideCompressor::Reset()
+{
+	// back to the initial state; zero filled text at position 0
 	S = 0;
-	for(int i = 0; i < SLIDE_N + SLIDE_M; i++) Text[i] = 0;
+	for(int i = 0; i < SLIDE_N + SLIDE_M - 1; i++) Text[i] = 0;
 	for(int i = 0; i < 256*256; i++)
 		Map[i] = -1;
 	for(int i = 0; i < SLIDE_N; i++)
@@ -14,10 +24,6 @@ SlideCompressor::SlideCompressor()
 		AddMap(i);
 }
 //---------------------------------------------------------------------------
-SlideCompressor::~SlideCompressor()
-{
-}
-//---------------------------------------------------------------------------
 int SlideCompressor::GetMatch(const unsigned char*cur, int curlen, int &pos, int s)
 {
 	// get match length
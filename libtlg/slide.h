@@ -41,6 +41,7 @@ public:
 
 	void Store();
 	void Restore();
+	void Reset();
 };
 //---------------------------------------------------------------------------
 #endif
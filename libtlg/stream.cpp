@@ -1,4 +1,6 @@
 #include "stream.h"
+#include "byteorder.h"
+#include <string.h>
 
 tjs_uint64
 tTJSBinaryStream::GetPosition()
@@ -13,15 +15,53 @@ tTJSBinaryStream::SetPosition(tjs_uint64 pos)
 }
 
 bool
-tTJSBinaryStream::ReadBuffer(void *buffer, tjs_uint read_size)
+tTJSBinaryStream::ReadBuffer(void *buffer, tjs_uint64 read_size)
 {
-	return Read(buffer, read_size) == read_size;
+	tjs_uint8 *p = (tjs_uint8 *)buffer;
+	while (read_size) {
+		tjs_uint one = read_size > TJS_BS_MAX_IO_SIZE ? TJS_BS_MAX_IO_SIZE : (tjs_uint)read_size;
+		if (Read(p, one) != one) {
+			return false;
+		}
+		p += one;
+		read_size -= one;
+	}
+	return true;
 }
 
 bool
-tTJSBinaryStream::WriteBuffer(const void *buffer, tjs_uint write_size)
+tTJSBinaryStream::WriteBuffer(const void *buffer, tjs_uint64 write_size)
+{
+	const tjs_uint8 *p = (const tjs_uint8 *)buffer;
+	while (write_size) {
+		tjs_uint one = write_size > TJS_BS_MAX_IO_SIZE ? TJS_BS_MAX_IO_SIZE : (tjs_uint)write_size;
+		if (Write(p, one) != one) {
+			return false;
+		}
+		p += one;
+		write_size -= one;
+	}
+	return true;
+}
+
+tjs_uint64
+tTJSBinaryStream::WriteV(const tTJSBinaryStreamVec *vecs, tjs_int count)
 {
-	return Write(buffer, write_size) == write_size;
+	tjs_uint64 total = 0;
+	for (tjs_int i = 0; i < count; i++) {
+		tjs_uint written = Write(vecs[i].buffer, vecs[i].size);
+		total += written;
+		if (written != vecs[i].size) break;
+	}
+	return total;
+}
+
+bool
+tTJSBinaryStream::WriteVBuffer(const tTJSBinaryStreamVec *vecs, tjs_int count)
+{
+	tjs_uint64 total = 0;
+	for (tjs_int i = 0; i < count; i++) total += vecs[i].size;
+	return WriteV(vecs, count) == total;
 }
 
 bool
@@ -91,25 +131,88 @@ tTJSBinaryStream::ReadI16LE(tjs_uint16 &value)
 }
 
 bool
-tTJSBinaryStream::WriteInt32(long num)
+tTJSBinaryStream::WriteInt32(tjs_uint32 num)
 {
-	unsigned char buf[4];
-	buf[0] = num & 0xff;
-	buf[1] = (num >> 8) & 0xff;
-	buf[2] = (num >> 16) & 0xff;
-	buf[3] = (num >> 24) & 0xff;
+	tjs_uint8 buf[4];
+	TVPTLGStoreInt32(buf, num);
 	return WriteBuffer(buf, 4);
 }
 
 #define BUFSIZE 8192
 
-void
-tTJSBinaryStream::CopyFrom(tTJSBinaryStream *stream, int pos)
+// count of views CopyFrom passes to one WriteV
+#define COPY_VEC_COUNT 64
+
+bool
+tTJSBinaryStream::CopyFrom(tTJSBinaryStream *stream, tjs_uint64 pos)
 {
+	tjs_uint size;
+	tjs_uint64 viewpos = pos;
+	if (stream->GetView(viewpos, size)) {
+		// the source is in memory; write directly from its storage,
+		// gathering its pieces into vectored writes
+		tTJSBinaryStreamVec vecs[COPY_VEC_COUNT];
+		tjs_int count;
+		do {
+			for (count = 0; count < COPY_VEC_COUNT; count++) {
+				vecs[count].buffer = stream->GetView(viewpos, vecs[count].size);
+				if (!vecs[count].buffer || !vecs[count].size) break;
+				viewpos += vecs[count].size;
+			}
+			if (count && !WriteVBuffer(vecs, count)) return false;
+		} while (count == COPY_VEC_COUNT);
+		stream->SetPosition(viewpos);
+		return true;
+	}
+
 	char buf[BUFSIZE];
 	stream->SetPosition(pos);
-	tjs_uint size;
 	while ((size = stream->Read(buf, BUFSIZE)) > 0) {
-		Write(buf, size);
+		if (Write(buf, size) != size) return false;
+	}
+	return true;
+}
+
+tTJSMemoryReadStream::tTJSMemoryReadStream(const void *data, tjs_uint64 size) :
+	Data((const tjs_uint8 *)data), Size(size), Position(0)
+{
+}
+
+tjs_uint64
+tTJSMemoryReadStream::Seek(tjs_int64 offset, tjs_int whence)
+{
+	tjs_int64 newpos;
+	switch(whence)
+	{
+	case TJS_BS_SEEK_CUR: newpos = (tjs_int64)Position + offset; break;
+	case TJS_BS_SEEK_END: newpos = (tjs_int64)Size + offset; break;
+	default:              newpos = offset; break;
 	}
+	if(newpos >= 0) Position = (tjs_uint64)newpos;
+	return Position;
+}
+
+tjs_uint
+tTJSMemoryReadStream::Read(void *buffer, tjs_uint read_size)
+{
+	if(Position >= Size) return 0;
+	if(read_size > Size - Position) read_size = (tjs_uint)(Size - Position);
+	memcpy(buffer, Data + Position, read_size);
+	Position += read_size;
+	return read_size;
+}
+
+tjs_uint
+tTJSMemoryReadStream::Write(const void * /* buffer */, tjs_uint /* write_size */)
+{
+	return 0;
+}
+
+const void *
+tTJSMemoryReadStream::GetView(tjs_uint64 pos, tjs_uint &size)
+{
+	if(pos >= Size) { size = 0; return 0; }
+	tjs_uint64 remain = Size - pos;
+	size = remain > TJS_BS_MAX_IO_SIZE ? TJS_BS_MAX_IO_SIZE : (tjs_uint)remain;
+	return Data + pos;
 }
@@ -7,6 +7,18 @@
 #define TJS_BS_SEEK_CUR 1
 #define TJS_BS_SEEK_END 2
 
+// largest size passed to one Read/Write call by ReadBuffer/WriteBuffer
+#define TJS_BS_MAX_IO_SIZE 0x40000000
+
+//---------------------------------------------------------------------------
+// tTJSBinaryStreamVec one buffer of a vectored write
+//---------------------------------------------------------------------------
+struct tTJSBinaryStreamVec
+{
+	const void *buffer;
+	tjs_uint size;
+};
+
 //---------------------------------------------------------------------------
 // tTJSBinaryStream base stream class
 //---------------------------------------------------------------------------
@@ -21,17 +33,49 @@ public:
 	virtual tjs_uint Read(void *buffer, tjs_uint read_size) = 0;
 	virtual tjs_uint Write(const void *buffer, tjs_uint write_size) = 0;
 
+	//-- optional
+	// returns false when the stream cannot seek (pipes etc.)
+	virtual bool CanSeek() { return true; }
+	// returns a pointer to the bytes at "pos" which stay valid until the
+	// next write, and the count of contiguous bytes there in "size".
+	// returns NULL when the stream has no such in-memory storage.
+	virtual const void *GetView(tjs_uint64 pos, tjs_uint &size) { size = 0; return 0; }
+	// writes "count" buffers in order, as one operation where the stream
+	// supports it (writev etc.). returns the total byte count written.
+	virtual tjs_uint64 WriteV(const tTJSBinaryStreamVec *vecs, tjs_int count);
+
 	tjs_uint64 GetPosition();
 	void SetPosition(tjs_uint64 pos);
-	bool ReadBuffer(void *buffer, tjs_uint read_size);
+	// these split sizes larger than TJS_BS_MAX_IO_SIZE into several calls
+	bool ReadBuffer(void *buffer, tjs_uint64 read_size);
 
-	bool WriteBuffer(const void *buffer, tjs_uint write_size);
+	bool WriteBuffer(const void *buffer, tjs_uint64 write_size);
+	bool WriteVBuffer(const tTJSBinaryStreamVec *vecs, tjs_int count);
 	bool ReadI64LE(tjs_uint64 &value);
 	bool ReadI32LE(tjs_uint32 &value);
 	bool ReadI16LE(tjs_uint16 &value);
 
-	bool WriteInt32(long num);
-	void CopyFrom(tTJSBinaryStream *stream, int pos);
+	bool WriteInt32(tjs_uint32 num);
+	// returns false when any of the data could not be written
+	bool CopyFrom(tTJSBinaryStream *stream, tjs_uint64 pos);
+};
+
+//---------------------------------------------------------------------------
+// tTJSMemoryReadStream read-only stream on memory owned by someone else
+//---------------------------------------------------------------------------
+class tTJSMemoryReadStream : public tTJSBinaryStream
+{
+	const tjs_uint8 *Data;
+	tjs_uint64 Size;
+	tjs_uint64 Position;
+
+public:
+	tTJSMemoryReadStream(const void *data, tjs_uint64 size);
+
+	virtual tjs_uint64 Seek(tjs_int64 offset, tjs_int whence);
+	virtual tjs_uint Read(void *buffer, tjs_uint read_size);
+	virtual tjs_uint Write(const void *buffer, tjs_uint write_size);
+	virtual const void *GetView(tjs_uint64 pos, tjs_uint &size);
 };
 
 #endif
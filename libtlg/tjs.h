@@ -3,6 +3,7 @@
 
 #define TVP_INLINE_FUNC
 
+#ifdef _MSC_VER
 typedef __int8 tjs_int8;
 typedef unsigned __int8 tjs_uint8;
 typedef __int16 tjs_int16;
@@ -11,6 +12,17 @@ typedef __int32 tjs_int32;
 typedef unsigned __int32 tjs_uint32;
 typedef __int64 tjs_int64;
 typedef unsigned __int64 tjs_uint64;
+#else
+#include <stdint.h>
+typedef int8_t tjs_int8;
+typedef uint8_t tjs_uint8;
+typedef int16_t tjs_int16;
+typedef uint16_t tjs_uint16;
+typedef int32_t tjs_int32;
+typedef uint32_t tjs_uint32;
+typedef int64_t tjs_int64;
+typedef uint64_t tjs_uint64;
+#endif
 typedef int tjs_int;    /* at least 32bits */
 typedef unsigned int tjs_uint;    /* at least 32bits */
 
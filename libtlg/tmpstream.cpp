@@ -0,0 +1,69 @@
+#include "stream.h"
+#include <stdio.h>
+
+#ifdef _WIN32
+#define TMPSTREAM_FSEEK _fseeki64
+#define TMPSTREAM_FTELL _ftelli64
+#else
+#define TMPSTREAM_FSEEK fseeko
+#define TMPSTREAM_FTELL ftello
+#endif
+
+/**
+ * 一時ファイル上のストリーム
+ * 閉じると削除される
+ */
+class tTemporaryStream : public tTJSBinaryStream
+{
+public:
+	tTemporaryStream() : fp(0) {
+		fp = tmpfile();
+	}
+
+	~tTemporaryStream() {
+		if (fp) {
+			fclose(fp);
+			fp = 0;
+		}
+	}
+
+	bool IsOpened() const { return fp != 0; }
+
+	virtual tjs_uint64 Seek(tjs_int64 offset, tjs_int whence) {
+		if (fp) {
+			int origin;
+			switch(whence) {
+			case TJS_BS_SEEK_SET:			origin = SEEK_SET;		break;
+			case TJS_BS_SEEK_CUR:			origin = SEEK_CUR;		break;
+			case TJS_BS_SEEK_END:			origin = SEEK_END;		break;
+			default:						origin = SEEK_SET;		break;
+			}
+			if (TMPSTREAM_FSEEK(fp, offset, origin) == 0) {
+				return TMPSTREAM_FTELL(fp);
+			}
+		}
+		return 0;
+	}
+
+	virtual tjs_uint Read(void *buffer, tjs_uint read_size) {
+		return fp ? (tjs_uint)fread(buffer, 1, read_size, fp) : 0;
+	}
+
+	virtual tjs_uint Write(const void *buffer, tjs_uint write_size) {
+		return fp ? (tjs_uint)fwrite(buffer, 1, write_size, fp) : 0;
+	}
+
+private:
+	FILE *fp;
+};
+
+tTJSBinaryStream *
+GetTemporaryStream()
+{
+	tTemporaryStream *stream = new tTemporaryStream();
+	if (!stream->IsOpened()) {
+		delete stream;
+		return 0;
+	}
+	return stream;
+}
@@ -70,19 +70,17 @@ TVP_GL_FUNC_DECL(void, TVPFillARGB, (tjs_uint32 *dest, tjs_int len, tjs_uint32 v
 #define TVP_TLG6_GOLOMB_HALF_THRESHOLD 8
 
 
-#define TVP_TLG6_GOLOMB_N_COUNT  4
 #define TVP_TLG6_LeadingZeroTable_BITS 12
 #define TVP_TLG6_LeadingZeroTable_SIZE  (1<<TVP_TLG6_LeadingZeroTable_BITS)
 tjs_uint8 TVPTLG6LeadingZeroTable[TVP_TLG6_LeadingZeroTable_SIZE];
-short int TVPTLG6GolombCompressed[TVP_TLG6_GOLOMB_N_COUNT][9] = {
+tTVPTLG6GolombCompressedTable TVPTLG6GolombCompressed = {
 		{3,7,15,27,63,108,223,448,130,},
 		{3,5,13,24,51,95,192,384,257,},
 		{2,5,12,21,39,86,155,320,384,},
 		{2,3,9,18,33,61,129,258,511,},
 	/* Tuned by W.Dee, 2004/03/25 */
 };
-char TVPTLG6GolombBitLengthTable
-	[TVP_TLG6_GOLOMB_N_COUNT*2*128][TVP_TLG6_GOLOMB_N_COUNT] =
+tTVPTLG6GolombBitLengthTable TVPTLG6GolombBitLengthTable =
 	{ { 0 } };
 
 
@@ -105,21 +103,31 @@ void TVPTLG6InitLeadingZeroTable(void)
 	}
 }
 
-void TVPTLG6InitGolombTable(void)
+int TVPTLG6ExpandGolombTable(tTVPTLG6GolombBitLengthTable table, const tTVPTLG6GolombCompressedTable compressed)
 {
+	/* expand compressed table into "table". */
+	/* returns zero if the counts do not fill the table exactly. */
 	int n, i, j;
 	for(n = 0; n < TVP_TLG6_GOLOMB_N_COUNT; n++)
 	{
 		int a = 0;
-		for(i = 0; i < 9; i++)
+		for(i = 0; i < TVP_TLG6_GOLOMB_K_COUNT; i++)
 		{
-			for(j = 0; j < TVPTLG6GolombCompressed[n][i]; j++)
-				TVPTLG6GolombBitLengthTable[a++][n] = (char)i;
+			if(compressed[n][i] < 0 ||
+				a + compressed[n][i] > TVP_TLG6_GOLOMB_A_COUNT) return 0;
+			for(j = 0; j < compressed[n][i]; j++)
+				table[a++][n] = (char)i;
 		}
-		if(a != TVP_TLG6_GOLOMB_N_COUNT*2*128)
-			*(char*)0 = 0;   /* THIS MUST NOT BE EXECUETED! */
-				/* (this is for compressed table data check) */
+		if(a != TVP_TLG6_GOLOMB_A_COUNT) return 0;
 	}
+	return 1;
+}
+
+void TVPTLG6InitGolombTable(void)
+{
+	if(!TVPTLG6ExpandGolombTable(TVPTLG6GolombBitLengthTable, TVPTLG6GolombCompressed))
+		*(char*)0 = 0;   /* THIS MUST NOT BE EXECUETED! */
+			/* (this is for compressed table data check) */
 }
 
 void TVPCreateTable(void)
@@ -214,6 +222,55 @@ TVP_GL_FUNC_DECL(tjs_int, TVPTLG5DecompressSlide, (tjs_uint8 *out, const tjs_uin
 	return r;
 }
 
+/* TVPTLG5DecompressSlide for untrusted streams: stops at outsize bytes of
+   output and at the end of the input. returns the count of bytes written,
+   or -1 if the stream yields more than outsize bytes or ends within a code. */
+/*export*/
+TVP_GL_FUNC_DECL(tjs_int, TVPTLG5DecompressSlideBounded, (tjs_uint8 *out, tjs_int outsize, const tjs_uint8 *in, tjs_int insize, tjs_uint8 *text, tjs_int initialr))
+{
+	tjs_int r = initialr;
+	tjs_uint flags = 0;
+	const tjs_uint8 *inlim = in + insize;
+	tjs_uint8 *outstart = out;
+	tjs_uint8 *outlim = out + outsize;
+	while(in < inlim)
+	{
+		if(((flags >>= 1) & 256) == 0)
+		{
+			flags = 0[in++] | 0xff00;
+		}
+		if(flags & 1)
+		{
+			tjs_int mpos, mlen;
+			if(inlim - in < 2) return -1;
+			mpos = in[0] | ((in[1] & 0xf) << 8);
+			mlen = (in[1] & 0xf0) >> 4;
+			in += 2;
+			mlen += 3;
+			if(mlen == 18)
+			{
+				if(in == inlim) return -1;
+				mlen += 0[in++];
+			}
+			if(outlim - out < mlen) return -1;
+
+			while(mlen--)
+			{
+				0[out++] = text[r++] = text[mpos++];
+				mpos &= (4096 - 1);
+				r &= (4096 - 1);
+			}
+		}
+		else
+		{
+			if(in == inlim || out == outlim) return -1;
+			0[out++] = text[r++] = 0[in++];
+			r &= (4096 - 1);
+		}
+	}
+	return (tjs_int)(out - outstart);
+}
+
 
 #if TJS_HOST_IS_BIG_ENDIAN
 	#define TVP_TLG6_BYTEOF(a, x) (((tjs_uint8*)(a))[(x)])
@@ -229,7 +286,7 @@ TVP_GL_FUNC_DECL(tjs_int, TVPTLG5DecompressSlide, (tjs_uint8 *out, const tjs_uin
 
 
 /*export*/
-TVP_GL_FUNC_DECL(void, TVPTLG6DecodeGolombValuesForFirst, (tjs_int8 *pixelbuf, tjs_int pixel_count, tjs_uint8 *bit_pool))
+TVP_GL_FUNC_DECL(void, TVPTLG6DecodeGolombValuesForFirst, (tjs_int8 *pixelbuf, tjs_int pixel_count, tjs_uint8 *bit_pool, const tTVPTLG6GolombBitLengthTable table))
 {
 	/*
 		decode values packed in "bit_pool".
@@ -237,6 +294,8 @@ TVP_GL_FUNC_DECL(void, TVPTLG6DecodeGolombValuesForFirst, (tjs_int8 *pixelbuf, t
 
 		"ForFirst" function do dword access to pixelbuf,
 		clearing with zero except for blue (least siginificant byte).
+
+		"table" gives golomb bit length for each (a, n).
 	*/
 
 	int n = TVP_TLG6_GOLOMB_N_COUNT - 1; /* output counter */
@@ -299,7 +358,7 @@ TVP_GL_FUNC_DECL(void, TVPTLG6DecodeGolombValuesForFirst, (tjs_int8 *pixelbuf, t
 
 			do
 			{
-				int k = TVPTLG6GolombBitLengthTable[a][n], v, sign;
+				int k = table[a][n], v, sign;
 
 				tjs_uint32 t = TVP_TLG6_FETCH_32BITS(bit_pool) >> bit_pos;
 				tjs_int bit_count;
@@ -352,11 +411,13 @@ TVP_GL_FUNC_DECL(void, TVPTLG6DecodeGolombValuesForFirst, (tjs_int8 *pixelbuf, t
 }
 
 /*export*/
-TVP_GL_FUNC_DECL(void, TVPTLG6DecodeGolombValues, (tjs_int8 *pixelbuf, tjs_int pixel_count, tjs_uint8 *bit_pool))
+TVP_GL_FUNC_DECL(void, TVPTLG6DecodeGolombValues, (tjs_int8 *pixelbuf, tjs_int pixel_count, tjs_uint8 *bit_pool, const tTVPTLG6GolombBitLengthTable table))
 {
 	/*
 		decode values packed in "bit_pool".
 		values are coded using golomb code.
+
+		"table" gives golomb bit length for each (a, n).
 	*/
 
 	int n = TVP_TLG6_GOLOMB_N_COUNT - 1; /* output counter */
@@ -419,7 +480,7 @@ TVP_GL_FUNC_DECL(void, TVPTLG6DecodeGolombValues, (tjs_int8 *pixelbuf, tjs_int p
 
 			do
 			{
-				int k = TVPTLG6GolombBitLengthTable[a][n], v, sign;
+				int k = table[a][n], v, sign;
 
 				tjs_uint32 t = TVP_TLG6_FETCH_32BITS(bit_pool) >> bit_pos;
 				tjs_int bit_count;
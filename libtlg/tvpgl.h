@@ -26,6 +26,12 @@
 #define TVP_GL_FUNC_PTR_DECL(rettype, funcname, arg) rettype __cdecl (*funcname) arg
 #define TVP_GL_FUNC_PTR_EXTERN_DECL_(rettype, funcname, arg) extern rettype __cdecl (*funcname) arg
 #define TVP_GL_FUNC_PTR_EXTERN_DECL TVP_GL_FUNC_PTR_EXTERN_DECL_
+#else
+#define TVP_GL_FUNC_DECL(rettype, funcname, arg)  rettype funcname arg
+#define TVP_GL_FUNC_EXTERN_DECL(rettype, funcname, arg)  extern rettype funcname arg
+#define TVP_GL_FUNC_PTR_DECL(rettype, funcname, arg) rettype (*funcname) arg
+#define TVP_GL_FUNC_PTR_EXTERN_DECL_(rettype, funcname, arg) extern rettype (*funcname) arg
+#define TVP_GL_FUNC_PTR_EXTERN_DECL TVP_GL_FUNC_PTR_EXTERN_DECL_
 #endif
 
 TVP_GL_FUNC_DECL(void, TVPFillARGB,  (tjs_uint32 *dest, tjs_int len, tjs_uint32 value));
@@ -33,11 +39,26 @@ TVP_GL_FUNC_DECL(void, TVPFillARGB,  (tjs_uint32 *dest, tjs_int len, tjs_uint32
 #define TVP_TLG6_H_BLOCK_SIZE 8
 #define TVP_TLG6_W_BLOCK_SIZE 8
 
+#define TVP_TLG6_GOLOMB_N_COUNT  4
+#define TVP_TLG6_GOLOMB_A_COUNT  (TVP_TLG6_GOLOMB_N_COUNT*2*128)
+#define TVP_TLG6_GOLOMB_K_COUNT  9
+
+/* golomb bit length (k) for each (a, n) */
+typedef char tTVPTLG6GolombBitLengthTable[TVP_TLG6_GOLOMB_A_COUNT][TVP_TLG6_GOLOMB_N_COUNT];
+/* compressed form of above; count of "a"s for each k, for each n */
+typedef short int tTVPTLG6GolombCompressedTable[TVP_TLG6_GOLOMB_N_COUNT][TVP_TLG6_GOLOMB_K_COUNT];
+
+extern tTVPTLG6GolombBitLengthTable TVPTLG6GolombBitLengthTable;
+extern tTVPTLG6GolombCompressedTable TVPTLG6GolombCompressed;
+extern void TVPCreateTable(void);
+extern int TVPTLG6ExpandGolombTable(tTVPTLG6GolombBitLengthTable table, const tTVPTLG6GolombCompressedTable compressed);
+
 TVP_GL_FUNC_DECL(void, TVPTLG5ComposeColors3To4,  (tjs_uint8 *outp, const tjs_uint8 *upper, tjs_uint8 * const * buf, tjs_int width));
 TVP_GL_FUNC_DECL(void, TVPTLG5ComposeColors4To4,  (tjs_uint8 *outp, const tjs_uint8 *upper, tjs_uint8 * const* buf, tjs_int width));
 TVP_GL_FUNC_DECL(tjs_int, TVPTLG5DecompressSlide,  (tjs_uint8 *out, const tjs_uint8 *in, tjs_int insize, tjs_uint8 *text, tjs_int initialr));
-TVP_GL_FUNC_DECL(void, TVPTLG6DecodeGolombValuesForFirst,  (tjs_int8 *pixelbuf, tjs_int pixel_count, tjs_uint8 *bit_pool));
-TVP_GL_FUNC_DECL(void, TVPTLG6DecodeGolombValues,  (tjs_int8 *pixelbuf, tjs_int pixel_count, tjs_uint8 *bit_pool));
+TVP_GL_FUNC_DECL(tjs_int, TVPTLG5DecompressSlideBounded,  (tjs_uint8 *out, tjs_int outsize, const tjs_uint8 *in, tjs_int insize, tjs_uint8 *text, tjs_int initialr));
+TVP_GL_FUNC_DECL(void, TVPTLG6DecodeGolombValuesForFirst,  (tjs_int8 *pixelbuf, tjs_int pixel_count, tjs_uint8 *bit_pool, const tTVPTLG6GolombBitLengthTable table));
+TVP_GL_FUNC_DECL(void, TVPTLG6DecodeGolombValues,  (tjs_int8 *pixelbuf, tjs_int pixel_count, tjs_uint8 *bit_pool, const tTVPTLG6GolombBitLengthTable table));
 TVP_GL_FUNC_DECL(void, TVPTLG6DecodeLineGeneric,  (tjs_uint32 *prevline, tjs_uint32 *curline, tjs_int width, tjs_int start_block, tjs_int block_limit, tjs_uint8 *filtertypes, tjs_int skipblockbytes, tjs_uint32 *in, tjs_uint32 initialp, tjs_int oddskip, tjs_int dir));
 TVP_GL_FUNC_DECL(void, TVPTLG6DecodeLine,  (tjs_uint32 *prevline, tjs_uint32 *curline, tjs_int width, tjs_int block_count, tjs_uint8 *filtertypes, tjs_int skipblockbytes, tjs_uint32 *in, tjs_uint32 initialp, tjs_int oddskip, tjs_int dir));
 
@@ -47,5 +68,17 @@ TVP_GL_FUNC_DECL(void, TVPTLG6DecodeLine,  (tjs_uint32 *prevline, tjs_uint32 *cu
 #endif
 /*]*/
 
+/*[*/
+#ifdef __cplusplus
+/* TVPCreateTable on the first call only; savers and loaders may run on
+   several threads at once */
+inline void TVPCreateTableOnce(void)
+{
+	static const bool created = (TVPCreateTable(), true);
+	(void)created;
+}
+#endif
+/*]*/
+
 #endif
 /* end of the file */
@@ -0,0 +1,261 @@
+﻿#include "atlas_command.h"
+#include "TLG.h"
+#include "fileop.h"
+#include "str_util.h"
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "atlas_packer.h"
+#include "cli_util.h"
+#include "convert.h"
+
+/**
+ * @brief Image of an atlas.
+ */
+struct AtlasImage {
+    std::string path;
+    std::string name;
+    TlgPic pic;
+    size_t atlas = 0;
+    uint32_t x = 0;
+    uint32_t y = 0;
+};
+
+/**
+ * @brief Packs images into atlases and encodes each atlas to TLG.
+ * @param output Path of the atlas. With more than one atlas, an index is put before the extension.
+ * @param maxSize Maximum width and height of an atlas
+ * @param padding Transparent pixels between images
+ */
+static void buildAtlas(std::vector<AtlasImage>& images, const std::string& output, uint32_t maxSize, uint32_t padding,
+    int tlgVersion, const std::map<std::string, std::string>& tags, const tTVPTLGSaveOption& saveOption) {
+    // tallest first, which suits the skyline
+    std::vector<size_t> order(images.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&images](size_t a, size_t b) {
+        const TlgPic& pa = images[a].pic;
+        const TlgPic& pb = images[b].pic;
+        return pa.height != pb.height ? pa.height > pb.height : pa.width > pb.width;
+    });
+    // each image takes the padding at its right and bottom, so the bins are larger by the padding
+    std::vector<SkylinePacker> packers;
+    for (auto index : order) {
+        auto& image = images[index];
+        if (image.pic.width > maxSize || image.pic.height > maxSize) {
+            throw std::runtime_error("Image is larger than the atlas size: " + image.path);
+        }
+        size_t i = 0;
+        for (; i < packers.size(); i++) {
+            if (packers[i].insert(image.pic.width + padding, image.pic.height + padding, image.x, image.y)) break;
+        }
+        if (i == packers.size()) {
+            packers.emplace_back(maxSize + padding, maxSize + padding);
+            packers.back().insert(image.pic.width + padding, image.pic.height + padding, image.x, image.y);
+        }
+        image.atlas = i;
+    }
+
+    for (size_t a = 0; a < packers.size(); a++) {
+        TlgPic atlas;
+        atlas.width = packers[a].usedWidth() - padding;
+        atlas.height = packers[a].usedHeight() - padding;
+        atlas.colors = 3;
+        std::vector<tTVPTLGAtlasEntry> entries;
+        for (const auto& image : images) {
+            if (image.atlas == a && image.pic.colors == 4) atlas.colors = 4;
+        }
+        size_t size = picByteSize(atlas.width, atlas.height, atlas.colors);
+        if (!size) {
+            throw std::runtime_error("Atlas is too large.");
+        }
+        std::unique_ptr<uint8_t[]> data(new uint8_t[size]());
+        atlas.data = data.get();
+        for (const auto& image : images) {
+            if (image.atlas != a) continue;
+            const TlgPic& pic = image.pic;
+            for (uint32_t y = 0; y < pic.height; y++) {
+                const uint8_t* s = picLine(pic, y);
+                uint8_t* d = picLine(atlas, image.y + y) + (size_t)image.x * atlas.colors;
+                for (uint32_t x = 0; x < pic.width; x++, s += pic.colors, d += atlas.colors) {
+                    if (pic.colors == 1) {
+                        d[0] = d[1] = d[2] = s[0];
+                    } else {
+                        d[0] = s[0];
+                        d[1] = s[1];
+                        d[2] = s[2];
+                    }
+                    if (atlas.colors == 4) d[3] = pic.colors == 4 ? s[3] : 255;
+                }
+            }
+            tTVPTLGAtlasEntry entry;
+            entry.name = image.name;
+            entry.rect.left = image.x;
+            entry.rect.top = image.y;
+            entry.rect.width = pic.width;
+            entry.rect.height = pic.height;
+            entries.push_back(entry);
+        }
+        std::vector<tTVPTLGChunk> chunks(1);
+        if (!TVPTLGBuildAtlasChunk(entries, chunks[0])) {
+            throw std::runtime_error("Too many images or too long names for an atlas.");
+        }
+        if (saveOption.extra_chunks) {
+            chunks.insert(chunks.end(), saveOption.extra_chunks->begin(), saveOption.extra_chunks->end());
+        }
+        tTVPTLGSaveOption option = saveOption;
+        option.extra_chunks = &chunks;
+        // trimming would move the images away from their rectangles
+        option.trim_transparent = false;
+
+        std::string path = output;
+        if (packers.size() > 1) {
+            std::string ext = fileop::extname(output);
+            path = fileop::filename(output) + "." + std::to_string(a) + (ext.empty() ? "" : "." + ext);
+        }
+        auto out = openFileStream(path, true);
+        int re = TVPSaveTLG(out.get(), tlgVersion == 5 ? 0 : 1, atlas.width, atlas.height, atlas.colors, &atlas,
+            tlg_pic_buf_callback, &tags, &option);
+        if (re != TLG_SUCCESS || !out->Flush()) {
+            throw std::runtime_error("Failed to save TLG file: " + path);
+        }
+        fprintf(stderr, "%s: %ux%u, %zu images\n", path.c_str(), atlas.width, atlas.height, entries.size());
+    }
+}
+
+static void printAtlasHelp() {
+    printf("Usage: tlg atlas [options] -o <output> <input>...\n");
+    printf("Pack PNG images into atlases and encode each atlas to a TLG file. The name and the rectangle of each\n");
+    printf("image are stored in the \"atls\" chunk of the atlas; tlg info prints them.\n");
+    printf("Options:\n");
+    printf("  -h, --help        Show this help message\n");
+    printf("  -o, --output <path>\n");
+    printf("                    TLG file to write. If the images need more than one atlas, an index is put\n");
+    printf("                    before the extension: <name>.0.tlg, <name>.1.tlg and so on.\n");
+    printf("  -v, --version <v> TLG version. Default: 5. Available values: 5, 6\n");
+    printf("  -s, --size <n>    Maximum width and height of an atlas. Default: 2048.\n");
+    printf("      --padding <n> Transparent pixels between images. Default: 1.\n");
+    printf("  -t, --tags <key>=<value>\n");
+    printf("                    Set a tag of the atlases. Can be used multiple times.\n");
+    printf("  -b, --batch <list>\n");
+    printf("                    Also pack the files listed in <list>, one per line. An image name can follow\n");
+    printf("                    the path after a tab. The name is the path otherwise.\n");
+}
+
+int runAtlas(int argc, char* argv[]) {
+    std::string output;
+    int tlgVersion = 5;
+    uint32_t maxSize = 2048;
+    uint32_t padding = 1;
+    std::map<std::string, std::string> tags;
+    std::vector<std::pair<std::string, std::string>> inputs;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            printAtlasHelp();
+            return 0;
+        } else if (arg.size() < 2 || arg[0] != '-') {
+            inputs.emplace_back(arg, memberName(arg));
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "%s needs a value.\n", arg.c_str());
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "-o" || arg == "--output") {
+            output = value;
+        } else if (arg == "-v" || arg == "--version") {
+            tlgVersion = atoi(value.c_str());
+            if (tlgVersion < 5 || tlgVersion > 6) {
+                fprintf(stderr, "Invalid TLG version: %s. Available values: 5, 6.\n", value.c_str());
+                return 1;
+            }
+        } else if (arg == "-s" || arg == "--size") {
+            unsigned long n = strtoul(value.c_str(), nullptr, 10);
+            if (!n || n > TVP_TLG_MAX_WIDTH) {
+                fprintf(stderr, "Invalid atlas size: %s\n", value.c_str());
+                return 1;
+            }
+            maxSize = (uint32_t)n;
+        } else if (arg == "--padding") {
+            unsigned long n = strtoul(value.c_str(), nullptr, 10);
+            if (n > 256) {
+                fprintf(stderr, "Invalid padding: %s. Available values: 0-256.\n", value.c_str());
+                return 1;
+            }
+            padding = (uint32_t)n;
+        } else if (arg == "-t" || arg == "--tags") {
+            auto re = str_util::str_splitv(value, "=", 2);
+            if (re.size() != 2) {
+                fprintf(stderr, "Invalid tag format: %s. Expected format: key=value\n", value.c_str());
+                return 1;
+            }
+            tags[re[0]] = re[1];
+        } else if (arg == "-b" || arg == "--batch") {
+            try {
+                for (const auto& line : readListFile(value)) {
+                    auto tab = line.find('\t');
+                    if (tab == std::string::npos) {
+                        inputs.emplace_back(line, memberName(line));
+                    } else {
+                        inputs.emplace_back(line.substr(0, tab), line.substr(tab + 1));
+                    }
+                }
+            } catch (const std::exception& e) {
+                fprintf(stderr, "Error: %s\n", e.what());
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+            printAtlasHelp();
+            return 1;
+        }
+    }
+    if (output.empty() || inputs.empty()) {
+        fprintf(stderr, "An output file and input images are required.\n");
+        printAtlasHelp();
+        return 1;
+    }
+    // images are looked up by name, so one of two with the same name could
+    // never be found
+    std::set<std::string> names;
+    for (const auto& input : inputs) {
+        if (!names.insert(input.second).second) {
+            fprintf(stderr, "Duplicate image name: %s\n", input.second.c_str());
+            return 1;
+        }
+    }
+    std::vector<AtlasImage> images(inputs.size());
+    int result = 0;
+    try {
+        for (size_t i = 0; i < inputs.size(); i++) {
+            images[i].path = inputs[i].first;
+            images[i].name = inputs[i].second;
+            memset(&images[i].pic, 0, sizeof(TlgPic));
+            auto in = openFileStream(inputs[i].first, false);
+            try {
+                images[i].pic = loadPng(in.get());
+            } catch (const std::exception& e) {
+                throw std::runtime_error(inputs[i].first + ": " + e.what());
+            }
+            if (!images[i].pic.width || !images[i].pic.height) {
+                throw std::runtime_error("Invalid PNG file: " + inputs[i].first);
+            }
+        }
+        tTVPTLGSaveOption saveOption;
+        buildAtlas(images, output, maxSize, padding, tlgVersion, tags, saveOption);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        result = 1;
+    }
+    for (auto& image : images) {
+        destory_tlg_pic(image.pic);
+    }
+    return result;
+}
@@ -0,0 +1,6 @@
+﻿/**
+ * @brief Runs the atlas subcommand.
+ * @param argc Count of arguments, including "atlas"
+ * @return Exit code
+ */
+int runAtlas(int argc, char* argv[]);
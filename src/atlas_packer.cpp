@@ -0,0 +1,65 @@
+﻿#include "atlas_packer.h"
+
+SkylinePacker::SkylinePacker(uint32_t width, uint32_t height) : binWidth(width), binHeight(height) {
+    skyline.push_back({ 0, 0, width });
+}
+
+bool SkylinePacker::fit(size_t index, uint32_t width, uint32_t height, uint32_t& y) const {
+    uint32_t x = skyline[index].x;
+    if (width > binWidth - x) return false;
+    // the rectangle rests on the highest segment under it
+    y = 0;
+    uint32_t remain = width;
+    for (size_t i = index; remain; i++) {
+        if (skyline[i].y > y) y = skyline[i].y;
+        if (height > binHeight - y) return false;
+        remain -= remain < skyline[i].width ? remain : skyline[i].width;
+    }
+    return true;
+}
+
+bool SkylinePacker::insert(uint32_t width, uint32_t height, uint32_t& x, uint32_t& y) {
+    if (!width || !height) return false;
+    size_t best = skyline.size();
+    uint32_t bestBottom = UINT32_MAX;
+    uint32_t bestWidth = UINT32_MAX;
+    for (size_t i = 0; i < skyline.size(); i++) {
+        uint32_t top;
+        if (!fit(i, width, height, top)) continue;
+        // lowest bottom edge first, then the narrowest segment to leave wide ones free
+        if (top + height < bestBottom || (top + height == bestBottom && skyline[i].width < bestWidth)) {
+            best = i;
+            bestBottom = top + height;
+            bestWidth = skyline[i].width;
+            y = top;
+        }
+    }
+    if (best == skyline.size()) return false;
+    x = skyline[best].x;
+
+    // the new segment covers the segments under the rectangle
+    skyline.insert(skyline.begin() + best, { x, y + height, width });
+    size_t i = best + 1;
+    while (i < skyline.size() && skyline[i].x < x + width) {
+        uint32_t end = skyline[i].x + skyline[i].width;
+        if (end <= x + width) {
+            skyline.erase(skyline.begin() + i);
+        } else {
+            skyline[i].width = end - (x + width);
+            skyline[i].x = x + width;
+            break;
+        }
+    }
+    // join neighbors of the same height
+    for (i = 0; i + 1 < skyline.size();) {
+        if (skyline[i].y == skyline[i + 1].y) {
+            skyline[i].width += skyline[i + 1].width;
+            skyline.erase(skyline.begin() + i + 1);
+        } else {
+            i++;
+        }
+    }
+    if (x + width > right) right = x + width;
+    if (y + height > bottom) bottom = y + height;
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+﻿#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/**
+ * @brief Places rectangles in a bin with the skyline bottom-left rule.
+ *
+ * The top edge of the placed rectangles is kept as a list of horizontal
+ * segments. A rectangle goes where its bottom edge ends up lowest; among
+ * equally low places it takes the one on the narrowest segment, leaving
+ * wide ones for wide rectangles. Space below a segment is never reused,
+ * which wastes little when rectangles are inserted from the tallest.
+*/
+class SkylinePacker {
+public:
+    /**
+     * @param width Width of the bin
+     * @param height Height of the bin
+     */
+    SkylinePacker(uint32_t width, uint32_t height);
+    /**
+     * @brief Places a rectangle.
+     * @param x Receives the left edge of the rectangle
+     * @param y Receives the top edge of the rectangle
+     * @return false if the rectangle does not fit.
+     */
+    bool insert(uint32_t width, uint32_t height, uint32_t& x, uint32_t& y);
+    /// Right edge of the rightmost rectangle placed.
+    uint32_t usedWidth() const { return right; }
+    /// Bottom edge of the lowest rectangle placed.
+    uint32_t usedHeight() const { return bottom; }
+private:
+    struct Segment {
+        uint32_t x;
+        uint32_t y;
+        uint32_t width;
+    };
+    bool fit(size_t index, uint32_t width, uint32_t height, uint32_t& y) const;
+    uint32_t binWidth;
+    uint32_t binHeight;
+    uint32_t right = 0;
+    uint32_t bottom = 0;
+    std::vector<Segment> skyline;
+};
\ No newline at end of file
@@ -0,0 +1,322 @@
+﻿#include "batch.h"
+#include "fileop.h"
+#include "str_util.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include "buffer_stream.h"
+#include "cli_util.h"
+#include "convert.h"
+#include "errno_message.h"
+#include "memory_scheduler.h"
+#include "png_stream.h"
+#include "stats_stream.h"
+#include "task_pool.h"
+
+/**
+ * @brief Matches a file name against a pattern, where * is any characters and ? is one character. Case is ignored.
+ */
+static bool matchPattern(const std::string& pattern, const std::string& name) {
+    std::string p = str_util::tolower(pattern);
+    std::string n = str_util::tolower(name);
+    size_t pi = 0, ni = 0;
+    size_t star = std::string::npos, mark = 0;
+    while (ni < n.size()) {
+        if (pi < p.size() && (p[pi] == '?' || p[pi] == n[ni])) {
+            pi++;
+            ni++;
+        } else if (pi < p.size() && p[pi] == '*') {
+            star = pi++;
+            mark = ni;
+        } else if (star != std::string::npos) {
+            pi = star + 1;
+            ni = ++mark;
+        } else {
+            return false;
+        }
+    }
+    while (pi < p.size() && p[pi] == '*') pi++;
+    return pi == p.size();
+}
+
+void collectBatchJobs(const std::string& source, const std::string& pattern, const std::string& outputDir,
+    std::vector<BatchJob>& jobs) {
+    namespace fs = std::filesystem;
+    auto outputOf = [&outputDir](const std::string& input, const std::string& relative) {
+        if (outputDir.empty()) return defaultOutputPath(input);
+        return defaultOutputPath(fileop::join(outputDir, relative));
+    };
+    std::string dir = source;
+    std::string match = pattern;
+    std::string name = fileop::basename(source);
+    if (name.find_first_of("*?") != std::string::npos) {
+        dir = fileop::dirname(source);
+        if (dir.empty()) dir = ".";
+        match = name;
+    }
+    std::error_code ec;
+    fs::path root = fs::u8path(dir);
+    if (!fs::is_directory(root, ec)) {
+        if (dir != source) {
+            throw std::runtime_error("Not a directory: " + dir);
+        }
+        for (const auto& line : readListFile(source)) {
+            auto tab = line.find('\t');
+            if (tab != std::string::npos) {
+                jobs.push_back({ line.substr(0, tab), line.substr(tab + 1) });
+                continue;
+            }
+            std::string relative = memberName(line);
+            jobs.push_back({ line, outputOf(line, isSafeMemberName(relative) ? relative : fileop::basename(line)) });
+        }
+        return;
+    }
+    std::vector<std::string> found;
+    fs::recursive_directory_iterator it(root, ec), end;
+    for (; !ec && it != end; it.increment(ec)) {
+        if (!it->is_regular_file(ec)) continue;
+        std::string file = it->path().filename().u8string();
+        if (match.empty() ? !isTlgPath(file) && str_util::tolower(fileop::extname(file)) != "png" : !matchPattern(match, file)) {
+            continue;
+        }
+        found.push_back(it->path().lexically_relative(root).generic_u8string());
+    }
+    if (ec) {
+        throw std::runtime_error("Failed to list directory: " + dir + ": " + ec.message());
+    }
+    // the order of a directory listing depends on the file system
+    std::sort(found.begin(), found.end());
+    for (const auto& relative : found) {
+        std::string input = fileop::join(dir, relative);
+        jobs.push_back({ input, outputOf(input, relative) });
+    }
+}
+
+static void addGolombStatistics(tTVPTLG6GolombStatistics& dest, const tTVPTLG6GolombStatistics& src) {
+    for (size_t i = 0; i < sizeof(dest.Bits) / sizeof(dest.Bits[0][0][0]); i++) {
+        (&dest.Bits[0][0][0])[i] += (&src.Bits[0][0][0])[i];
+    }
+}
+
+size_t runBatch(const std::vector<BatchJob>& jobs, IoEngine::Kind engineKind, unsigned depth, unsigned threads,
+    uint64_t memoryBudget, int tlgVersion, const std::map<std::string, std::string>& input_tags, const tTVPTLGSaveOption& saveOption,
+    bool thumbnailOnly, const DeltaBase& delta, IoStats* inputStats, IoStats* outputStats) {
+    // files converted at the same time must not write over each other
+    std::map<std::string, size_t> inputs;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        inputs.emplace(memberName(jobs[i].input), i);
+    }
+    std::set<std::string> parents;
+    for (const auto& job : jobs) {
+        auto it = inputs.find(memberName(job.output));
+        if (it != inputs.end()) {
+            throw std::runtime_error("The output of " + job.input + " is the input " + jobs[it->second].input +
+                ". Use --match to choose the inputs.");
+        }
+        std::string parent = fileop::dirname(job.output);
+        if (!parent.empty() && parents.insert(parent).second && !fileop::mkdirs(parent, 0777, true)) {
+            throw std::runtime_error("Failed to create directory: " + parent);
+        }
+    }
+    auto engine = IoEngine::create(engineKind, depth);
+    if (!engine) {
+        throw std::runtime_error("The requested I/O engine is not available.");
+    }
+    std::unique_ptr<TaskPool> pool(new TaskPool(threads));
+    if (depth < pool->size()) depth = pool->size();
+    tTVPTLGSaveOption taskOption = saveOption;
+    if (pool->size() > 1) {
+        taskOption.tlg6_parallel = taskPoolParallel;
+        taskOption.tlg6_parallel_data = pool.get();
+    }
+
+    /**
+     * @brief A converted file, handed from a worker back to the I/O loop.
+     */
+    struct Converted {
+        size_t id;
+        std::vector<uint8_t> data;
+        std::string error;
+        IoStats inputStats;
+        IoStats outputStats;
+        std::unique_ptr<tTVPTLG6GolombStatistics> golombStatistics;
+    };
+    std::mutex convertedMutex;
+    std::condition_variable convertedReady;
+    std::deque<std::unique_ptr<Converted>> converted;
+    auto convert = [&](size_t id, std::vector<uint8_t> data) {
+        const auto& job = jobs[id];
+        std::unique_ptr<Converted> result(new Converted());
+        result->id = id;
+        try {
+            BufferStream in(std::move(data));
+            BufferStream out;
+            tTJSBinaryStream* src = &in;
+            tTJSBinaryStream* dest = &out;
+            // counters of this file, added to the totals by the I/O loop
+            std::unique_ptr<StatsStream> countedIn, countedOut;
+            if (inputStats) {
+                countedIn.reset(new StatsStream(&in, result->inputStats));
+                src = countedIn.get();
+            }
+            if (outputStats) {
+                countedOut.reset(new StatsStream(&out, result->outputStats));
+                dest = countedOut.get();
+            }
+            if (isTlgPath(job.input)) {
+                tlgToPng(src, dest, job.input, fileop::filename(job.output) + ".tags", thumbnailOnly, delta);
+            } else {
+                tTVPTLGSaveOption option = taskOption;
+                if (saveOption.tlg6_golomb_statistics) {
+                    result->golombStatistics.reset(new tTVPTLG6GolombStatistics());
+                    option.tlg6_golomb_statistics = result->golombStatistics.get();
+                }
+                pngToTlg(src, dest, job.input, tlgVersion, input_tags, option, delta);
+            }
+            result->data = std::move(out.data());
+        } catch (const std::exception& e) {
+            result->error = e.what();
+            if (result->error.find(job.input) == std::string::npos) {
+                result->error = job.input + ": " + result->error;
+            }
+        }
+        // notified under the lock, as the I/O loop may return as soon as it sees the result
+        std::lock_guard<std::mutex> lock(convertedMutex);
+        converted.push_back(std::move(result));
+        convertedReady.notify_one();
+    };
+
+    // read files wait here until the scheduler starts them
+    MemoryScheduler scheduler(memoryBudget, depth);
+    std::map<size_t, std::vector<uint8_t>> ready;
+    size_t failures = 0;
+    size_t written = 0;
+    uint64_t bytesRead = 0;
+    uint64_t bytesWritten = 0;
+    size_t next = 0;
+    // files being read or converted, and outputs being written
+    size_t reading = 0;
+    size_t converting = 0;
+    size_t writing = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto reportError = [&failures](const std::string& path, int code) {
+        fprintf(stderr, "Error: %s: %s\n", path.c_str(), errnoMessage(code).c_str());
+        failures++;
+    };
+    try {
+        while (true) {
+            // start the conversions which fit in the memory budget; with a
+            // budget, only as many as there are threads, so that the choice
+            // is made when a thread is free
+            size_t id;
+            while ((!memoryBudget || converting < pool->size()) && scheduler.next(id)) {
+                auto data = std::make_shared<std::vector<uint8_t>>(std::move(ready[id]));
+                ready.erase(id);
+                converting++;
+                pool->submit([&convert, id, data] { convert(id, std::move(*data)); });
+            }
+            // keep the engine busy with reads of upcoming inputs, while the
+            // files in memory stay within the depth
+            while (next < jobs.size() && reading + converting + scheduler.waiting() < depth) {
+                std::unique_ptr<IoRequest> req(new IoRequest());
+                req->type = IoRequest::Read;
+                req->path = jobs[next].input;
+                req->id = next++;
+                engine->submit(std::move(req));
+                reading++;
+            }
+            std::deque<std::unique_ptr<Converted>> results;
+            {
+                std::unique_lock<std::mutex> lock(convertedMutex);
+                if (converted.empty() && !reading && !writing && converting) {
+                    convertedReady.wait(lock, [&converted] { return !converted.empty(); });
+                }
+                results.swap(converted);
+            }
+            for (auto& result : results) {
+                converting--;
+                scheduler.finish(result->id, result->error.empty() ? result->data.size() : 0);
+                if (inputStats) inputStats->add(result->inputStats);
+                if (outputStats) outputStats->add(result->outputStats);
+                if (result->golombStatistics) {
+                    addGolombStatistics(*saveOption.tlg6_golomb_statistics, *result->golombStatistics);
+                }
+                if (!result->error.empty()) {
+                    fprintf(stderr, "Error: %s\n", result->error.c_str());
+                    failures++;
+                    continue;
+                }
+                std::unique_ptr<IoRequest> write(new IoRequest());
+                write->type = IoRequest::Write;
+                write->path = jobs[result->id].output;
+                write->id = result->id;
+                write->data = std::move(result->data);
+                engine->submit(std::move(write));
+                writing++;
+            }
+            if (!results.empty()) continue;
+            if (!reading && !writing) {
+                if (converting) continue;
+                break;
+            }
+            auto req = engine->wait();
+            if (req->type == IoRequest::Write) {
+                writing--;
+                if (req->error) {
+                    reportError(req->path, req->error);
+                } else {
+                    written++;
+                    bytesWritten += req->data.size();
+                }
+                continue;
+            }
+            reading--;
+            if (req->error) {
+                reportError(req->path, req->error);
+                continue;
+            }
+            bytesRead += req->data.size();
+            bool encoding = !isTlgPath(jobs[req->id].input);
+            ImageHeader header;
+            uint64_t pixelBytes = 0;
+            uint64_t bufferBytes = 0;
+            if (readImageHeader(req->data.data(), req->data.size(), header)) {
+                pixelBytes = (uint64_t)header.width * header.height * header.colors;
+                // images are streamed: the rows of the PNG side and the row
+                // groups of the TLG codec, unless pngToTlg keeps the image
+                // whole for bands encoded on several threads
+                uint64_t rowBytes = (uint64_t)header.width * 4 * PngReader::RingLines * 2;
+                bool whole = encoding && taskOption.tlg6_parallel && tlgVersion == 6 && pixelBytes <= WholePngBytes;
+                bufferBytes = whole ? pixelBytes : std::min(pixelBytes, rowBytes);
+            }
+            scheduler.add(req->id, encoding, req->data.size(), pixelBytes, bufferBytes);
+            ready[req->id] = std::move(req->data);
+        }
+    } catch (...) {
+        // queued conversions refer to the locals of this function
+        pool.reset();
+        throw;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "Converted %zu of %zu files on %u thread%s in %.2f s (%.1f files/s), %s read, %s written",
+        written, jobs.size(), pool->size(), pool->size() > 1 ? "s" : "", seconds, seconds > 0 ? written / seconds : 0.0,
+        formatBytes(bytesRead).c_str(), formatBytes(bytesWritten).c_str());
+    fprintf(stderr, failures ? ", %zu failed.\n" : ".\n", failures);
+    if (memoryBudget) {
+        // estimates against the process peak, the only measured figure, to
+        // calibrate the budget
+        uint64_t resident = peakResidentBytes();
+        fprintf(stderr, "Memory: budget %s, estimated peak %s, process peak %s. Largest file: estimated %s, %s with its real output.",
+            formatBytes(memoryBudget).c_str(), formatBytes(scheduler.peakEstimate()).c_str(),
+            resident ? formatBytes(resident).c_str() : "unknown", formatBytes(scheduler.largestEstimate()).c_str(),
+            formatBytes(scheduler.largestCalibrated()).c_str());
+        fprintf(stderr, " Output per pixel byte: encode %.3f, decode %.3f.\n", scheduler.outputRatio(true),
+            scheduler.outputRatio(false));
+    }
+    return failures;
+}
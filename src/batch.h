@@ -0,0 +1,48 @@
+﻿#include "TLG.h"
+#include "io_engine.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <vector>
+
+struct DeltaBase;
+struct IoStats;
+
+/**
+ * @brief A file of a batch conversion.
+ */
+struct BatchJob {
+    std::string input;
+    std::string output;
+};
+
+/**
+ * @brief Adds the files of a batch source to jobs.
+ * @param source A directory, whose files are converted recursively, a directory followed by a file name pattern
+ * such as dir/\*.png, which is the directory with that pattern, or a list file. Each line of a list file is an input
+ * path, optionally followed by a tab and an output path.
+ * @param pattern If not empty, only files of a directory whose name matches it are converted. PNG and TLG files otherwise.
+ * @param outputDir If not empty, outputs are written to this directory, at their path relative to the source
+ * directory. Relative paths of a list file are kept too; other files of a list go directly into it.
+ */
+void collectBatchJobs(const std::string& source, const std::string& pattern, const std::string& outputDir,
+    std::vector<BatchJob>& jobs);
+
+/**
+ * @brief Converts many files. Inputs are read and outputs are written by an IoEngine on the calling thread, and
+ * files are converted in memory on a work-stealing TaskPool. TLG6 images are encoded in bands of row groups, which
+ * idle workers steal, so that a large image does not hold back the end of the batch.
+ * @param depth Count of files read ahead and converted at the same time, at least the count of threads.
+ * @param threads Count of conversion threads. 0 for the count of hardware threads.
+ * @param memoryBudget If not 0, conversions start only while the sum of their estimated peak memory fits in this
+ * many bytes. See MemoryScheduler.
+ * @param thumbnailOnly Decode the embedded thumbnails of TLG images. See tlgToPng.
+ * @param delta Base image of the delta images to encode or decode. See tlgToPng and pngToTlg.
+ * @param inputStats If not null, accesses of the codecs to the inputs in memory are added to it.
+ * @param outputStats If not null, accesses of the codecs to the outputs in memory are added to it.
+ * @return Count of files failed to convert.
+ */
+size_t runBatch(const std::vector<BatchJob>& jobs, IoEngine::Kind engineKind, unsigned depth, unsigned threads,
+    uint64_t memoryBudget, int tlgVersion, const std::map<std::string, std::string>& input_tags, const tTVPTLGSaveOption& saveOption,
+    bool thumbnailOnly, const DeltaBase& delta, IoStats* inputStats, IoStats* outputStats);
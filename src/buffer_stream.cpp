@@ -0,0 +1,88 @@
+﻿#include "buffer_stream.h"
+#include <string.h>
+#include <stdexcept>
+
+BufferStream::BufferStream(std::vector<uint8_t>&& data) : buffer(std::move(data)) {
+}
+
+tjs_uint64 BufferStream::Seek(tjs_int64 offset, tjs_int whence) {
+    tjs_int64 newpos;
+    switch (whence) {
+    case TJS_BS_SEEK_CUR:
+        newpos = position + offset;
+        break;
+    case TJS_BS_SEEK_END:
+        newpos = buffer.size() + offset;
+        break;
+    default:
+        newpos = offset;
+        break;
+    }
+    if (newpos < 0) {
+        throw std::runtime_error("Failed to seek in buffer stream: negative position");
+    }
+    position = newpos;
+    return position;
+}
+
+tjs_uint BufferStream::Read(void* dest, tjs_uint read_size) {
+    if (position >= buffer.size()) return 0;
+    size_t size = buffer.size() - position;
+    if (size > read_size) size = read_size;
+    memcpy(dest, buffer.data() + position, size);
+    position += size;
+    return size;
+}
+
+tjs_uint BufferStream::Write(const void* src, tjs_uint write_size) {
+    if (!write_size) return 0;
+    if (position + write_size > buffer.size()) {
+        buffer.resize(position + write_size);
+    }
+    memcpy(buffer.data() + position, src, write_size);
+    position += write_size;
+    return write_size;
+}
+
+const void* BufferStream::GetView(tjs_uint64 pos, tjs_uint& size) {
+    if (pos >= buffer.size()) {
+        size = 0;
+        return nullptr;
+    }
+    size_t remain = buffer.size() - pos;
+    size = remain > 0xffffffff ? 0xffffffff : (tjs_uint)remain;
+    return buffer.data() + pos;
+}
+
+PrefixedStream::PrefixedStream(std::vector<uint8_t>&& prefix, tTJSBinaryStream* source) : prefix(std::move(prefix)), source(source) {
+}
+
+tjs_uint64 PrefixedStream::Seek(tjs_int64 offset, tjs_int whence) {
+    if ((whence == TJS_BS_SEEK_CUR && offset == 0) || (whence == TJS_BS_SEEK_SET && (tjs_uint64)offset == position)) {
+        return position;
+    }
+    throw std::runtime_error("Failed to seek in stream: the stream is not seekable");
+}
+
+tjs_uint PrefixedStream::Read(void* dest, tjs_uint read_size) {
+    tjs_uint total = 0;
+    if (position < prefix.size()) {
+        size_t size = prefix.size() - position;
+        if (size > read_size) size = read_size;
+        memcpy(dest, prefix.data() + position, size);
+        total = size;
+    }
+    if (total < read_size) {
+        total += source->Read(static_cast<uint8_t*>(dest) + total, read_size - total);
+    }
+    position += total;
+    return total;
+}
+
+tjs_uint PrefixedStream::Write(const void* src, tjs_uint write_size) {
+    return 0;
+}
+
+bool PrefixedStream::CanSeek() {
+    return false;
+}
\ No newline at end of file
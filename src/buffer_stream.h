@@ -0,0 +1,48 @@
+﻿#include "stream.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/**
+ * @brief Stream on a byte vector in memory. Writes grow the vector.
+*/
+class BufferStream : public tTJSBinaryStream {
+public:
+    BufferStream() {}
+    /**
+     * @brief Creates a stream on the specified contents.
+     * @param data Contents. Moved into the stream.
+     */
+    BufferStream(std::vector<uint8_t>&& data);
+    virtual tjs_uint64 Seek(tjs_int64 offset, tjs_int whence) override;
+    virtual tjs_uint Read(void* buffer, tjs_uint read_size) override;
+    virtual tjs_uint Write(const void* buffer, tjs_uint write_size) override;
+    virtual const void* GetView(tjs_uint64 pos, tjs_uint& size) override;
+    std::vector<uint8_t>& data() { return buffer; }
+private:
+    std::vector<uint8_t> buffer;
+    size_t position = 0;
+};
+
+/**
+ * @brief Forward-only stream which replays bytes already read from a stream before the rest of it.
+ *
+ * Used to look at the head of a pipe and then hand the whole stream to a decoder.
+*/
+class PrefixedStream : public tTJSBinaryStream {
+public:
+    /**
+     * @param prefix Bytes read from the source so far.
+     * @param source Stream the rest is read from. Not owned.
+     */
+    PrefixedStream(std::vector<uint8_t>&& prefix, tTJSBinaryStream* source);
+    /// Only seeks to the current position are allowed; others throw a runtime error.
+    virtual tjs_uint64 Seek(tjs_int64 offset, tjs_int whence) override;
+    virtual tjs_uint Read(void* buffer, tjs_uint read_size) override;
+    virtual tjs_uint Write(const void* buffer, tjs_uint write_size) override;
+    virtual bool CanSeek() override;
+private:
+    std::vector<uint8_t> prefix;
+    tTJSBinaryStream* source;
+    tjs_uint64 position = 0;
+};
\ No newline at end of file
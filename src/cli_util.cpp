@@ -0,0 +1,79 @@
+﻿#include "cli_util.h"
+#include "fileop.h"
+#include <stdexcept>
+#include <stdio.h>
+
+std::vector<std::string> readListFile(const std::string& listPath) {
+    FILE* fp = fileop::fopen(listPath, "rb");
+    if (!fp) {
+        throw std::runtime_error("Failed to open list file: " + listPath);
+    }
+    std::vector<std::string> lines;
+    std::string line;
+    int c;
+    do {
+        c = fgetc(fp);
+        if (c != EOF && c != '\n') {
+            line += (char)c;
+            continue;
+        }
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        if (!line.empty()) lines.push_back(line);
+        line.clear();
+    } while (c != EOF);
+    fclose(fp);
+    return lines;
+}
+
+std::string memberName(const std::string& path) {
+    std::string name = path;
+    for (auto& c : name) {
+        if (c == '\\') c = '/';
+    }
+    while (name.size() > 2 && name.compare(0, 2, "./") == 0) name.erase(0, 2);
+    return name;
+}
+
+bool isSafeMemberName(std::string_view name) {
+    if (name.empty() || name[0] == '/' || name.find('\\') != std::string_view::npos || name.find(':') != std::string_view::npos) {
+        return false;
+    }
+    size_t start = 0;
+    while (start <= name.size()) {
+        size_t end = name.find('/', start);
+        if (end == std::string_view::npos) end = name.size();
+        auto part = name.substr(start, end - start);
+        if (part.empty() || part == "." || part == "..") return false;
+        start = end + 1;
+    }
+    return true;
+}
+
+std::string formatBytes(uint64_t bytes) {
+    char buf[32];
+    if (bytes < 1024 * 1024) {
+        snprintf(buf, sizeof(buf), "%.1f KiB", bytes / 1024.0);
+    } else if (bytes < 1024ull * 1024 * 1024) {
+        snprintf(buf, sizeof(buf), "%.1f MiB", bytes / (1024.0 * 1024.0));
+    } else {
+        snprintf(buf, sizeof(buf), "%.2f GiB", bytes / (1024.0 * 1024.0 * 1024.0));
+    }
+    return buf;
+}
+
+void appendJsonString(std::string& out, const std::string& str) {
+    out += '"';
+    for (unsigned char c : str) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += (char)c;
+        }
+    }
+    out += '"';
+}
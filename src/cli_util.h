@@ -0,0 +1,29 @@
+﻿#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Reads the non-empty lines of a list file.
+ */
+std::vector<std::string> readListFile(const std::string& listPath);
+
+/**
+ * @brief Returns the name of a file in a pack or an atlas: the path with '/' as separator and without a leading "./".
+ */
+std::string memberName(const std::string& path);
+
+/**
+ * @brief Checks that a member name stays in the output directory when it is extracted.
+ */
+bool isSafeMemberName(std::string_view name);
+
+/**
+ * @brief Formats a byte count in KiB, MiB or GiB.
+*/
+std::string formatBytes(uint64_t bytes);
+
+/**
+ * @brief Appends a string as a JSON string literal. Bytes other than control characters are copied as is.
+ */
+void appendJsonString(std::string& out, const std::string& str);
@@ -0,0 +1,202 @@
+﻿#include "convert.h"
+#include "fileop.h"
+#include "str_util.h"
+#include <stdexcept>
+#include <string.h>
+#include "dict_file.h"
+#include "png_stream.h"
+#include "task_pool.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <unistd.h>
+#endif
+
+size_t picByteSize(uint64_t width, uint64_t height, uint64_t colors) {
+    uint64_t line = width * colors;
+    if (height && line > (uint64_t)SIZE_MAX / height) {
+        return 0;
+    }
+    return (size_t)(line * height);
+}
+
+void* tlg_pic_buf_callback(void* callbackdata, tjs_int y) {
+    TlgPic* pic = static_cast<TlgPic*>(callbackdata);
+    if (y < 0) {
+        // If y is -1, return nullptr to indicate that the image has been fully processed
+        return nullptr;
+    }
+    // Return a pointer to the scanline buffer for the specified y coordinate
+    return picLine(*pic, y);
+}
+
+void destory_tlg_pic(TlgPic& pic) {
+    if (pic.data) {
+        delete[] pic.data;
+        pic.data = nullptr;
+    }
+    pic.width = 0;
+    pic.height = 0;
+    pic.colors = 0;
+}
+
+TlgPic loadPng(tTJSBinaryStream* in) {
+    PngReader reader(in);
+    TlgPic pic;
+    pic.width = reader.width();
+    pic.height = reader.height();
+    pic.colors = reader.colors();
+    size_t size = picByteSize(pic.width, pic.height, pic.colors);
+    if (!size) {
+        throw std::runtime_error("PNG image is too large.");
+    }
+    pic.data = new uint8_t[size];
+    for (uint32_t y = 0; y < pic.height; ++y) {
+        const uint8_t* row = reader.row(y);
+        if (!row) {
+            destory_tlg_pic(pic);
+            throw std::runtime_error(reader.error());
+        }
+        memcpy(picLine(pic, y), row, (size_t)pic.width * pic.colors);
+    }
+    return pic;
+}
+
+std::unique_ptr<NativeFileStream> openFileStream(const std::string& path, bool writing) {
+    if (path == "-") {
+#ifdef _WIN32
+        FILE* fp = writing ? stdout : stdin;
+        _setmode(_fileno(fp), _O_BINARY);
+        return std::unique_ptr<NativeFileStream>(new FileStream(fp, false));
+#else
+        return std::unique_ptr<NativeFileStream>(new FdStream(writing ? STDOUT_FILENO : STDIN_FILENO, false));
+#endif
+    }
+    return std::unique_ptr<NativeFileStream>(new NativeFileStream(path, writing ? "wb" : "rb"));
+}
+
+bool isTlgPath(const std::string& path) {
+    std::string ext = str_util::tolower(fileop::extname(path));
+    return ext == "tlg" || ext == "tlg5" || ext == "tlg6";
+}
+
+std::string defaultOutputPath(const std::string& input) {
+    return fileop::filename(input) + (isTlgPath(input) ? ".png" : ".tlg");
+}
+
+void tlgToPng(tTJSBinaryStream* in, tTJSBinaryStream* out, const std::string& input, const std::string& tagsPath,
+    bool thumbnailOnly, const DeltaBase& delta) {
+    // a stream which cannot seek would lose the signature checked here;
+    // the decoder rejects such input anyway
+    if (in->CanSeek() && !TVPCheckTLG(in)) {
+        throw std::runtime_error("Not a valid TLG file: " + input);
+    }
+    PngWriter writer(out, true);
+    std::map<std::string, std::string> tags;
+    int re;
+    tTVPTLGDeltaInfo deltaInfo;
+    bool isDelta = !thumbnailOnly && (in->CanSeek() ? TVPProbeTLGDelta(in, &deltaInfo) == TLG_SUCCESS : !delta.path.empty());
+    if (thumbnailOnly) {
+        re = TVPLoadTLGThumbnail(&writer, PngWriter::sizeCallback, PngWriter::scanLine, in);
+    } else if (isDelta) {
+        std::string basePath = delta.path;
+        if (basePath.empty()) {
+            if (input == "-") {
+                throw std::runtime_error("The base image of a delta image on stdin must be specified by --delta-base.");
+            }
+            std::string dir = fileop::dirname(input);
+            basePath = dir.empty() ? deltaInfo.base : fileop::join(dir, deltaInfo.base);
+        }
+        auto base = openFileStream(basePath, false);
+        re = TVPLoadTLGDelta(&writer, PngWriter::sizeCallback, PngWriter::scanLine, &tags, in, base.get());
+        if (re != TLG_SUCCESS && writer.error().empty()) {
+            throw std::runtime_error("Failed to load TLG file: " + input + ". It is a delta image; the base " + basePath +
+                " may not be the one it was made against.");
+        }
+    } else {
+        re = TVPLoadTLG(
+            &writer,
+            PngWriter::sizeCallback,
+            PngWriter::scanLine,
+            &tags,
+            in
+        );
+    }
+    // a failed write aborts the decoder
+    if (!writer.error().empty()) {
+        throw std::runtime_error(writer.error());
+    }
+    if (re != TLG_SUCCESS) {
+        throw std::runtime_error("Failed to load TLG file: " + input);
+    }
+    writer.finish();
+    if (!tags.empty() && tagsPath.empty()) {
+        fprintf(stderr, "Warning: The tags of %s are not saved.\n", input.c_str());
+    } else if (!tags.empty()) {
+        auto f = fileop::fopen(tagsPath, "wb");
+        if (!f) {
+            throw std::runtime_error("Failed to open output file for tags: " + tagsPath);
+        }
+        for (const auto& tag : tags) {
+            fprintf(f, "%s=%s\n", tag.first.c_str(), tag.second.c_str());
+        }
+        fclose(f);
+    }
+}
+
+void pngToTlg(tTJSBinaryStream* in, tTJSBinaryStream* out, const std::string& input, int tlgVersion,
+    const std::map<std::string, std::string>& input_tags, const tTVPTLGSaveOption& saveOption,
+    const DeltaBase& delta) {
+    // bands of TLG6 encoded on several threads read rows out of order, so
+    // the image is decoded whole; larger ones are read row by row and
+    // encoded on one thread
+    PngReader reader(in, saveOption.tlg6_parallel && tlgVersion == 6 ? WholePngBytes : 0);
+    tTVPTLGSaveOption option = saveOption;
+    if (reader.streaming()) {
+        option.tlg6_parallel = nullptr;
+    }
+    std::map<std::string, std::string> tags;
+    auto tags_path = fileop::filename(input) + ".tags";
+    if (fileop::exists(tags_path)) {
+        DictFile dict(tags_path);
+        if (!dict.HasError) {
+            tags = dict.maps;
+        }
+    }
+    for (const auto& tag : input_tags) {
+        tags[tag.first] = tag.second;
+    }
+    int re;
+    if (!delta.path.empty()) {
+        auto base = openFileStream(delta.path, false);
+        re = TVPSaveTLGDelta(out, tlgVersion == 5 ? 0 : 1, reader.width(), reader.height(), reader.colors(), &reader,
+            PngReader::scanLine, base.get(), delta.name.empty() ? fileop::basename(delta.path) : delta.name, &tags,
+            &option);
+    } else {
+        re = TVPSaveTLG(
+            out,
+            tlgVersion == 5 ? 0 : 1, // TLG version
+            reader.width(),
+            reader.height(),
+            reader.colors(),
+            &reader,
+            PngReader::scanLine,
+            &tags,
+            &option
+        );
+    }
+    if (!reader.error().empty()) {
+        throw std::runtime_error(reader.error());
+    }
+    if (re != TLG_SUCCESS) {
+        throw std::runtime_error("Failed to save TLG file: " + input);
+    }
+}
+
+void taskPoolParallel(void* callbackdata, tjs_int count, tTVPTLGTaskProc task, void* taskdata) {
+    static_cast<TaskPool*>(callbackdata)->parallelFor(count, [task, taskdata](size_t i) {
+        task(taskdata, (tjs_int)i);
+    });
+}
@@ -0,0 +1,110 @@
+﻿#include "TLG.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <memory>
+#include <string>
+
+#ifdef _WIN32
+#include "file_stream.h"
+typedef FileStream NativeFileStream;
+#else
+#include "fd_stream.h"
+// avoids the lseek/ftell pair stdio makes for every position query
+typedef FdStream NativeFileStream;
+#endif
+
+typedef struct TlgPic {
+    uint32_t width;
+    uint32_t height;
+    uint32_t colors;
+    uint8_t* data; // Pointer to the image data
+} TlgPic;
+
+/**
+ * @brief Returns the byte size of a width x height x colors image.
+ * @return 0 if the size does not fit in size_t.
+*/
+size_t picByteSize(uint64_t width, uint64_t height, uint64_t colors);
+
+/**
+ * @brief Returns the address of scanline y.
+*/
+static inline uint8_t* picLine(const TlgPic& pic, uint32_t y) {
+    return pic.data + (size_t)y * pic.width * pic.colors;
+}
+
+/**
+ * @brief Scanline callback of the encoder which returns the lines of a TlgPic.
+*/
+void* tlg_pic_buf_callback(void* callbackdata, tjs_int y);
+void destory_tlg_pic(TlgPic& pic);
+
+/**
+ * @brief PNG images of at most this many pixel bytes are decoded whole when TLG6 bands are encoded on several
+ * threads. Larger ones are read row by row and encoded on one thread.
+*/
+static const uint64_t WholePngBytes = 64ull << 20;
+
+/**
+ * @brief Reads a whole PNG image, in the BGR(A) order of TLG.
+ */
+TlgPic loadPng(tTJSBinaryStream* in);
+
+/**
+ * @brief Opens a file for reading or writing. "-" opens stdin or stdout.
+ */
+std::unique_ptr<NativeFileStream> openFileStream(const std::string& path, bool writing);
+
+/**
+ * @brief Checks whether a path has the extension of a TLG file.
+*/
+bool isTlgPath(const std::string& path);
+
+/**
+ * @brief Returns the path next to the input with the extension of the other format.
+*/
+std::string defaultOutputPath(const std::string& input);
+
+/**
+ * @brief Base image of delta TLG files.
+ */
+struct DeltaBase {
+    /// Path of the base TLG file. When decoding, empty to look for the name stored in the delta image next to it.
+    std::string path;
+    /// Name stored in delta images. Empty for the file name of path.
+    std::string name;
+};
+
+/**
+ * @brief Decodes a TLG image to PNG. Lines are compressed as they are decoded, so the image is not held whole, except
+ * for delta images, which are put together in memory.
+ * @param in TLG image
+ * @param out Stream to write the PNG image to
+ * @param input Name of the input, used in error messages
+ * @param tagsPath File to write the tags of the image to, if it has any. Empty to drop them.
+ * @param thumbnailOnly Decode the embedded thumbnail instead, or the whole image if there is none. Tags are not read.
+ * @param delta Base of the image if it is a delta image. A stream which cannot seek is taken as a delta image if a path is given.
+ */
+void tlgToPng(tTJSBinaryStream* in, tTJSBinaryStream* out, const std::string& input, const std::string& tagsPath,
+    bool thumbnailOnly = false, const DeltaBase& delta = DeltaBase());
+
+/**
+ * @brief Encodes a PNG image to TLG. Rows are decoded as the encoder asks for them, and decoded again for each of its
+ * passes over the image, unless the image is kept whole (see PngReader and WholePngBytes).
+ * @param in PNG image
+ * @param out Stream to write the TLG image to
+ * @param input Path of the input. Tags are loaded from the .tags file next to it.
+ * @param tlgVersion TLG version, 5 or 6
+ * @param input_tags Tags specified on the command line, which override the ones in the .tags file
+ * @param saveOption Options of the encoder
+ * @param delta If a path is given, the image is saved as a delta image against it.
+ */
+void pngToTlg(tTJSBinaryStream* in, tTJSBinaryStream* out, const std::string& input, int tlgVersion,
+    const std::map<std::string, std::string>& input_tags, const tTVPTLGSaveOption& saveOption,
+    const DeltaBase& delta = DeltaBase());
+
+/**
+ * @brief Runs the parts of a TLG6 image given by the encoder on a TaskPool.
+ */
+void taskPoolParallel(void* callbackdata, tjs_int count, tTVPTLGTaskProc task, void* taskdata);
@@ -0,0 +1,10 @@
+﻿#include "errno_message.h"
+#include "err.h"
+
+std::string errnoMessage(int code) {
+    std::string errmsg;
+    if (!err::get_errno_message(errmsg, code)) {
+        errmsg = "Unknown error";
+    }
+    return errmsg;
+}
@@ -0,0 +1,6 @@
+﻿#include <string>
+
+/**
+ * @brief Returns the message of an errno value, or "Unknown error" if it has none.
+*/
+std::string errnoMessage(int code);
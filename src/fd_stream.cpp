@@ -0,0 +1,263 @@
+﻿#include "fd_stream.h"
+
+#ifndef _WIN32
+#include <stdexcept>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <vector>
+#include "errno_message.h"
+
+static int openFlags(const std::string& mode) {
+    bool plus = mode.find('+') != std::string::npos;
+    int flags = O_CLOEXEC;
+    switch (mode.empty() ? 'r' : mode[0]) {
+    case 'w':
+        flags |= (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+        break;
+    case 'a':
+        flags |= (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND;
+        break;
+    default:
+        flags |= plus ? O_RDWR : O_RDONLY;
+        break;
+    }
+    return flags;
+}
+
+FdStream::FdStream(std::string fileName, std::string mode, size_t bufferSize) {
+    do {
+        fd = ::open(fileName.c_str(), openFlags(mode), 0666);
+    } while (fd == -1 && errno == EINTR);
+    if (fd == -1) {
+        throw std::runtime_error("Failed to open file: " + fileName + ": " + errnoMessage(errno));
+    }
+    owned = true;
+    init(bufferSize);
+}
+
+FdStream::FdStream(int fd, bool owned, size_t bufferSize) {
+    this->fd = fd;
+    this->owned = owned;
+    init(bufferSize);
+}
+
+void FdStream::init(size_t bufferSize) {
+    // pipes and character devices report an error here
+    off_t cur = lseek(fd, 0, SEEK_CUR);
+    seekable = cur != -1;
+    position = seekable ? cur : 0;
+    size = position;
+    struct stat st;
+    if (seekable && fstat(fd, &st) == 0 && (tjs_uint64)st.st_size > size) {
+        size = st.st_size;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (seekable) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    if (bufferSize) {
+        buffer = new unsigned char[bufferSize];
+        bufferCapacity = bufferSize;
+    }
+}
+
+FdStream::~FdStream() {
+    Flush();
+    if (owned) {
+        ::close(fd);
+    } else if (seekable) {
+        // hand the descriptor back at the position the caller expects
+        lseek(fd, position, SEEK_SET);
+    }
+    delete[] buffer;
+}
+
+size_t FdStream::rawRead(void* buf, size_t count, tjs_uint64 offset) {
+    ssize_t re;
+    do {
+        re = seekable ? pread(fd, buf, count, offset) : ::read(fd, buf, count);
+    } while (re == -1 && errno == EINTR);
+    return re > 0 ? re : 0;
+}
+
+bool FdStream::rawWrite(const void* buf, size_t count, tjs_uint64 offset) {
+    const unsigned char* p = static_cast<const unsigned char*>(buf);
+    while (count) {
+        ssize_t re = seekable ? pwrite(fd, p, count, offset) : ::write(fd, p, count);
+        if (re == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += re;
+        offset += re;
+        count -= re;
+    }
+    return true;
+}
+
+bool FdStream::rawWriteV(struct iovec* iov, int count, tjs_uint64 offset) {
+    while (count) {
+        ssize_t re = seekable ? pwritev(fd, iov, count, offset) : ::writev(fd, iov, count);
+        if (re == -1) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        offset += re;
+        // skip the buffers written, and the written part of a partial one
+        while (count && (size_t)re >= iov->iov_len) {
+            re -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count) {
+            iov->iov_base = (char*)iov->iov_base + re;
+            iov->iov_len -= re;
+        }
+    }
+    return true;
+}
+
+bool FdStream::Flush() {
+    if (!dirty) return true;
+    bool ok = rawWrite(buffer, bufferLength, bufferStart);
+    dirty = false;
+    bufferLength = 0;
+    return ok;
+}
+
+tjs_uint64 FdStream::Seek(tjs_int64 offset, tjs_int whence) {
+    tjs_int64 newpos;
+    switch (whence) {
+    case TJS_BS_SEEK_CUR:
+        newpos = position + offset;
+        break;
+    case TJS_BS_SEEK_END: {
+        // another writer may have extended the file
+        struct stat st;
+        if (seekable && fstat(fd, &st) == 0 && (tjs_uint64)st.st_size > size) {
+            size = st.st_size;
+        }
+        newpos = size + offset;
+        break;
+    }
+    default:
+        newpos = offset;
+        break;
+    }
+    if (newpos < 0 || (!seekable && (tjs_uint64)newpos != position)) {
+        throw std::runtime_error("Failed to seek in file stream: " + errnoMessage(newpos < 0 ? EINVAL : ESPIPE));
+    }
+    position = newpos;
+    return position;
+}
+
+tjs_uint FdStream::Read(void* buf, tjs_uint read_size) {
+    if (dirty && !Flush()) return 0;
+    unsigned char* dest = static_cast<unsigned char*>(buf);
+    tjs_uint total = 0;
+    while (total < read_size) {
+        size_t remain = read_size - total;
+        if (position >= bufferStart && position < bufferStart + bufferLength) {
+            size_t offset = position - bufferStart;
+            size_t one = bufferLength - offset;
+            if (one > remain) one = remain;
+            memcpy(dest + total, buffer + offset, one);
+            position += one;
+            total += one;
+            continue;
+        }
+        if (remain >= bufferCapacity) {
+            // large reads bypass the buffer
+            size_t re = rawRead(dest + total, remain, position);
+            if (!re) break;
+            position += re;
+            total += re;
+            continue;
+        }
+        bufferStart = position;
+        bufferLength = rawRead(buffer, bufferCapacity, position);
+        if (!bufferLength) break;
+    }
+    return total;
+}
+
+tjs_uint FdStream::Write(const void* buf, tjs_uint write_size) {
+    if (!dirty) {
+        // drop the read-ahead data, which this write may overwrite
+        bufferLength = 0;
+    } else if (position != bufferStart + bufferLength || bufferLength + write_size > bufferCapacity) {
+        if (!Flush()) return 0;
+    }
+    if (write_size >= bufferCapacity) {
+        if (!rawWrite(buf, write_size, position)) return 0;
+    } else {
+        if (!dirty) {
+            bufferStart = position;
+            dirty = true;
+        }
+        memcpy(buffer + bufferLength, buf, write_size);
+        bufferLength += write_size;
+    }
+    position += write_size;
+    if (position > size) size = position;
+    return write_size;
+}
+
+tjs_uint64 FdStream::WriteV(const tTJSBinaryStreamVec* vecs, tjs_int count) {
+    tjs_uint64 total = 0;
+    for (tjs_int i = 0; i < count; i++) total += vecs[i].size;
+    if (total < bufferCapacity) {
+        // small enough to gather in the buffer
+        return tTJSBinaryStream::WriteV(vecs, count);
+    }
+#ifdef IOV_MAX
+    const int maxCount = IOV_MAX;
+#else
+    const int maxCount = 1024;
+#endif
+    std::vector<struct iovec> iov;
+    iov.reserve(count + 1 < maxCount ? count + 1 : maxCount);
+    tjs_uint64 offset = position;
+    if (!dirty) {
+        // drop the read-ahead data, which this write may overwrite
+        bufferLength = 0;
+    } else if (position == bufferStart + bufferLength) {
+        // pending data goes in front of the buffers in the same call
+        struct iovec v;
+        v.iov_base = buffer;
+        v.iov_len = bufferLength;
+        iov.push_back(v);
+        offset = bufferStart;
+        dirty = false;
+        bufferLength = 0;
+    } else if (!Flush()) {
+        return 0;
+    }
+    for (tjs_int i = 0; i < count; i++) {
+        if (!vecs[i].size) continue;
+        struct iovec v;
+        v.iov_base = const_cast<void*>(vecs[i].buffer);
+        v.iov_len = vecs[i].size;
+        iov.push_back(v);
+        if ((int)iov.size() == maxCount) {
+            size_t bytes = 0;
+            for (auto& e : iov) bytes += e.iov_len;
+            if (!rawWriteV(iov.data(), (int)iov.size(), offset)) return 0;
+            offset += bytes;
+            iov.clear();
+        }
+    }
+    if (!iov.empty() && !rawWriteV(iov.data(), (int)iov.size(), offset)) return 0;
+    position += total;
+    if (position > size) size = position;
+    return total;
+}
+
+bool FdStream::CanSeek() {
+    return seekable;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,66 @@
+﻿#include "stream.h"
+#include <string>
+#include <stddef.h>
+
+struct iovec;
+
+#ifndef _WIN32
+/**
+ * @brief Stream on a POSIX file descriptor.
+ *
+ * The logical position is kept in memory, so Seek never makes a system call.
+ * Data goes through one buffer which works as read-ahead while reading and
+ * as write-behind while writing. Seekable files are accessed with pread/pwrite,
+ * pipes with plain read/write.
+ */
+class FdStream : public tTJSBinaryStream {
+public:
+    static const size_t DefaultBufferSize = 1024 * 1024;
+    /**
+     * @brief Opens a file with the specified file name and mode. If the file cannot be opened, it throws a runtime error.
+     * @param fileName File name
+     * @param mode Mode used by fopen
+     * @param bufferSize Size of the read-ahead/write-behind buffer. 0 disables buffering.
+     */
+    FdStream(std::string fileName, std::string mode, size_t bufferSize = DefaultBufferSize);
+    /**
+     * @brief Wraps an already opened file descriptor. The stream starts at the current offset of the descriptor.
+     * @param fd File descriptor
+     * @param owned Closes the descriptor on destruction if true. Otherwise the offset of the descriptor is moved to the logical position.
+     * @param bufferSize Size of the read-ahead/write-behind buffer. 0 disables buffering.
+     */
+    FdStream(int fd, bool owned = false, size_t bufferSize = DefaultBufferSize);
+    ~FdStream();
+    FdStream(const FdStream&) = delete;
+    FdStream& operator=(const FdStream&) = delete;
+    virtual tjs_uint64 Seek(tjs_int64 offset, tjs_int whence) override;
+    virtual tjs_uint Read(void* buffer, tjs_uint read_size) override;
+    virtual tjs_uint Write(const void* buffer, tjs_uint write_size) override;
+    virtual tjs_uint64 WriteV(const tTJSBinaryStreamVec* vecs, tjs_int count) override;
+    virtual bool CanSeek() override;
+    /**
+     * @brief Writes the pending data to the descriptor.
+     * @return false if an error occurred. The data could not be written is dropped.
+     */
+    bool Flush();
+private:
+    void init(size_t bufferSize);
+    size_t rawRead(void* buffer, size_t size, tjs_uint64 offset);
+    bool rawWrite(const void* buffer, size_t size, tjs_uint64 offset);
+    bool rawWriteV(struct iovec* iov, int count, tjs_uint64 offset);
+    int fd = -1;
+    bool owned = false;
+    bool seekable = true;
+    // logical position
+    tjs_uint64 position = 0;
+    // file size known to this stream, including pending data
+    tjs_uint64 size = 0;
+    // buffer holds [bufferStart, bufferStart + bufferLength) of the file
+    unsigned char* buffer = nullptr;
+    size_t bufferCapacity = 0;
+    tjs_uint64 bufferStart = 0;
+    size_t bufferLength = 0;
+    // true when the buffer holds data not written yet
+    bool dirty = false;
+};
+#endif
\ No newline at end of file
@@ -1,17 +1,26 @@
 ﻿#include "file_stream.h"
 #include "fileop.h"
 #include <stdexcept>
-#include "err.h"
+#include <errno.h>
+#include "errno_message.h"
 
 FileStream::FileStream(std::string fileName, std::string mode) {
     file = fileop::fopen(fileName, mode);
     if (!file) {
         throw std::runtime_error("Failed to open file: " + fileName);
     }
+    // pipes and character devices report an error here
+    seekable = fileop::ftell(file) != -1;
+}
+
+FileStream::FileStream(FILE* file, bool owned) : file(file), owned(owned) {
+    seekable = fileop::ftell(file) != -1;
 }
 
 FileStream::~FileStream() {
-    if (file) {
+    if (!owned) {
+        fflush(file);
+    } else if (file) {
         fclose(file);
         file = nullptr;
     }
@@ -20,19 +29,11 @@ FileStream::~FileStream() {
 tjs_uint64 FileStream::Seek(tjs_int64 offset, tjs_int whence) {
     int re = fileop::fseek(file, offset, whence);
     if (re) {
-        std::string errmsg;
-        if (!err::get_errno_message(errmsg, errno)) {
-            errmsg = "Unknown error";
-        }
-        throw std::runtime_error("Failed to seek in file stream：" + errmsg + "(" + std::to_string(re) + ")");
+        throw std::runtime_error("Failed to seek in file stream：" + errnoMessage(errno) + "(" + std::to_string(re) + ")");
     }
     auto loc = fileop::ftell(file);
     if (loc == -1) {
-        std::string errmsg;
-        if (!err::get_errno_message(errmsg, errno)) {
-            errmsg = "Unknown error";
-        }
-        throw std::runtime_error("Failed to get file position: " + errmsg);
+        throw std::runtime_error("Failed to get file position: " + errnoMessage(errno));
     }
     return loc;
 }
@@ -45,4 +46,12 @@ tjs_uint FileStream::Read(void* buffer, tjs_uint read_size) {
 tjs_uint FileStream::Write(const void* buffer, tjs_uint write_size) {
     auto writed = fwrite(buffer, 1, write_size, file);
     return writed;
+}
+
+bool FileStream::CanSeek() {
+    return seekable;
+}
+
+bool FileStream::Flush() {
+    return fflush(file) == 0;
 }
\ No newline at end of file
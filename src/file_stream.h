@@ -10,10 +10,24 @@ public:
      * @param mode Mode used by fopen
      */
     FileStream(std::string fileName, std::string mode);
+    /**
+     * @brief Creates a stream on an already opened file.
+     * @param file File
+     * @param owned Closes the file on destruction if true.
+     */
+    FileStream(FILE* file, bool owned);
     ~FileStream();
     virtual tjs_uint64 Seek(tjs_int64 offset, tjs_int whence) override;
     virtual tjs_uint Read(void* buffer, tjs_uint read_size) override;
     virtual tjs_uint Write(const void* buffer, tjs_uint write_size) override;
+    virtual bool CanSeek() override;
+    /**
+     * @brief Writes the data buffered by stdio to the file.
+     * @return false if an error occurred.
+     */
+    bool Flush();
 private:
     FILE* file = nullptr;
+    bool owned = true;
+    bool seekable = true;
 };
@@ -0,0 +1,67 @@
+﻿#include "golomb_table.h"
+#include "fileop.h"
+#include <stdint.h>
+
+bool loadGolombTable(std::string path, tTVPTLG6GolombTable& table) {
+    FILE* fp = fileop::fopen(path, "rb");
+    if (!fp) return false;
+    for (int n = 0; n < 4; n++) {
+        for (int k = 0; k < 9; k++) {
+            int count;
+            if (fscanf(fp, "%d", &count) != 1 || count < 0 || count > 1024) {
+                fclose(fp);
+                return false;
+            }
+            table.Counts[n][k] = (short int)count;
+        }
+    }
+    fclose(fp);
+    return true;
+}
+
+bool saveGolombTable(std::string path, const tTVPTLG6GolombTable& table) {
+    FILE* fp = fileop::fopen(path, "wb");
+    if (!fp) return false;
+    for (int n = 0; n < 4; n++) {
+        for (int k = 0; k < 9; k++) {
+            fprintf(fp, k ? " %d" : "%d", table.Counts[n][k]);
+        }
+        fprintf(fp, "\n");
+    }
+    return fclose(fp) == 0;
+}
+
+bool loadGolombStatistics(std::string path, tTVPTLG6GolombStatistics& stats) {
+    FILE* fp = fileop::fopen(path, "rb");
+    if (!fp) return false;
+    const size_t count = sizeof(stats.Bits) / sizeof(tjs_uint64);
+    tjs_uint64* bits = &stats.Bits[0][0][0];
+    for (size_t i = 0; i < count; i++) {
+        uint8_t buf[8];
+        if (fread(buf, 1, 8, fp) != 8) {
+            fclose(fp);
+            return false;
+        }
+        tjs_uint64 v = 0;
+        for (int j = 7; j >= 0; j--) v = (v << 8) | buf[j];
+        bits[i] = v;
+    }
+    fclose(fp);
+    return true;
+}
+
+bool saveGolombStatistics(std::string path, const tTVPTLG6GolombStatistics& stats) {
+    FILE* fp = fileop::fopen(path, "wb");
+    if (!fp) return false;
+    const size_t count = sizeof(stats.Bits) / sizeof(tjs_uint64);
+    const tjs_uint64* bits = &stats.Bits[0][0][0];
+    for (size_t i = 0; i < count; i++) {
+        uint8_t buf[8];
+        for (int j = 0; j < 8; j++) buf[j] = (uint8_t)(bits[i] >> (j * 8));
+        if (fwrite(buf, 1, 8, fp) != 8) {
+            fclose(fp);
+            return false;
+        }
+    }
+    return fclose(fp) == 0;
+}
\ No newline at end of file
@@ -0,0 +1,10 @@
+﻿#include <string>
+#include "TLG.h"
+
+// Text file of a TLG6 golomb bit length table: 4 lines of 9 counts.
+bool loadGolombTable(std::string path, tTVPTLG6GolombTable& table);
+bool saveGolombTable(std::string path, const tTVPTLG6GolombTable& table);
+
+// Binary file of statistics to train a golomb table over many images.
+bool loadGolombStatistics(std::string path, tTVPTLG6GolombStatistics& stats);
+bool saveGolombStatistics(std::string path, const tTVPTLG6GolombStatistics& stats);
\ No newline at end of file
@@ -0,0 +1,192 @@
+﻿#include "info_command.h"
+#include "TLG.h"
+#include <string.h>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "cli_util.h"
+#include "convert.h"
+
+static std::string chunkName(const tTVPTLGChunkInfo& chunk) {
+    std::string name(chunk.name, 4);
+    for (auto& c : name) {
+        if ((unsigned char)c < 0x20 || (unsigned char)c >= 0x7f) c = '?';
+    }
+    return name;
+}
+
+static std::string formatInfoJson(const std::string& path, const tTVPTLGInfo& info,
+    const std::vector<tTVPTLGAtlasEntry>& atlas) {
+    std::string out = "{\"path\":";
+    appendJsonString(out, path);
+    out += ",\"version\":" + std::to_string(info.version);
+    out += ",\"colors\":" + std::to_string(info.colors);
+    out += ",\"width\":" + std::to_string(info.width);
+    out += ",\"height\":" + std::to_string(info.height);
+    if (info.version == 5) {
+        out += ",\"block_height\":" + std::to_string(info.block_height);
+    } else {
+        out += ",\"max_bit_length\":" + std::to_string(info.max_bit_length);
+        out += std::string(",\"external_golomb_table\":") + (info.external_golomb_table ? "true" : "false");
+    }
+    out += std::string(",\"sds\":") + (info.sds ? "true" : "false");
+    if (info.sds) {
+        out += ",\"raw_size\":" + std::to_string(info.raw_size);
+    }
+    out += ",\"chunks\":[";
+    for (size_t i = 0; i < info.chunks.size(); i++) {
+        if (i) out += ',';
+        out += "{\"name\":";
+        appendJsonString(out, chunkName(info.chunks[i]));
+        out += ",\"offset\":" + std::to_string(info.chunks[i].offset);
+        out += ",\"size\":" + std::to_string(info.chunks[i].size) + "}";
+    }
+    out += "],\"tags\":{";
+    bool first = true;
+    for (const auto& tag : info.tags) {
+        if (!first) out += ',';
+        first = false;
+        appendJsonString(out, tag.first);
+        out += ':';
+        appendJsonString(out, tag.second);
+    }
+    out += "}";
+    if (!atlas.empty()) {
+        out += ",\"atlas\":[";
+        for (size_t i = 0; i < atlas.size(); i++) {
+            const auto& r = atlas[i].rect;
+            out += i ? ",{\"name\":" : "{\"name\":";
+            appendJsonString(out, atlas[i].name);
+            out += ",\"left\":" + std::to_string(r.left) + ",\"top\":" + std::to_string(r.top);
+            out += ",\"width\":" + std::to_string(r.width) + ",\"height\":" + std::to_string(r.height) + "}";
+        }
+        out += "]";
+    }
+    out += "}";
+    return out;
+}
+
+static void printInfoText(const std::string& path, const tTVPTLGInfo& info, const std::vector<tTVPTLGAtlasEntry>& atlas) {
+    printf("%s: TLG%d %ux%u, %d colors", path.c_str(), info.version, info.width, info.height, info.colors);
+    if (info.version == 5) {
+        printf(", block height %u", info.block_height);
+    } else {
+        printf(", max bit length %u%s", info.max_bit_length, info.external_golomb_table ? ", external golomb table" : "");
+    }
+    printf("\n");
+    if (info.sds) {
+        printf("  raw data: %u bytes\n", info.raw_size);
+    }
+    for (const auto& chunk : info.chunks) {
+        printf("  chunk %s: %u bytes at %llu\n", chunkName(chunk).c_str(), chunk.size, (unsigned long long)chunk.offset);
+    }
+    for (const auto& tag : info.tags) {
+        printf("  tag %s=%s\n", tag.first.c_str(), tag.second.c_str());
+    }
+    for (const auto& entry : atlas) {
+        printf("  image %s: %ux%u at %u,%u\n", entry.name.c_str(), entry.rect.width, entry.rect.height, entry.rect.left,
+            entry.rect.top);
+    }
+}
+
+static void printInfoHelp() {
+    printf("Usage: tlg info [options] <input>...\n");
+    printf("Print the size, format, chunks, tags and atlas placements of TLG files without decoding them.\n");
+    printf("Options:\n");
+    printf("  -h, --help        Show this help message\n");
+    printf("  -j, --json        Print a JSON array with an object per file\n");
+    printf("  -b, --batch <list>\n");
+    printf("                    Also print the files listed in <list>, one per line.\n");
+}
+
+int runInfo(int argc, char* argv[]) {
+    bool json = false;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            printInfoHelp();
+            return 0;
+        } else if (arg == "-j" || arg == "--json") {
+            json = true;
+        } else if (arg == "-b" || arg == "--batch") {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "%s needs a list file.\n", arg.c_str());
+                return 1;
+            }
+            try {
+                auto lines = readListFile(argv[++i]);
+                inputs.insert(inputs.end(), lines.begin(), lines.end());
+            } catch (const std::exception& e) {
+                fprintf(stderr, "Error: %s\n", e.what());
+                return 1;
+            }
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+            printInfoHelp();
+            return 1;
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (inputs.empty()) {
+        fprintf(stderr, "Input file is required.\n");
+        printInfoHelp();
+        return 1;
+    }
+    int result = 0;
+    if (json) printf("[");
+    for (size_t i = 0; i < inputs.size(); i++) {
+        const auto& path = inputs[i];
+        tTVPTLGInfo info;
+        std::vector<tTVPTLGAtlasEntry> atlas;
+        std::string error;
+        try {
+            std::unique_ptr<tTJSBinaryStream> in;
+            if (path == "-") {
+                in = openFileStream(path, false);
+            } else {
+#ifdef _WIN32
+                in.reset(new FileStream(path, "rb"));
+#else
+                // only the headers and the chunks are read
+                in.reset(new FdStream(path, "rb", 4096));
+#endif
+            }
+            if (TVPProbeTLG(in.get(), &info) != TLG_SUCCESS) {
+                error = "Not a valid TLG file";
+            } else if (in->CanSeek()) {
+                // the placements of an atlas are read again from its chunk
+                for (const auto& chunk : info.chunks) {
+                    if (!memcmp(chunk.name, "atls", 4) && TVPProbeTLGAtlas(in.get(), &atlas) != TLG_SUCCESS) {
+                        error = "Malformed atlas chunk";
+                    }
+                }
+            }
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+        if (!error.empty()) {
+            result = 1;
+        }
+        if (json) {
+            std::string out = i ? ",\n" : "\n";
+            if (error.empty()) {
+                out += formatInfoJson(path, info, atlas);
+            } else {
+                out += "{\"path\":";
+                appendJsonString(out, path);
+                out += ",\"error\":";
+                appendJsonString(out, error);
+                out += "}";
+            }
+            fwrite(out.data(), 1, out.size(), stdout);
+        } else if (error.empty()) {
+            printInfoText(path, info, atlas);
+        } else {
+            fprintf(stderr, "Error: %s: %s\n", path.c_str(), error.c_str());
+        }
+    }
+    if (json) printf("\n]\n");
+    return result;
+}
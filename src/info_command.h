@@ -0,0 +1,6 @@
+﻿/**
+ * @brief Runs the info subcommand.
+ * @param argc Count of arguments, including "info"
+ * @return Exit code
+ */
+int runInfo(int argc, char* argv[]);
@@ -0,0 +1,374 @@
+﻿#include "io_engine.h"
+#include "fileop.h"
+#include <errno.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <map>
+#endif
+
+static bool readWholeFile(IoRequest& req) {
+    FILE* fp = fileop::fopen(req.path, "rb");
+    if (!fp) return false;
+    bool ok = fileop::fseek(fp, 0, SEEK_END) == 0;
+    int64_t size = ok ? fileop::ftell(fp) : -1;
+    ok = size >= 0 && fileop::fseek(fp, 0, SEEK_SET) == 0;
+    if (ok) {
+        req.data.resize(size);
+        ok = fread(req.data.data(), 1, req.data.size(), fp) == req.data.size();
+    }
+    int code = errno;
+    fclose(fp);
+    errno = code;
+    return ok;
+}
+
+static bool writeWholeFile(IoRequest& req) {
+    FILE* fp = fileop::fopen(req.path, "wb");
+    if (!fp) return false;
+    bool ok = fwrite(req.data.data(), 1, req.data.size(), fp) == req.data.size();
+    ok = fclose(fp) == 0 && ok;
+    return ok;
+}
+
+/**
+ * @brief Engine which runs blocking reads and writes on worker threads.
+*/
+class ThreadIoEngine : public IoEngine {
+public:
+    ThreadIoEngine(unsigned depth) {
+        // requests beyond the workers wait in the queue
+        unsigned limit = std::max(std::thread::hardware_concurrency(), 1u) * 2;
+        unsigned count = std::min(depth, limit);
+        for (unsigned i = 0; i < count; i++) {
+            workers.emplace_back([this] { work(); });
+        }
+    }
+    ~ThreadIoEngine() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queued.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+    virtual void submit(std::unique_ptr<IoRequest> req) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending.push_back(std::move(req));
+            outstanding++;
+        }
+        queued.notify_one();
+    }
+    virtual std::unique_ptr<IoRequest> wait() override {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!outstanding) return nullptr;
+        finished.wait(lock, [this] { return !done.empty(); });
+        auto req = std::move(done.front());
+        done.pop_front();
+        outstanding--;
+        return req;
+    }
+    virtual const char* name() const override {
+        return "threads";
+    }
+private:
+    void work() {
+        while (true) {
+            std::unique_ptr<IoRequest> req;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                queued.wait(lock, [this] { return stopping || !pending.empty(); });
+                if (pending.empty()) return;
+                req = std::move(pending.front());
+                pending.pop_front();
+            }
+            bool ok = req->type == IoRequest::Read ? readWholeFile(*req) : writeWholeFile(*req);
+            req->error = ok ? 0 : (errno ? errno : EIO);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.push_back(std::move(req));
+            }
+            finished.notify_one();
+        }
+    }
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable queued;
+    std::condition_variable finished;
+    std::deque<std::unique_ptr<IoRequest>> pending;
+    std::deque<std::unique_ptr<IoRequest>> done;
+    size_t outstanding = 0;
+    bool stopping = false;
+};
+
+#ifdef __linux__
+/**
+ * @brief Engine on io_uring, driven with raw system calls.
+ *
+ * Files are opened synchronously; reads and writes of their contents are put
+ * to the submission ring and submitted together when the caller waits.
+*/
+class UringIoEngine : public IoEngine {
+public:
+    ~UringIoEngine() {
+        // finish what the kernel still references before unmapping the rings
+        while (inflight.size()) reap(true);
+        for (auto& op : queue) ::close(op->fd);
+        if (sqes) munmap(sqes, sqesSize);
+        if (cqRing && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing) munmap(sqRing, sqRingSize);
+        if (ring != -1) ::close(ring);
+    }
+    static std::unique_ptr<UringIoEngine> create(unsigned depth) {
+        std::unique_ptr<UringIoEngine> engine(new UringIoEngine());
+        if (!engine->setup(depth)) return nullptr;
+        return engine;
+    }
+    virtual void submit(std::unique_ptr<IoRequest> req) override {
+        std::unique_ptr<Op> op(new Op());
+        op->req = std::move(req);
+        IoRequest& r = *op->req;
+        bool reading = r.type == IoRequest::Read;
+        do {
+            op->fd = ::open(r.path.c_str(), reading ? O_RDONLY | O_CLOEXEC : O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        } while (op->fd == -1 && errno == EINTR);
+        if (op->fd == -1) {
+            r.error = errno;
+            done.push_back(std::move(op->req));
+            return;
+        }
+        if (reading) {
+            struct stat st;
+            if (fstat(op->fd, &st)) {
+                r.error = errno;
+                ::close(op->fd);
+                done.push_back(std::move(op->req));
+                return;
+            }
+            r.data.resize(st.st_size);
+        }
+        queue.push_back(std::move(op));
+    }
+    virtual std::unique_ptr<IoRequest> wait() override {
+        while (done.empty()) {
+            if (queue.empty() && inflight.empty()) return nullptr;
+            fill();
+            reap(true);
+        }
+        auto req = std::move(done.front());
+        done.pop_front();
+        return req;
+    }
+    virtual const char* name() const override {
+        return "io_uring";
+    }
+private:
+    struct Op {
+        std::unique_ptr<IoRequest> req;
+        int fd = -1;
+        // bytes already transferred
+        size_t offset = 0;
+    };
+
+    UringIoEngine() {}
+
+    bool setup(unsigned depth) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ring = (int)syscall(__NR_io_uring_setup, depth, &params);
+        if (ring == -1 || !supportsReadWrite()) return false;
+        entries = params.sq_entries;
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            if (cqRingSize > sqRingSize) sqRingSize = cqRingSize;
+            cqRingSize = sqRingSize;
+        }
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) {
+            sqRing = nullptr;
+            return false;
+        }
+        if (single) {
+            cqRing = sqRing;
+        } else {
+            cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+            if (cqRing == MAP_FAILED) {
+                cqRing = nullptr;
+                return false;
+            }
+        }
+        sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        void* p = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+        if (p == MAP_FAILED) return false;
+        sqes = (struct io_uring_sqe*)p;
+        char* sq = (char*)sqRing;
+        char* cq = (char*)cqRing;
+        sqTail = (unsigned*)(sq + params.sq_off.tail);
+        sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+        sqArray = (unsigned*)(sq + params.sq_off.array);
+        cqHead = (unsigned*)(cq + params.cq_off.head);
+        cqTail = (unsigned*)(cq + params.cq_off.tail);
+        cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    bool supportsReadWrite() {
+        // IORING_OP_READ and IORING_OP_WRITE came with Linux 5.6, as did the
+        // probe; on 5.1 to 5.5 the ring sets up but every request fails
+        std::vector<uint64_t> buf((sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op) + 7) / 8);
+        struct io_uring_probe* probe = (struct io_uring_probe*)buf.data();
+        if (syscall(__NR_io_uring_register, ring, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) < 0) return false;
+        for (int opcode : { IORING_OP_READ, IORING_OP_WRITE }) {
+            if (opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)) return false;
+        }
+        return true;
+    }
+
+    void prepare(Op* op) {
+        // the tail is only written by this thread
+        unsigned tail = *sqTail;
+        unsigned index = tail & sqMask;
+        struct io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        IoRequest& r = *op->req;
+        size_t remain = r.data.size() - op->offset;
+        // a single transfer is limited to INT_MAX bytes rounded down to a page
+        if (remain > 0x7ffff000) remain = 0x7ffff000;
+        sqe->opcode = r.type == IoRequest::Read ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->fd = op->fd;
+        sqe->off = op->offset;
+        sqe->addr = (uint64_t)(uintptr_t)(r.data.data() + op->offset);
+        sqe->len = (unsigned)remain;
+        sqe->user_data = (uint64_t)(uintptr_t)op;
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        toSubmit++;
+    }
+
+    void fill() {
+        // move queued operations to the ring while there is room in it
+        while (!queue.empty() && inflight.size() < entries) {
+            std::unique_ptr<Op> op = std::move(queue.front());
+            queue.pop_front();
+            if (op->req->data.empty()) {
+                finish(std::move(op), 0);
+                continue;
+            }
+            Op* raw = op.get();
+            inflight[raw] = std::move(op);
+            prepare(raw);
+        }
+    }
+
+    void finish(std::unique_ptr<Op> op, int error) {
+        int re = ::close(op->fd);
+        if (!error && re && op->req->type == IoRequest::Write) error = errno;
+        op->req->error = error;
+        done.push_back(std::move(op->req));
+    }
+
+    void reap(bool block) {
+        unsigned head = *cqHead;
+        bool empty = head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        bool sleep = block && empty && inflight.size();
+        if (toSubmit || sleep) {
+            // pending entries are submitted even when completions are ready,
+            // so that the device works while the caller processes them
+            unsigned flags = sleep ? IORING_ENTER_GETEVENTS : 0;
+            int re = (int)syscall(__NR_io_uring_enter, ring, toSubmit, sleep ? 1 : 0, flags, nullptr, 0);
+            if (re >= 0) {
+                toSubmit -= re;
+            } else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                failAll(errno);
+                return;
+            }
+        }
+        unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe* cqe = &cqes[head & cqMask];
+            Op* raw = (Op*)(uintptr_t)cqe->user_data;
+            int res = cqe->res;
+            auto it = inflight.find(raw);
+            std::unique_ptr<Op> op = std::move(it->second);
+            inflight.erase(it);
+            if (res == -EINTR || res == -EAGAIN) {
+                queue.push_front(std::move(op));
+            } else if (res < 0) {
+                finish(std::move(op), -res);
+            } else if (res == 0 && op->offset < op->req->data.size()) {
+                // the file was shorter than its size when opened
+                if (op->req->type == IoRequest::Read) op->req->data.resize(op->offset);
+                finish(std::move(op), op->req->type == IoRequest::Read ? 0 : EIO);
+            } else {
+                op->offset += res;
+                if (op->offset < op->req->data.size()) {
+                    // short transfer; continue with the rest
+                    queue.push_front(std::move(op));
+                } else {
+                    finish(std::move(op), 0);
+                }
+            }
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+
+    void failAll(int error) {
+        // the ring is unusable; nothing in it will complete
+        for (auto& entry : inflight) finish(std::move(entry.second), error);
+        inflight.clear();
+        while (!queue.empty()) {
+            finish(std::move(queue.front()), error);
+            queue.pop_front();
+        }
+        toSubmit = 0;
+    }
+
+    int ring = -1;
+    unsigned entries = 0;
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    struct io_uring_sqe* sqes = nullptr;
+    size_t sqesSize = 0;
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    struct io_uring_cqe* cqes = nullptr;
+    unsigned toSubmit = 0;
+    // opened, waiting for a slot in the ring
+    std::deque<std::unique_ptr<Op>> queue;
+    std::map<Op*, std::unique_ptr<Op>> inflight;
+    std::deque<std::unique_ptr<IoRequest>> done;
+};
+#endif
+
+std::unique_ptr<IoEngine> IoEngine::create(Kind kind, unsigned depth) {
+    if (!depth) depth = 1;
+#ifdef __linux__
+    if (kind != Threads) {
+        auto engine = UringIoEngine::create(depth);
+        if (engine) return engine;
+    }
+#endif
+    if (kind == Uring) return nullptr;
+    return std::unique_ptr<IoEngine>(new ThreadIoEngine(depth));
+}
\ No newline at end of file
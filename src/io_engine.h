@@ -0,0 +1,58 @@
+﻿#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A whole-file read or write handled by an IoEngine.
+*/
+struct IoRequest {
+    enum Type {
+        Read,
+        Write,
+    };
+    Type type = Read;
+    std::string path;
+    /// Contents read from the file, or contents to write to the file.
+    std::vector<uint8_t> data;
+    /// errno of the failed operation. 0 on success.
+    int error = 0;
+    /// Free for the caller to identify the request.
+    size_t id = 0;
+};
+
+/**
+ * @brief Performs whole-file reads and writes in the background.
+ *
+ * Requests are queued by submit() and may be processed in any order and in
+ * batches. Finished requests are handed back by wait().
+*/
+class IoEngine {
+public:
+    enum Kind {
+        Auto,
+        Uring,
+        Threads,
+    };
+    virtual ~IoEngine() {}
+    /**
+     * @brief Queues a request.
+     * @param req Request. The engine owns it until it is returned by wait().
+     */
+    virtual void submit(std::unique_ptr<IoRequest> req) = 0;
+    /**
+     * @brief Waits for a request to finish.
+     * @return The finished request, or nullptr if no request is queued.
+     */
+    virtual std::unique_ptr<IoRequest> wait() = 0;
+    virtual const char* name() const = 0;
+    /**
+     * @brief Creates an engine.
+     * @param kind Auto uses io_uring when the kernel supports its read and write operations (Linux 5.6) and a thread
+     * pool otherwise.
+     * @param depth Maximum count of requests processed at the same time. The thread pool runs at most twice as many
+     * threads as the hardware has; further requests wait in its queue.
+     * @return nullptr if the requested kind is not available.
+     */
+    static std::unique_ptr<IoEngine> create(Kind kind, unsigned depth);
+};
\ No newline at end of file
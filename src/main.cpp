@@ -1,154 +1,84 @@
 ﻿#include "TLG.h"
-#include "png.h"
 #include "getopt.h"
 #include "wchar_util.h"
 #include <stdint.h>
-#include "file_stream.h"
 #include "fileop.h"
 #include "str_util.h"
 #include <stdexcept>
+#include <memory>
 #include "dict_file.h"
+#include "golomb_table.h"
+#include "buffer_stream.h"
+#include "stats_stream.h"
+#include "task_pool.h"
+#include "memory_scheduler.h"
+#include "convert.h"
+#include "atlas_command.h"
+#include "batch.h"
+#include "info_command.h"
+#include "pack_command.h"
+#include "tags_command.h"
 
-typedef struct TlgPic {
-    uint32_t width;
-    uint32_t height;
-    uint32_t colors;
-    uint8_t* data; // Pointer to the image data
-} TlgPic;
+#ifndef _WIN32
+#include "shm_image.h"
 
-bool tlg_pic_size_callback(void* callbackdata, tjs_uint w, tjs_uint h) {
-    TlgPic* pic = static_cast<TlgPic*>(callbackdata);
-    pic->width = w;
-    pic->height = h;
-    pic->colors = 4; // Assuming BGRA format
-    pic->data = new uint8_t[w * h * 4]; // Assuming 4 bytes per pixel (BGRA)
-    return true; // Continue processing
-}
-
-void* tlg_pic_buf_callback(void* callbackdata, tjs_int y) {
-    TlgPic* pic = static_cast<TlgPic*>(callbackdata);
-    if (y < 0) {
-        // If y is -1, return nullptr to indicate that the image has been fully processed
-        return nullptr;
-    }
-    // Return a pointer to the scanline buffer for the specified y coordinate
-    return pic->data + (y * pic->width * pic->colors);
-}
-
-void destory_tlg_pic(TlgPic& pic) {
-    if (pic.data) {
-        delete[] pic.data;
-        pic.data = nullptr;
-    }
-    pic.width = 0;
-    pic.height = 0;
-    pic.colors = 0;
-}
+struct ShmDecodeTarget {
+    ShmImage* image;
+    std::string error;
+};
 
-void convertBgrToRgb(TlgPic& pic) {
-    if (pic.colors != 3 && pic.colors != 4) return;
-    for (uint32_t y = 0; y < pic.height; ++y) {
-        size_t lineOffset = y * pic.width * pic.colors;
-        for (uint32_t x = 0; x < pic.width; ++x) {
-            uint8_t* pixel = pic.data + lineOffset + (x * pic.colors);
-            std::swap(pixel[0], pixel[2]); // Swap B and R channels
-        }
+static bool shm_size_callback(void* callbackdata, tjs_uint w, tjs_uint h) {
+    ShmDecodeTarget* target = static_cast<ShmDecodeTarget*>(callbackdata);
+    try {
+        target->image->allocate(w, h);
+    } catch (const std::exception& e) {
+        target->error = e.what();
+        return false;
     }
+    return true;
 }
 
-void savePng(const TlgPic& pic, const std::string& output) {
-    FILE* fp = fileop::fopen(output.c_str(), "wb");
-    if (!fp) {
-        throw std::runtime_error("Failed to open output file: " + output);
-    }
-    png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-    if (!png_ptr) {
-        fclose(fp);
-        throw std::runtime_error("Failed to create PNG write struct");
-    }
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if (!info_ptr) {
-        png_destroy_write_struct(&png_ptr, nullptr);
-        fclose(fp);
-        throw std::runtime_error("Failed to create PNG info struct");
-    }
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        png_destroy_write_struct(&png_ptr, &info_ptr);
-        fclose(fp);
-        throw std::runtime_error("Error during PNG creation");
-    }
-    png_init_io(png_ptr, fp);
-    png_set_IHDR(png_ptr, info_ptr, pic.width, pic.height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
-        PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-    png_write_info(png_ptr, info_ptr);
-
-    for (uint32_t y = 0; y < pic.height; ++y) {
-        uint8_t* row = pic.data + (y * pic.width * pic.colors);
-        png_write_row(png_ptr, row);
+static void* shm_buf_callback(void* callbackdata, tjs_int y) {
+    ShmDecodeTarget* target = static_cast<ShmDecodeTarget*>(callbackdata);
+    if (y < 0) {
+        return nullptr;
     }
-
-    png_write_end(png_ptr, nullptr);
-    png_destroy_write_struct(&png_ptr, &info_ptr);
-    fclose(fp);
+    return target->image->line(y);
 }
 
-TlgPic loadPng(std::string input) {
-    TlgPic pic;
-    memset(&pic, 0, sizeof(TlgPic));
-    FILE* fp = fileop::fopen(input.c_str(), "rb");
-    if (!fp) {
-        throw std::runtime_error("Failed to open PNG file: " + input);
-    }
-    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-    if (!png_ptr) {
-        fclose(fp);
-        throw std::runtime_error("Failed to create PNG read struct");
+/**
+ * @brief Decodes a TLG image into shared memory, without encoding it to another format.
+ * @param in TLG image
+ * @param image Destination
+ * @param input Name of the input, used in error messages
+ * @param format Pixel format of the destination
+ */
+void tlgToShm(tTJSBinaryStream* in, ShmImage* image, const std::string& input, ShmImage::Format format) {
+    if (in->CanSeek() && !TVPCheckTLG(in)) {
+        throw std::runtime_error("Not a valid TLG file: " + input);
     }
-    png_infop info_ptr = png_create_info_struct(png_ptr);
-    if (!info_ptr) {
-        png_destroy_read_struct(&png_ptr, nullptr, nullptr);
-        fclose(fp);
-        throw std::runtime_error("Failed to create PNG info struct");
+    ShmDecodeTarget target = { image };
+    std::map<std::string, std::string> tags;
+    auto re = TVPLoadTLG(&target, shm_size_callback, shm_buf_callback, &tags, in);
+    if (!target.error.empty()) {
+        throw std::runtime_error(target.error);
     }
-    if (setjmp(png_jmpbuf(png_ptr))) {
-        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-        fclose(fp);
-        throw std::runtime_error("Error during PNG reading");
+    if (re != TLG_SUCCESS) {
+        throw std::runtime_error("Failed to load TLG file: " + input);
     }
-    png_init_io(png_ptr, fp);
-    png_read_info(png_ptr, info_ptr);
-    pic.width = png_get_image_width(png_ptr, info_ptr);
-    pic.height = png_get_image_height(png_ptr, info_ptr);
-    if (png_get_bit_depth(png_ptr, info_ptr) != 8) {
-        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-        fclose(fp);
-        throw std::runtime_error("Unsupported PNG bit depth. Only 8-bit PNGs are supported.");
-    }
-    int type = png_get_color_type(png_ptr, info_ptr);
-    if (type == PNG_COLOR_TYPE_GRAY) {
-        pic.colors = 1; // Grayscale
-    } else if (type == PNG_COLOR_TYPE_RGB) {
-        pic.colors = 3; // RGB
-    } else if (type == PNG_COLOR_TYPE_RGBA) {
-        pic.colors = 4; // RGBA
-    } else {
-        png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-        fclose(fp);
-        throw std::runtime_error("Unsupported PNG color type. Only grayscale, RGB, and RGBA are supported.");
-    }
-    pic.data = new uint8_t[pic.width * pic.height * pic.colors];
-    for (uint32_t y = 0; y < pic.height; ++y) {
-        uint8_t* row = pic.data + (y * pic.width * pic.colors);
-        png_read_row(png_ptr, row, nullptr);
-    }
-    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
-    fclose(fp);
-    convertBgrToRgb(pic);
-    return pic;
+    image->finish(format, tags);
 }
+#endif
 
 void printHelp() {
     printf("Usage: tlg [options] <input> [<output>]\n");
+    printf("       tlg [options] -b <list>\n");
+    printf("       tlg info [--json] <input>...\n");
+    printf("       tlg tags [options] <input>...\n");
+    printf("       tlg pack build|list|extract [options] ...\n");
+    printf("       tlg atlas [options] -o <output> <input>...\n");
+    printf("<input> and <output> can be - to read from stdin or write to stdout. The format of stdin is detected\n");
+    printf("from its content, and the output defaults to stdout then.\n");
     printf("Tools to processing TLG files.\n");
     printf("Options:\n");
     printf("  -h, --help        Show this help message\n");
@@ -157,6 +87,77 @@ void printHelp() {
     printf("                    Specify tags for the input file. Can be used multiple times.\n");
     printf("  -p, --tag-path <path>\n");
     printf("                    Specify a file path to load tags from. The file should contain key=value pairs.\n");
+    printf("  -d, --direct      Write TLG6 row groups directly to the output file instead of buffering\n");
+    printf("                    the whole compressed image in memory.\n");
+    printf("  -e, --entropy <mode>\n");
+    printf("                    TLG6 entropy coding of each row group. Default: golomb. Available values:\n");
+    printf("                    golomb (readable by any TLG6 decoder), smallest, fast (favour fast decoding).\n");
+    printf("                    Values other than golomb need a decoder which supports LZSS/raw row groups.\n");
+    printf("  -g, --golomb-table <path|auto>\n");
+    printf("                    Encode TLG6 with a golomb bit length table stored in the file. auto trains the\n");
+    printf("                    table from the input image; otherwise the table is loaded from a text file.\n");
+    printf("  -a, --analyze     Save with the least color count the image needs: drop an alpha channel\n");
+    printf("                    which is fully opaque, and save gray images as 8bit gray (TLG6 only).\n");
+    printf("  -n, --normalize-transparent\n");
+    printf("                    Replace the color of fully transparent pixels with a predicted value so that\n");
+    printf("                    it compresses better. The original color under such pixels is lost.\n");
+    printf("  -b, --batch <list|dir>\n");
+    printf("                    Convert every file listed in <list>, one per line, or every PNG and TLG file\n");
+    printf("                    under <dir>. An output path can follow the input path after a tab. dir/*.png is\n");
+    printf("                    the same as dir with --match *.png. Can be used multiple times. Reads and writes\n");
+    printf("                    overlap with the conversion, and a summary is printed at the end.\n");
+    printf("      --match <pattern>\n");
+    printf("                    Convert only the files of a --batch directory whose name matches <pattern>,\n");
+    printf("                    where * is any characters and ? one character.\n");
+    printf("      --output-dir <dir>\n");
+    printf("                    Write the outputs of --batch into <dir>, at their path relative to the --batch\n");
+    printf("                    directory (or the relative path in the list), instead of next to the inputs.\n");
+    printf("  -j, --jobs <n>    Count of threads to convert with. Default: 0, the count of hardware threads.\n");
+    printf("                    Idle threads take whole files of --batch and bands of TLG6 images. Bands need\n");
+    printf("                    the whole image in memory; PNG images over 64 MiB of pixels are instead read\n");
+    printf("                    row by row and encoded on one thread.\n");
+    printf("      --memory-budget <size>\n");
+    printf("                    Start --batch conversions only while the sum of their peak memory, estimated from\n");
+    printf("                    the image headers, fits in <size> (such as 512M or 8G). Smaller files fill the\n");
+    printf("                    memory left; a file larger than the budget runs alone. The estimates and the\n");
+    printf("                    memory actually used are printed at the end.\n");
+    printf("      --io-engine <engine>\n");
+    printf("                    I/O engine used by --batch. Default: auto. Available values: auto, uring\n");
+    printf("                    (io_uring, Linux only), threads.\n");
+    printf("      --io-depth <n>\n");
+    printf("                    Count of files --batch reads ahead. Default: 32, at least --jobs.\n");
+#ifndef _WIN32
+    printf("      --shm <name>\n");
+    printf("                    Decode the TLG image into a new POSIX shared memory object instead of a PNG\n");
+    printf("                    file, and print the object name. The object holds a header, the raw pixels\n");
+    printf("                    and the tags. See ShmImageHeader in shm_image.h for the layout.\n");
+    printf("      --shm-fd <fd> Like --shm, but write into an inherited descriptor, such as a memfd created by\n");
+    printf("                    the calling process.\n");
+    printf("      --raw-format <format>\n");
+    printf("                    Pixel format used by --shm and --shm-fd. Default: bgra. Available values:\n");
+    printf("                    bgra (as decoded, no conversion), rgba.\n");
+#endif
+    printf("      --trim        Encode only the box around the pixels which are not fully transparent, and add\n");
+    printf("                    its offset to the LEFT and TOP tags. Images without alpha are not trimmed.\n");
+    printf("      --trim-size-tags\n");
+    printf("                    --trim, and write the size before trimming to ORIGINAL_WIDTH and ORIGINAL_HEIGHT\n");
+    printf("                    tags unless they are given.\n");
+    printf("      --thumbnail <size>\n");
+    printf("                    Store a preview which fits in <size>x<size> pixels in the TLG file when encoding.\n");
+    printf("      --extract-thumbnail\n");
+    printf("                    Decode the preview stored by --thumbnail instead of the image. Images without a\n");
+    printf("                    preview are decoded as a whole.\n");
+    printf("      --delta-base <path>\n");
+    printf("                    Encode: store only the rectangles which differ from the TLG image at <path>,\n");
+    printf("                    with the name of the base. Decode: the base of delta images. Default: the stored\n");
+    printf("                    name, next to the delta image.\n");
+    printf("      --delta-name <name>\n");
+    printf("                    Name of the base stored by --delta-base. Default: the file name of the base.\n");
+    printf("      --io-stats    Print counts, sizes and time of the reads, writes and seeks done on the input\n");
+    printf("                    and the output to stderr. With --batch, the accesses to the files in memory.\n");
+    printf("      --golomb-train <path>\n");
+    printf("                    Add statistics of the input image to <path>.stats and write the golomb table\n");
+    printf("                    trained from all images added so far to <path>, for use with --golomb-table.\n");
 }
 
 int main(int argc, char* argv[]) {
@@ -168,20 +169,79 @@ int main(int argc, char* argv[]) {
         argc = wargc;
         argv = wargv;
     }
+    if (argc > 1 && !strcmp(argv[1], "info")) {
+        int result = runInfo(argc - 1, argv + 1);
+        if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+        return result;
+    }
+    if (argc > 1 && !strcmp(argv[1], "tags")) {
+        int result = runTags(argc - 1, argv + 1);
+        if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+        return result;
+    }
+    if (argc > 1 && !strcmp(argv[1], "atlas")) {
+        int result = runAtlas(argc - 1, argv + 1);
+        if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+        return result;
+    }
+    if (argc > 1 && !strcmp(argv[1], "pack")) {
+        int result = runPack(argc - 1, argv + 1);
+        if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+        return result;
+    }
     struct option options[] = {
         {"help", 0, nullptr, 'h'},
         {"version", 1, nullptr, 'v'},
         {"tags", 1, nullptr, 't'},
         {"tag-path", 1, nullptr, 'p'},
+        {"direct", 0, nullptr, 'd'},
+        {"entropy", 1, nullptr, 'e'},
+        {"golomb-table", 1, nullptr, 'g'},
+        {"analyze", 0, nullptr, 'a'},
+        {"normalize-transparent", 0, nullptr, 'n'},
+        {"batch", 1, nullptr, 'b'},
+        {"golomb-train", 1, nullptr, 256},
+        {"io-engine", 1, nullptr, 257},
+        {"io-depth", 1, nullptr, 258},
+        {"shm", 1, nullptr, 259},
+        {"shm-fd", 1, nullptr, 260},
+        {"raw-format", 1, nullptr, 261},
+        {"io-stats", 0, nullptr, 262},
+        {"thumbnail", 1, nullptr, 263},
+        {"extract-thumbnail", 0, nullptr, 264},
+        {"delta-base", 1, nullptr, 265},
+        {"delta-name", 1, nullptr, 266},
+        {"trim", 0, nullptr, 267},
+        {"trim-size-tags", 0, nullptr, 268},
+        {"jobs", 1, nullptr, 'j'},
+        {"match", 1, nullptr, 269},
+        {"output-dir", 1, nullptr, 270},
+        {"memory-budget", 1, nullptr, 271},
         nullptr,
     };
     int opt;
-    const char* shortopt = "-hv:t:p:";
+    const char* shortopt = "-hv:t:p:de:g:anb:j:";
     std::string input;
     std::string output;
     // Default TLG version
     int tlgVersion = 5;
     std::map<std::string, std::string> input_tags;
+    tTVPTLGSaveOption saveOption;
+    tTVPTLG6GolombTable golombTable;
+    std::string golombTrainPath;
+    std::vector<std::string> batchSources;
+    std::string batchMatch;
+    std::string outputDir;
+    unsigned jobs = 0;
+    uint64_t memoryBudget = 0;
+    IoEngine::Kind ioEngine = IoEngine::Auto;
+    unsigned ioDepth = 32;
+    std::string shmName;
+    int shmFd = -1;
+    bool rawRgba = false;
+    bool printIoStats = false;
+    bool extractThumbnail = false;
+    DeltaBase delta;
     while ((opt = getopt_long(argc, argv, shortopt, options, nullptr)) != -1) {
         switch (opt) {
         case 'h':
@@ -223,6 +283,162 @@ int main(int argc, char* argv[]) {
                 }
             }
             break;
+        case 'd':
+            saveOption.tlg6_direct_output = true;
+            break;
+        case 'e':
+            if (optarg) {
+                std::string mode = str_util::tolower(optarg);
+                if (mode == "golomb") {
+                    saveOption.tlg6_entropy = temGolomb;
+                } else if (mode == "smallest") {
+                    saveOption.tlg6_entropy = temSmallest;
+                } else if (mode == "fast") {
+                    saveOption.tlg6_entropy = temFastDecode;
+                } else {
+                    fprintf(stderr, "Invalid entropy mode: %s. Available values: golomb, smallest, fast.\n", optarg);
+                    if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+                    return 1;
+                }
+            }
+            break;
+        case 'g':
+            if (optarg) {
+                if (std::string(optarg) == "auto") {
+                    saveOption.tlg6_train_golomb_table = true;
+                } else if (loadGolombTable(optarg, golombTable)) {
+                    saveOption.tlg6_golomb_table = &golombTable;
+                } else {
+                    fprintf(stderr, "Failed to load golomb table from file: %s\n", optarg);
+                    if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+                    return 1;
+                }
+            }
+            break;
+        case 'a':
+            saveOption.analyze_content = true;
+            break;
+        case 'n':
+            saveOption.normalize_transparent = true;
+            break;
+        case 'b':
+            if (optarg) {
+                batchSources.push_back(optarg);
+            }
+            break;
+        case 256:
+            if (optarg) {
+                golombTrainPath = optarg;
+            }
+            break;
+        case 257:
+            if (optarg) {
+                std::string kind = str_util::tolower(optarg);
+                if (kind == "auto") {
+                    ioEngine = IoEngine::Auto;
+                } else if (kind == "uring") {
+                    ioEngine = IoEngine::Uring;
+                } else if (kind == "threads") {
+                    ioEngine = IoEngine::Threads;
+                } else {
+                    fprintf(stderr, "Invalid I/O engine: %s. Available values: auto, uring, threads.\n", optarg);
+                    if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+                    return 1;
+                }
+            }
+            break;
+        case 258:
+            if (optarg) {
+                int depth = std::stoi(optarg);
+                if (depth < 1) {
+                    fprintf(stderr, "Invalid I/O depth: %s.\n", optarg);
+                    if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+                    return 1;
+                }
+                ioDepth = depth;
+            }
+            break;
+        case 259:
+            if (optarg) {
+                shmName = optarg;
+            }
+            break;
+        case 260:
+            if (optarg) {
+                shmFd = std::stoi(optarg);
+                if (shmFd < 0) {
+                    fprintf(stderr, "Invalid file descriptor: %s.\n", optarg);
+                    if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+                    return 1;
+                }
+            }
+            break;
+        case 261:
+            if (optarg) {
+                std::string format = str_util::tolower(optarg);
+                if (format == "bgra" || format == "rgba") {
+                    rawRgba = format == "rgba";
+                } else {
+                    fprintf(stderr, "Invalid raw format: %s. Available values: bgra, rgba.\n", optarg);
+                    if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+                    return 1;
+                }
+            }
+            break;
+        case 262:
+            printIoStats = true;
+            break;
+        case 263:
+            if (optarg) {
+                int size = std::stoi(optarg);
+                if (size < 1 || size > 65536) {
+                    fprintf(stderr, "Invalid thumbnail size: %s. Available values: 1-65536.\n", optarg);
+                    if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+                    return 1;
+                }
+                saveOption.thumbnail_size = size;
+            }
+            break;
+        case 264:
+            extractThumbnail = true;
+            break;
+        case 265:
+            if (optarg) delta.path = optarg;
+            break;
+        case 266:
+            if (optarg) delta.name = optarg;
+            break;
+        case 267:
+            saveOption.trim_transparent = true;
+            break;
+        case 268:
+            saveOption.trim_transparent = true;
+            saveOption.trim_size_tags = true;
+            break;
+        case 'j':
+            if (optarg) {
+                int count = std::stoi(optarg);
+                if (count < 0 || count > 1024) {
+                    fprintf(stderr, "Invalid count of jobs: %s. Available values: 0-1024.\n", optarg);
+                    if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+                    return 1;
+                }
+                jobs = count;
+            }
+            break;
+        case 269:
+            if (optarg) batchMatch = optarg;
+            break;
+        case 270:
+            if (optarg) outputDir = optarg;
+            break;
+        case 271:
+            if (optarg && !parseByteSize(optarg, memoryBudget)) {
+                fprintf(stderr, "Invalid memory budget: %s. Expected a byte count such as 512M or 8G.\n", optarg);
+                if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+                return 1;
+            }
+            break;
         case 1:
             if (input.empty()) {
                 input = optarg;
@@ -242,83 +458,150 @@ int main(int argc, char* argv[]) {
             return 1;
         }
     }
-    if (input.empty()) {
+    if (input.empty() && batchSources.empty()) {
         fprintf(stderr, "Input file is required.\n");
         printHelp();
         if (haveWargv) wchar_util::freeArgv(wargv, wargc);
         return 1;
     }
-    std::string inputExt = str_util::tolower(fileop::extname(input));
-    bool decoding = (inputExt == "tlg" || inputExt == "tlg5" || inputExt == "tlg6");
+    bool toShm = !shmName.empty() || shmFd != -1;
+    if (toShm && !batchSources.empty()) {
+        fprintf(stderr, "--shm and --shm-fd cannot be used with --batch.\n");
+        if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+        return 1;
+    }
+#ifdef _WIN32
+    if (toShm) {
+        fprintf(stderr, "--shm and --shm-fd are not supported on this platform.\n");
+        if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+        return 1;
+    }
+#endif
+    bool decoding = batchSources.empty() && (toShm || isTlgPath(input));
     if (haveWargv) wchar_util::freeArgv(wargv, wargc);
+    int result = 0;
+    IoStats inputStats;
+    IoStats outputStats;
     try {
-        if (decoding) {
-            auto f = FileStream(input, "rb");
-            if (!TVPCheckTLG(&f)) {
-                fprintf(stderr, "Not a valid TLG file: %s\n", input.c_str());
-                return 1;
+        std::unique_ptr<tTVPTLG6GolombStatistics> stats;
+        if (!golombTrainPath.empty() && !decoding) {
+            stats.reset(new tTVPTLG6GolombStatistics());
+            auto stats_path = golombTrainPath + ".stats";
+            if (fileop::exists(stats_path) && !loadGolombStatistics(stats_path, *stats)) {
+                throw std::runtime_error("Failed to load golomb statistics: " + stats_path);
             }
-            TlgPic pic;
-            memset(&pic, 0, sizeof(TlgPic));
-            std::map<std::string, std::string> tags;
-            auto re = TVPLoadTLG(
-                &pic,
-                tlg_pic_size_callback,
-                tlg_pic_buf_callback,
-                &tags,
-                &f
-            );
-            if (re == -1) {
-                throw std::runtime_error("Failed to load TLG file: " + input);
+            saveOption.tlg6_golomb_statistics = stats.get();
+        }
+        if (toShm) {
+#ifndef _WIN32
+            auto in = openFileStream(input, false);
+            tTJSBinaryStream* src = in.get();
+            std::unique_ptr<StatsStream> countedIn;
+            if (printIoStats) {
+                countedIn.reset(new StatsStream(src, inputStats));
+                src = countedIn.get();
             }
-            convertBgrToRgb(pic);
-            savePng(pic, output.empty() ? fileop::filename(input) + ".png" : output);
-            destory_tlg_pic(pic);
-            if (!tags.empty()) {
-                auto f = fileop::fopen(fileop::filename(output.empty()? input : output) + ".tags", "wb");
-                if (!f) {
-                    throw std::runtime_error("Failed to open output file for tags: " + output);
-                }
-                for (const auto& tag : tags) {
-                    fprintf(f, "%s=%s\n", tag.first.c_str(), tag.second.c_str());
-                }
-                fclose(f);
+            std::unique_ptr<ShmImage> image(shmFd != -1 ? new ShmImage(shmFd, false) : ShmImage::createNamed(shmName));
+            try {
+                tlgToShm(src, image.get(), input, rawRgba ? ShmImage::RGBA : ShmImage::BGRA);
+            } catch (...) {
+                image->unlink();
+                throw;
+            }
+            if (!image->name().empty()) {
+                printf("%s\n", image->name().c_str());
+            }
+#endif
+        } else if (!batchSources.empty()) {
+            std::vector<BatchJob> batchJobs;
+            for (const auto& source : batchSources) {
+                collectBatchJobs(source, batchMatch, outputDir, batchJobs);
+            }
+            if (runBatch(batchJobs, ioEngine, ioDepth, jobs, memoryBudget, tlgVersion, input_tags, saveOption, extractThumbnail, delta,
+                printIoStats ? &inputStats : nullptr, printIoStats ? &outputStats : nullptr)) {
+                result = 1;
             }
         } else {
-            TlgPic pic = loadPng(input);
-            if (pic.width == 0 || pic.height == 0 || pic.data == nullptr) {
-                throw std::runtime_error("Invalid PNG file: " + input);
+            if (output.empty()) {
+                output = input == "-" ? "-" : defaultOutputPath(input);
+            }
+            auto in = openFileStream(input, false);
+            tTJSBinaryStream* src = in.get();
+            std::unique_ptr<PrefixedStream> prefixed;
+            if (input == "-") {
+                // stdin has no extension; tell the format from the signature
+                // and replay it to the decoder
+                std::vector<uint8_t> head(8);
+                head.resize(in->Read(head.data(), head.size()));
+                decoding = head.size() >= 3 && !memcmp(head.data(), "TLG", 3);
+                prefixed.reset(new PrefixedStream(std::move(head), in.get()));
+                src = prefixed.get();
             }
-            auto f = FileStream(output.empty() ? fileop::filename(input) + ".tlg" : output, "wb");
-            std::map<std::string, std::string> tags;
-            auto tags_path = fileop::filename(input) + ".tags";
-            if (fileop::exists(tags_path)) {
-                DictFile dict(tags_path);
-                if (!dict.HasError) {
-                    tags = dict.maps;
+            // the output is written beside its final path and renamed when
+            // the conversion succeeds, so a bad input never truncates it
+            std::string tempOutput = output == "-" ? output : output + ".tmp";
+            auto out = openFileStream(tempOutput, true);
+            tTJSBinaryStream* dest = out.get();
+            std::unique_ptr<StatsStream> countedIn, countedOut;
+            if (printIoStats) {
+                countedIn.reset(new StatsStream(src, inputStats));
+                countedOut.reset(new StatsStream(dest, outputStats));
+                src = countedIn.get();
+                dest = countedOut.get();
+            }
+            try {
+                if (decoding) {
+                    tlgToPng(src, dest, input, output == "-" ? "" : fileop::filename(output) + ".tags", extractThumbnail,
+                        delta);
+                } else {
+                    // bands of a TLG6 image are encoded on all threads
+                    std::unique_ptr<TaskPool> pool;
+                    if (tlgVersion == 6 && jobs != 1) {
+                        pool.reset(new TaskPool(jobs));
+                        saveOption.tlg6_parallel = taskPoolParallel;
+                        saveOption.tlg6_parallel_data = pool.get();
+                    }
+                    pngToTlg(src, dest, input, tlgVersion, input_tags, saveOption, delta);
                 }
+                if (!out->Flush()) {
+                    throw std::runtime_error("Failed to write output file: " + output);
+                }
+            } catch (...) {
+                countedOut.reset();
+                out.reset();
+                if (tempOutput != "-") fileop::remove(tempOutput);
+                throw;
             }
-            for (const auto& tag : input_tags) {
-                tags[tag.first] = tag.second;
+            countedOut.reset();
+            out.reset();
+            if (tempOutput != output) {
+#ifdef _WIN32
+                // rename does not replace an existing file here
+                if (fileop::exists(output)) fileop::remove(output);
+#endif
+                if (!fileop::rename(tempOutput, output)) {
+                    fileop::remove(tempOutput);
+                    throw std::runtime_error("Failed to replace " + output + " with " + tempOutput);
+                }
             }
-            auto re = TVPSaveTLG(
-                &f,
-                tlgVersion == 5 ? 0 : 1, // TLG version
-                pic.width,
-                pic.height,
-                pic.colors,
-                &pic,
-                tlg_pic_buf_callback,
-                &tags
-            );
-            if (re == -1) {
-                throw std::runtime_error("Failed to save TLG file: " + output);
+        }
+        if (stats) {
+            tTVPTLG6GolombTable table;
+            TVPTLG6TrainGolombTable(stats.get(), &table);
+            if (!saveGolombStatistics(golombTrainPath + ".stats", *stats) ||
+                !saveGolombTable(golombTrainPath, table)) {
+                throw std::runtime_error("Failed to save golomb table: " + golombTrainPath);
             }
-            destory_tlg_pic(pic);
         }
     } catch (const std::exception& e) {
         fprintf(stderr, "Error: %s\n", e.what());
-        return 1;
+        result = 1;
+    }
+    if (printIoStats) {
+        inputStats.print(stderr, "input");
+        if (!toShm) {
+            outputStats.print(stderr, "output");
+        }
     }
-    return 0;
+    return result;
 }
@@ -0,0 +1,145 @@
+﻿#include "memory_scheduler.h"
+#include "byteorder.h"
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+static uint32_t readBE32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+bool readImageHeader(const uint8_t* data, size_t size, ImageHeader& header) {
+    // PNG: signature, then the IHDR chunk with width, height, bit depth and color type
+    if (size >= 26 && !memcmp(data, "\x89PNG\r\n\x1a\n", 8) && !memcmp(data + 12, "IHDR", 4)) {
+        header.width = readBE32(data + 16);
+        header.height = readBE32(data + 20);
+        uint8_t type = data[25];
+        header.colors = type == 0 ? 1 : type == 2 ? 3 : 4;
+        header.tlg = false;
+        return true;
+    }
+    // TLG0.0 sds: the raw TLG stream follows the raw data size
+    if (size >= 15 && !memcmp(data, "TLG0.0\x00sds\x1a", 11)) {
+        data += 15;
+        size -= 15;
+    }
+    // TLG5.0/TLG6.0: colors, (TLG6 only: three flags,) width and height
+    size_t pos;
+    if (size >= 11 && !memcmp(data, "TLG5.0\x00raw\x1a", 11)) {
+        pos = 12;
+    } else if (size >= 11 && !memcmp(data, "TLG6.0\x00raw\x1a", 11)) {
+        pos = 15;
+    } else {
+        return false;
+    }
+    if (size < pos + 8) return false;
+    header.width = TVPTLGLoadInt32(data + pos);
+    header.height = TVPTLGLoadInt32(data + pos + 4);
+    header.colors = 4;
+    header.tlg = true;
+    return true;
+}
+
+bool parseByteSize(const char* str, uint64_t& bytes) {
+    char* end;
+    unsigned long long value = strtoull(str, &end, 10);
+    if (end == str) return false;
+    int shift = 0;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    case 't': case 'T': shift = 40; end++; break;
+    }
+    if ((*end == 'b' || *end == 'B') && shift) end++;
+    if (*end || value > (UINT64_MAX >> shift)) return false;
+    bytes = (uint64_t)value << shift;
+    return true;
+}
+
+uint64_t peakResidentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+MemoryScheduler::MemoryScheduler(uint64_t budget, size_t maxSkips): limit(budget), maxSkips(maxSkips) {}
+
+uint64_t MemoryScheduler::estimate(bool encoding, uint64_t inputBytes, uint64_t pixelBytes, uint64_t bufferBytes) const {
+    // the encoder keeps the compressed stream in a memory stream until it is
+    // copied to the output buffer, so the output is held twice
+    double ratio = outputRatio(encoding);
+    if (ratio <= 0) ratio = 1;
+    uint64_t output = (uint64_t)(pixelBytes * ratio);
+    return FixedBytes + inputBytes + bufferBytes + output * (encoding ? 2 : 1);
+}
+
+void MemoryScheduler::add(size_t id, bool encoding, uint64_t inputBytes, uint64_t pixelBytes, uint64_t bufferBytes) {
+    Job job = { id, encoding, inputBytes, pixelBytes, bufferBytes, estimate(encoding, inputBytes, pixelBytes, bufferBytes),
+        0, 0 };
+    queue.push_back(job);
+}
+
+void MemoryScheduler::start(std::deque<Job>::iterator it) {
+    Job job = *it;
+    queue.erase(it);
+    used += job.estimate;
+    if (used > peak) peak = used;
+    active[job.id] = job;
+}
+
+bool MemoryScheduler::next(size_t& id) {
+    if (queue.empty()) return false;
+    auto oldest = queue.begin();
+    if (!limit || active.empty() || used + oldest->estimate <= limit) {
+        id = oldest->id;
+        start(oldest);
+        return true;
+    }
+    if (oldest->skips >= maxSkips) return false;
+    // the smallest job which fits in what is left
+    auto best = queue.end();
+    for (auto it = queue.begin() + 1; it != queue.end(); ++it) {
+        if (used + it->estimate <= limit && (best == queue.end() || it->estimate < best->estimate)) best = it;
+    }
+    if (best == queue.end()) return false;
+    oldest->skips++;
+    id = best->id;
+    start(best);
+    return true;
+}
+
+double MemoryScheduler::outputRatio(bool encoding) const {
+    uint64_t pixels = pixelTotals[encoding ? 1 : 0];
+    return pixels ? (double)outputTotals[encoding ? 1 : 0] / pixels : 0;
+}
+
+void MemoryScheduler::finish(size_t id, uint64_t outputBytes) {
+    auto it = active.find(id);
+    if (it == active.end()) return;
+    Job& job = it->second;
+    used -= job.estimate;
+    if (outputBytes && job.pixelBytes) {
+        outputTotals[job.encoding ? 1 : 0] += outputBytes;
+        pixelTotals[job.encoding ? 1 : 0] += job.pixelBytes;
+        job.calibrated = FixedBytes + job.inputBytes + job.bufferBytes + outputBytes * (job.encoding ? 2 : 1);
+        if (job.calibrated > largest.calibrated) largest = job;
+    }
+    active.erase(it);
+}
\ No newline at end of file
@@ -0,0 +1,114 @@
+﻿#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <map>
+
+/**
+ * @brief Size of an image read from the header of its file.
+*/
+struct ImageHeader {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    /// Bytes per pixel of the decoded image: 1, 3 or 4 for PNG, 4 for TLG, which is decoded to 32bpp.
+    uint32_t colors = 0;
+    bool tlg = false;
+};
+
+/**
+ * @brief Reads the size of a PNG or TLG image from the start of its file, without decoding it.
+ * @return false if the data does not start with a PNG or TLG header.
+ */
+bool readImageHeader(const uint8_t* data, size_t size, ImageHeader& header);
+
+/**
+ * @brief Parses a byte count with an optional K, M, G or T suffix (powers of 1024), such as 512M.
+ */
+bool parseByteSize(const char* str, uint64_t& bytes);
+
+/**
+ * @brief Returns the highest resident memory of the process so far, or 0 if it is unknown.
+ */
+uint64_t peakResidentBytes();
+
+/**
+ * @brief Decides which conversions may run, so that the sum of their estimated peak memory fits a budget.
+ *
+ * Jobs are started in the order they were added while they fit. When the
+ * oldest job does not fit, smaller jobs which fit are started instead, up to
+ * a count of times; then no job is started until enough memory is released
+ * for the oldest one, so that a large image is not held back forever. A job
+ * larger than the whole budget runs when nothing else does.
+ *
+ * A conversion holds its input, the pixel buffers of the codecs (the whole
+ * image, or only some rows when it is streamed) and its output. The
+ * estimates assume that the output is as large as the pixels until
+ * conversions have finished; then the total output of the finished ones
+ * over their total pixel bytes is used, so that the fixed size of the
+ * headers of a few tiny images does not inflate every later estimate.
+*/
+class MemoryScheduler {
+public:
+    /// Memory of a conversion which does not depend on the image: codec tables, libpng state and stacks.
+    static const uint64_t FixedBytes = 4u << 20;
+    /**
+     * @param budget Bytes the running jobs may use. 0 for no limit.
+     * @param maxSkips Count of jobs which may start before the oldest waiting job.
+     */
+    MemoryScheduler(uint64_t budget, size_t maxSkips);
+    /**
+     * @brief Estimates the peak memory of a conversion.
+     * @param encoding true for PNG to TLG, false for TLG to PNG
+     * @param inputBytes Size of the input file, which is held in memory
+     * @param pixelBytes Size of the decoded image, from which the size of the output is estimated
+     * @param bufferBytes Size of the pixel buffers of the conversion
+     */
+    uint64_t estimate(bool encoding, uint64_t inputBytes, uint64_t pixelBytes, uint64_t bufferBytes) const;
+    /**
+     * @brief Adds a job which is ready to start.
+     */
+    void add(size_t id, bool encoding, uint64_t inputBytes, uint64_t pixelBytes, uint64_t bufferBytes);
+    /**
+     * @brief Takes the next job to start.
+     * @return false if no job may start now.
+     */
+    bool next(size_t& id);
+    /**
+     * @brief Releases the memory of a finished job.
+     * @param outputBytes Size of the output, 0 if the job failed. It is used to calibrate the estimates.
+     */
+    void finish(size_t id, uint64_t outputBytes);
+    size_t waiting() const { return queue.size(); }
+    size_t running() const { return active.size(); }
+    uint64_t budget() const { return limit; }
+    /// Highest sum of the estimates of the running jobs.
+    uint64_t peakEstimate() const { return peak; }
+    /**
+     * @brief Largest finished job: the estimate it was admitted with, and the same
+     * estimate recomputed with its real output size. Neither is measured.
+     */
+    uint64_t largestEstimate() const { return largest.estimate; }
+    uint64_t largestCalibrated() const { return largest.calibrated; }
+    /// Total output over total pixel bytes of the finished jobs, or 0 if no job finished.
+    double outputRatio(bool encoding) const;
+private:
+    struct Job {
+        size_t id;
+        bool encoding;
+        uint64_t inputBytes;
+        uint64_t pixelBytes;
+        uint64_t bufferBytes;
+        uint64_t estimate;
+        uint64_t calibrated;
+        size_t skips;
+    };
+    void start(std::deque<Job>::iterator it);
+    uint64_t limit;
+    size_t maxSkips;
+    uint64_t used = 0;
+    uint64_t peak = 0;
+    uint64_t outputTotals[2] = { 0, 0 };
+    uint64_t pixelTotals[2] = { 0, 0 };
+    Job largest = {};
+    std::deque<Job> queue;
+    std::map<size_t, Job> active;
+};
\ No newline at end of file
@@ -0,0 +1,270 @@
+﻿#include "pack_command.h"
+#include "TLG.h"
+#include "fileop.h"
+#include <string.h>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "cli_util.h"
+#include "convert.h"
+#include "errno_message.h"
+#include "io_engine.h"
+#include "tlg_pack.h"
+
+/**
+ * @brief Builds a pack from TLG files. The files are read ahead by an IoEngine.
+ * @param inputs Pairs of a file path and a member name
+ * @return Count of files which could not be added.
+ */
+static size_t buildPack(const std::string& output, const std::vector<std::pair<std::string, std::string>>& inputs, uint32_t alignment) {
+    NativeFileStream out(output, "w+b");
+    TlgPackWriter writer(&out, alignment);
+    const unsigned depth = 32;
+    auto engine = IoEngine::create(IoEngine::Auto, depth);
+    if (!engine) {
+        throw std::runtime_error("The requested I/O engine is not available.");
+    }
+    size_t failures = 0;
+    size_t shared = 0;
+    size_t next = 0;
+    auto readNext = [&]() {
+        if (next >= inputs.size()) return;
+        std::unique_ptr<IoRequest> req(new IoRequest());
+        req->type = IoRequest::Read;
+        req->path = inputs[next].first;
+        req->id = next++;
+        engine->submit(std::move(req));
+    };
+    for (unsigned i = 0; i < depth; i++) readNext();
+    // members are added in the order of the inputs, so the same inputs give the same pack
+    std::map<size_t, std::unique_ptr<IoRequest>> done;
+    size_t added = 0;
+    while (auto req = engine->wait()) {
+        readNext();
+        done[req->id] = std::move(req);
+        for (auto it = done.find(added); it != done.end(); it = done.find(++added)) {
+            const auto& input = *it->second;
+            if (input.error) {
+                fprintf(stderr, "Error: %s: %s\n", input.path.c_str(), errnoMessage(input.error).c_str());
+                failures++;
+            } else {
+                try {
+                    if (writer.add(inputs[added].second, input.data)) shared++;
+                } catch (const std::exception& e) {
+                    fprintf(stderr, "Error: %s\n", e.what());
+                    failures++;
+                }
+            }
+            done.erase(it);
+        }
+    }
+    writer.finish();
+    if (!out.Flush()) {
+        throw std::runtime_error("Failed to write pack file: " + output);
+    }
+    fprintf(stderr, "%zu members, %zu shared with an identical member, %llu bytes of image data.\n", writer.count(), shared,
+        (unsigned long long)writer.storedBytes());
+    return failures;
+}
+
+static void printPackList(const TlgPack& pack, bool json) {
+    if (json) printf("[");
+    for (size_t i = 0; i < pack.size(); i++) {
+        const auto& entry = pack.entry(i);
+        std::string name(entry.name);
+        auto tags = pack.tags(i);
+        if (json) {
+            std::string out = i ? ",\n{\"name\":" : "\n{\"name\":";
+            appendJsonString(out, name);
+            out += ",\"version\":" + std::to_string(entry.version);
+            out += ",\"colors\":" + std::to_string(entry.colors);
+            out += ",\"width\":" + std::to_string(entry.width);
+            out += ",\"height\":" + std::to_string(entry.height);
+            out += ",\"offset\":" + std::to_string(entry.dataOffset);
+            out += ",\"size\":" + std::to_string(entry.dataSize);
+            char hash[17];
+            snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)entry.hash);
+            out += std::string(",\"hash\":\"") + hash + "\",\"tags\":{";
+            for (size_t j = 0; j < tags.size(); j++) {
+                if (j) out += ',';
+                appendJsonString(out, std::string(tags[j].first));
+                out += ':';
+                appendJsonString(out, std::string(tags[j].second));
+            }
+            out += "}}";
+            fwrite(out.data(), 1, out.size(), stdout);
+            continue;
+        }
+        printf("%s: TLG%u %ux%u, %u colors, %llu bytes at %llu\n", name.c_str(), entry.version, entry.width, entry.height,
+            entry.colors, (unsigned long long)entry.dataSize, (unsigned long long)entry.dataOffset);
+        for (const auto& tag : tags) {
+            printf("  tag %.*s=%.*s\n", (int)tag.first.size(), tag.first.data(), (int)tag.second.size(), tag.second.data());
+        }
+    }
+    if (json) printf("\n]\n");
+}
+
+/**
+ * @brief Writes a pack member to a file, as is or decoded to PNG.
+ */
+static void extractPackMember(const TlgPack& pack, size_t index, const std::string& dir, bool png) {
+    const auto& entry = pack.entry(index);
+    std::string name(entry.name);
+    if (!isSafeMemberName(entry.name)) {
+        throw std::runtime_error("Refusing to extract a member outside the output directory: " + name);
+    }
+    std::string path = dir.empty() ? name : fileop::join(dir, name);
+    if (png) path = fileop::filename(path) + ".png";
+    std::string parent = fileop::dirname(path);
+    if (!parent.empty() && !fileop::mkdirs(parent, 0777, true)) {
+        throw std::runtime_error("Failed to create directory: " + parent);
+    }
+    auto out = openFileStream(path, true);
+    if (png) {
+        auto in = pack.open(index);
+        tlgToPng(in.get(), out.get(), name, fileop::filename(path) + ".tags");
+    } else if (!out->WriteBuffer(pack.data(index), entry.dataSize)) {
+        throw std::runtime_error("Failed to write file: " + path);
+    }
+    if (!out->Flush()) {
+        throw std::runtime_error("Failed to write file: " + path);
+    }
+}
+
+static void printPackHelp() {
+    printf("Usage: tlg pack build [options] -o <pack> <input>...\n");
+    printf("       tlg pack list [--json] <pack>\n");
+    printf("       tlg pack extract [options] <pack> [<member>...]\n");
+    printf("Bundle TLG files into a pack file which is memory mapped when read. The size, format and tags of the\n");
+    printf("members are kept in a sorted directory, and identical files are stored once.\n");
+    printf("Options:\n");
+    printf("  -h, --help        Show this help message\n");
+    printf("  -o, --output <path>\n");
+    printf("                    build: Pack file to write. extract: Directory to extract to. Default: current directory.\n");
+    printf("  -a, --align <n>   build: Alignment of the member data. A power of two. Default: %u.\n", (unsigned)TlgPackWriter::DefaultAlignment);
+    printf("  -b, --batch <list>\n");
+    printf("                    build: Also add the files listed in <list>, one per line. A member name can follow\n");
+    printf("                    the path after a tab. The name is the path otherwise.\n");
+    printf("  -j, --json        list: Print a JSON array with an object per member.\n");
+    printf("      --png         extract: Decode the members to PNG files.\n");
+}
+
+int runPack(int argc, char* argv[]) {
+    if (argc < 2 || !strcmp(argv[1], "-h") || !strcmp(argv[1], "--help")) {
+        printPackHelp();
+        return argc < 2 ? 1 : 0;
+    }
+    std::string command = argv[1];
+    if (command != "build" && command != "list" && command != "extract") {
+        fprintf(stderr, "Unknown pack command: %s\n", command.c_str());
+        printPackHelp();
+        return 1;
+    }
+    std::string output;
+    uint32_t alignment = TlgPackWriter::DefaultAlignment;
+    bool json = false;
+    bool png = false;
+    std::vector<std::pair<std::string, std::string>> inputs;
+    std::vector<std::string> args;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            printPackHelp();
+            return 0;
+        } else if (arg == "-j" || arg == "--json") {
+            json = true;
+            continue;
+        } else if (arg == "--png") {
+            png = true;
+            continue;
+        } else if (arg.size() < 2 || arg[0] != '-') {
+            args.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "%s needs a value.\n", arg.c_str());
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "-o" || arg == "--output") {
+            output = value;
+        } else if (arg == "-a" || arg == "--align") {
+            unsigned long n = strtoul(value.c_str(), nullptr, 10);
+            if (!n || n > 0x10000 || (n & (n - 1))) {
+                fprintf(stderr, "Invalid alignment: %s. It must be a power of two up to 65536.\n", value.c_str());
+                return 1;
+            }
+            alignment = (uint32_t)n;
+        } else if (arg == "-b" || arg == "--batch") {
+            try {
+                for (const auto& line : readListFile(value)) {
+                    auto tab = line.find('\t');
+                    if (tab == std::string::npos) {
+                        inputs.emplace_back(line, memberName(line));
+                    } else {
+                        inputs.emplace_back(line.substr(0, tab), line.substr(tab + 1));
+                    }
+                }
+            } catch (const std::exception& e) {
+                fprintf(stderr, "Error: %s\n", e.what());
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+            printPackHelp();
+            return 1;
+        }
+    }
+    try {
+        if (command == "build") {
+            for (const auto& arg : args) {
+                inputs.emplace_back(arg, memberName(arg));
+            }
+            if (output.empty() || inputs.empty()) {
+                fprintf(stderr, "An output pack and input files are required.\n");
+                printPackHelp();
+                return 1;
+            }
+            return buildPack(output, inputs, alignment) ? 1 : 0;
+        }
+        if (args.empty()) {
+            fprintf(stderr, "Pack file is required.\n");
+            printPackHelp();
+            return 1;
+        }
+        TlgPack pack(args[0]);
+        if (command == "list") {
+            printPackList(pack, json);
+            return 0;
+        }
+        int result = 0;
+        std::vector<size_t> members;
+        for (size_t i = 1; i < args.size(); i++) {
+            auto index = pack.find(memberName(args[i]));
+            if (index < 0) {
+                fprintf(stderr, "Error: No such member: %s\n", args[i].c_str());
+                result = 1;
+            } else {
+                members.push_back(index);
+            }
+        }
+        if (args.size() == 1) {
+            for (size_t i = 0; i < pack.size(); i++) members.push_back(i);
+        }
+        for (auto index : members) {
+            try {
+                extractPackMember(pack, index, output, png);
+            } catch (const std::exception& e) {
+                fprintf(stderr, "Error: %s\n", e.what());
+                result = 1;
+            }
+        }
+        return result;
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Error: %s\n", e.what());
+        return 1;
+    }
+}
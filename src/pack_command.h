@@ -0,0 +1,6 @@
+﻿/**
+ * @brief Runs the pack subcommand.
+ * @param argc Count of arguments, including "pack"
+ * @return Exit code
+ */
+int runPack(int argc, char* argv[]);
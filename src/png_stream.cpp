@@ -0,0 +1,258 @@
+﻿#include "png_stream.h"
+#include <stdexcept>
+#include <string.h>
+
+static void pngReadData(png_structp png_ptr, png_bytep data, png_size_t length) {
+    auto stream = static_cast<tTJSBinaryStream*>(png_get_io_ptr(png_ptr));
+    if (!stream->ReadBuffer(data, length)) {
+        png_error(png_ptr, "Unexpected end of file");
+    }
+}
+
+static void pngWriteData(png_structp png_ptr, png_bytep data, png_size_t length) {
+    auto stream = static_cast<tTJSBinaryStream*>(png_get_io_ptr(png_ptr));
+    if (!stream->WriteBuffer(data, length)) {
+        png_error(png_ptr, "Write error");
+    }
+}
+
+static void pngFlushData(png_structp png_ptr) {
+}
+
+// libpng reports errors by longjmp; the calls which may fail are made from
+// functions without objects to destroy
+
+static bool pngReadRow(png_structp png, uint8_t* row) {
+    if (setjmp(png_jmpbuf(png))) {
+        return false;
+    }
+    png_read_row(png, row, nullptr);
+    return true;
+}
+
+static bool pngWriteEnd(png_structp png) {
+    if (setjmp(png_jmpbuf(png))) {
+        return false;
+    }
+    png_write_end(png, nullptr);
+    return true;
+}
+
+PngReader::PngReader(tTJSBinaryStream* in, uint64_t wholeBytes): in(in), start(in->CanSeek() ? in->GetPosition() : 0) {
+    const char* error = open();
+    if (error) {
+        close();
+        throw std::runtime_error(error);
+    }
+    uint64_t lineBytes = (uint64_t)imageWidth * imageColors;
+    if (lineBytes * imageHeight > SIZE_MAX) {
+        close();
+        throw std::runtime_error("PNG image is too large.");
+    }
+    stride = (size_t)lineBytes;
+    // the rows of an interlaced image are only complete after the last pass
+    bool whole = interlaced || !in->CanSeek() || imageHeight <= RingLines || lineBytes * imageHeight <= wholeBytes;
+    lines = whole ? imageHeight : RingLines;
+    buffer.resize(stride * lines);
+    bufferRows.assign(lines, -1);
+    if (!whole) {
+        return;
+    }
+    for (int pass = 0; pass < passes; pass++) {
+        for (uint32_t y = 0; y < imageHeight; y++) {
+            if (!pngReadRow(png, &buffer[y * stride])) {
+                close();
+                throw std::runtime_error("Error during PNG reading");
+            }
+        }
+    }
+    for (uint32_t y = 0; y < imageHeight; y++) {
+        bufferRows[y] = y;
+    }
+    nextRow = imageHeight;
+    close();
+}
+
+PngReader::~PngReader() {
+    close();
+}
+
+const char* PngReader::open() {
+    png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png) {
+        return "Failed to create PNG read struct";
+    }
+    info = png_create_info_struct(png);
+    if (!info) {
+        return "Failed to create PNG info struct";
+    }
+    if (setjmp(png_jmpbuf(png))) {
+        return "Error during PNG reading";
+    }
+    png_set_read_fn(png, in, pngReadData);
+    // libpng rejects images wider or taller than 1000000 pixels by default
+    png_set_user_limits(png, 0x7fffffff, 0x7fffffff);
+    png_read_info(png, info);
+    if (png_get_bit_depth(png, info) != 8) {
+        return "Unsupported PNG bit depth. Only 8-bit PNGs are supported.";
+    }
+    int type = png_get_color_type(png, info);
+    if (type == PNG_COLOR_TYPE_GRAY) {
+        imageColors = 1;
+    } else if (type == PNG_COLOR_TYPE_RGB) {
+        imageColors = 3;
+    } else if (type == PNG_COLOR_TYPE_RGBA) {
+        imageColors = 4;
+    } else {
+        return "Unsupported PNG color type. Only grayscale, RGB, and RGBA are supported.";
+    }
+    imageWidth = png_get_image_width(png, info);
+    imageHeight = png_get_image_height(png, info);
+    interlaced = png_get_interlace_type(png, info) != PNG_INTERLACE_NONE;
+    passes = png_set_interlace_handling(png);
+    if (imageColors != 1) {
+        png_set_bgr(png);
+    }
+    png_read_update_info(png, info);
+    return nullptr;
+}
+
+void PngReader::close() {
+    if (png) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        png = nullptr;
+        info = nullptr;
+    }
+}
+
+bool PngReader::restart() {
+    close();
+    if (in->Seek(start, TJS_BS_SEEK_SET) != start) {
+        errorMessage = "Failed to seek to the start of the PNG image";
+        return false;
+    }
+    const char* error = open();
+    if (error) {
+        errorMessage = error;
+        return false;
+    }
+    nextRow = 0;
+    return true;
+}
+
+const uint8_t* PngReader::row(uint32_t y) {
+    if (y >= imageHeight) {
+        return nullptr;
+    }
+    uint8_t* line = &buffer[(size_t)(y % lines) * stride];
+    if (bufferRows[y % lines] == y) {
+        return line;
+    }
+    if (!errorMessage.empty()) {
+        return nullptr;
+    }
+    // a row already dropped from the buffer; start over from the top
+    if (y < nextRow && !restart()) {
+        return nullptr;
+    }
+    for (; nextRow <= y; nextRow++) {
+        uint32_t slot = nextRow % lines;
+        if (!pngReadRow(png, &buffer[(size_t)slot * stride])) {
+            bufferRows[slot] = -1;
+            errorMessage = "Error during PNG reading";
+            return nullptr;
+        }
+        bufferRows[slot] = nextRow;
+    }
+    return line;
+}
+
+void* PngReader::scanLine(void* callbackdata, tjs_int y) {
+    if (y < 0) {
+        return nullptr;
+    }
+    return const_cast<uint8_t*>(static_cast<PngReader*>(callbackdata)->row((uint32_t)y));
+}
+
+PngWriter::PngWriter(tTJSBinaryStream* out, bool bgr): out(out), bgr(bgr) {}
+
+PngWriter::~PngWriter() {
+    if (png) {
+        png_destroy_write_struct(&png, &info);
+    }
+}
+
+bool PngWriter::begin(uint32_t width, uint32_t height) {
+    if (png) {
+        errorMessage = "The PNG header is already written";
+        return false;
+    }
+    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png) {
+        errorMessage = "Failed to create PNG write struct";
+        return false;
+    }
+    info = png_create_info_struct(png);
+    if (!info) {
+        errorMessage = "Failed to create PNG info struct";
+        return false;
+    }
+    if (setjmp(png_jmpbuf(png))) {
+        errorMessage = "Error during PNG creation";
+        return false;
+    }
+    png_set_write_fn(png, out, pngWriteData, pngFlushData);
+    png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE,
+        PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    if (bgr) {
+        png_set_bgr(png);
+    }
+    imageHeight = height;
+    return true;
+}
+
+bool PngWriter::writeRow(const uint8_t* row) {
+    if (!errorMessage.empty()) {
+        return false;
+    }
+    if (!png || nextRow >= imageHeight) {
+        errorMessage = "Too many rows for the PNG image";
+        return false;
+    }
+    if (setjmp(png_jmpbuf(png))) {
+        errorMessage = "Error during PNG creation";
+        return false;
+    }
+    png_write_row(png, (png_bytep)row);
+    nextRow++;
+    return true;
+}
+
+void PngWriter::finish() {
+    if (errorMessage.empty() && (!png || nextRow != imageHeight)) {
+        errorMessage = "The PNG image is incomplete";
+    }
+    if (errorMessage.empty() && !pngWriteEnd(png)) {
+        errorMessage = "Error during PNG creation";
+    }
+    if (!errorMessage.empty()) {
+        throw std::runtime_error(errorMessage);
+    }
+}
+
+bool PngWriter::sizeCallback(void* callbackdata, tjs_uint w, tjs_uint h) {
+    PngWriter* writer = static_cast<PngWriter*>(callbackdata);
+    writer->line.resize((size_t)w * 4);
+    return writer->begin(w, h);
+}
+
+void* PngWriter::scanLine(void* callbackdata, tjs_int y) {
+    PngWriter* writer = static_cast<PngWriter*>(callbackdata);
+    if (y < 0) {
+        // the decoder is done with the line
+        writer->writeRow(writer->line.data());
+        return nullptr;
+    }
+    return writer->errorMessage.empty() ? writer->line.data() : nullptr;
+}
\ No newline at end of file
@@ -0,0 +1,116 @@
+﻿#include "TLG.h"
+#include "png.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Reads the rows of a PNG image on demand, to be used as the scanline source of the TLG encoder.
+ *
+ * Rows are in the BGR(A) order of TLG. Only the last RingLines rows decoded
+ * are kept; a row before them is decoded again from the start of the image,
+ * as the encoder reads the image once for each of its passes (content
+ * analysis, trimming, thumbnail). Interlaced images and inputs which cannot
+ * seek are kept whole.
+*/
+class PngReader {
+public:
+    /// Rows kept when streaming: a TLG6 row group of 8 lines and the line above it, rounded up.
+    static const uint32_t RingLines = 16;
+    /**
+     * @brief Reads the header. It throws a runtime error if the data is not a supported PNG image.
+     * @param in PNG image. Not owned.
+     * @param wholeBytes Images whose pixels take at most this many bytes are decoded whole, so that the rows may be
+     * read in any order and from several threads.
+     */
+    PngReader(tTJSBinaryStream* in, uint64_t wholeBytes = 0);
+    ~PngReader();
+    PngReader(const PngReader&) = delete;
+    PngReader& operator=(const PngReader&) = delete;
+    uint32_t width() const { return imageWidth; }
+    uint32_t height() const { return imageHeight; }
+    /// Bytes per pixel: 1, 3 or 4.
+    uint32_t colors() const { return imageColors; }
+    /// true if only some rows are kept. The rows must then be read from one thread.
+    bool streaming() const { return lines < imageHeight; }
+    /// Message of the error which made row() return nullptr.
+    const std::string& error() const { return errorMessage; }
+    /**
+     * @brief Returns row y, or nullptr if it cannot be decoded. The row stays valid until RingLines other rows are read.
+     */
+    const uint8_t* row(uint32_t y);
+    /**
+     * @brief Scanline callback of the TLG encoder. The callback data is the PngReader.
+     */
+    static void* scanLine(void* callbackdata, tjs_int y);
+private:
+    const char* open();
+    void close();
+    bool restart();
+    tTJSBinaryStream* in;
+    uint64_t start;
+    png_structp png = nullptr;
+    png_infop info = nullptr;
+    uint32_t imageWidth = 0;
+    uint32_t imageHeight = 0;
+    uint32_t imageColors = 0;
+    bool interlaced = false;
+    // passes of libpng over each row, more than one for interlaced images
+    int passes = 1;
+    size_t stride = 0;
+    uint32_t lines = 0;
+    // next row libpng decodes
+    uint32_t nextRow = 0;
+    std::vector<uint8_t> buffer;
+    // row held by each line of the buffer, -1 if none
+    std::vector<int64_t> bufferRows;
+    std::string errorMessage;
+};
+
+/**
+ * @brief Writes an RGBA PNG image row by row. It can be used as the callbacks of the TLG decoder, which then gets the
+ * same buffer for every line, compressed as soon as the decoder hands it over.
+*/
+class PngWriter {
+public:
+    /**
+     * @param out Stream to write to. Not owned.
+     * @param bgr true if the rows are in the BGRA order of TLG.
+     */
+    PngWriter(tTJSBinaryStream* out, bool bgr = false);
+    ~PngWriter();
+    PngWriter(const PngWriter&) = delete;
+    PngWriter& operator=(const PngWriter&) = delete;
+    /**
+     * @brief Writes the header.
+     * @return false on errors. See error().
+     */
+    bool begin(uint32_t width, uint32_t height);
+    /**
+     * @brief Compresses the next row.
+     * @return false on errors. See error().
+     */
+    bool writeRow(const uint8_t* row);
+    /**
+     * @brief Writes the end of the image. It throws a runtime error if any row failed or is missing.
+     */
+    void finish();
+    const std::string& error() const { return errorMessage; }
+    /**
+     * @brief Size callback of the TLG decoder. The callback data is the PngWriter.
+     */
+    static bool sizeCallback(void* callbackdata, tjs_uint w, tjs_uint h);
+    /**
+     * @brief Scanline callback of the TLG decoder. The line is compressed when the decoder is done with it.
+     */
+    static void* scanLine(void* callbackdata, tjs_int y);
+private:
+    png_structp png = nullptr;
+    png_infop info = nullptr;
+    tTJSBinaryStream* out;
+    bool bgr;
+    uint32_t imageHeight = 0;
+    uint32_t nextRow = 0;
+    std::vector<uint8_t> line;
+    std::string errorMessage;
+};
\ No newline at end of file
@@ -0,0 +1,126 @@
+﻿#include "shm_image.h"
+
+#ifndef _WIN32
+#include <stdexcept>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "errno_message.h"
+
+ShmImage* ShmImage::createNamed(const std::string& name) {
+    std::string objectName = name.empty() || name[0] != '/' ? "/" + name : name;
+    int fd = shm_open(objectName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+        throw std::runtime_error("Failed to create shared memory object " + objectName + ": " + errnoMessage(errno));
+    }
+    ShmImage* image = new ShmImage(fd, true);
+    image->objectName = objectName;
+    return image;
+}
+
+ShmImage::ShmImage(int fd, bool owned) {
+    descriptor = fd;
+    this->owned = owned;
+}
+
+ShmImage::~ShmImage() {
+    unmap();
+    if (owned && descriptor != -1) {
+        close(descriptor);
+    }
+}
+
+void ShmImage::unmap() {
+    if (mapping) {
+        munmap(mapping, mappingSize);
+        mapping = nullptr;
+        pixels = nullptr;
+    }
+}
+
+void ShmImage::allocate(uint32_t width, uint32_t height) {
+    unmap();
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t offset = (sizeof(ShmImageHeader) + page - 1) / page * page;
+    uint64_t lineSize = (uint64_t)width * 4;
+    if (lineSize > UINT32_MAX || (height && lineSize > ((uint64_t)SIZE_MAX - offset) / height)) {
+        throw std::runtime_error("Image is too large for shared memory.");
+    }
+    uint64_t size = offset + lineSize * height;
+    // truncating to zero first drops the pages of an earlier image
+    if (ftruncate(descriptor, 0) == -1 || ftruncate(descriptor, (off_t)size) == -1) {
+        throw std::runtime_error("Failed to size shared memory: " + errnoMessage(errno));
+    }
+    void* p = mmap(nullptr, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+    if (p == MAP_FAILED) {
+        throw std::runtime_error("Failed to map shared memory: " + errnoMessage(errno));
+    }
+    mapping = static_cast<uint8_t*>(p);
+    mappingSize = (size_t)size;
+    pixels = mapping + offset;
+    this->width = width;
+    this->height = height;
+    stride = (uint32_t)lineSize;
+    dataOffset = offset;
+}
+
+void ShmImage::finish(Format format, const std::map<std::string, std::string>& tags) {
+    if (!mapping) {
+        throw std::runtime_error("Shared memory image is not allocated.");
+    }
+    if (format == RGBA) {
+        for (uint32_t y = 0; y < height; ++y) {
+            uint8_t* p = line(y);
+            for (uint32_t x = 0; x < width; ++x, p += 4) {
+                uint8_t t = p[0];
+                p[0] = p[2];
+                p[2] = t;
+            }
+        }
+    }
+    std::string text;
+    for (const auto& tag : tags) {
+        text += tag.first + "=" + tag.second + "\n";
+    }
+    uint64_t tagsOffset = mappingSize;
+    if (!text.empty()) {
+        // the tags are known only after the pixels are decoded; grow the
+        // object behind the pixels instead of remapping them
+        if (ftruncate(descriptor, (off_t)(tagsOffset + text.size())) == -1) {
+            throw std::runtime_error("Failed to size shared memory: " + errnoMessage(errno));
+        }
+        size_t done = 0;
+        while (done < text.size()) {
+            ssize_t n = pwrite(descriptor, text.data() + done, text.size() - done, (off_t)(tagsOffset + done));
+            if (n == -1 && errno == EINTR) continue;
+            if (n <= 0) {
+                throw std::runtime_error("Failed to write tags to shared memory: " + errnoMessage(errno));
+            }
+            done += (size_t)n;
+        }
+    }
+    ShmImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "TLGRAW1", 8);
+    header.headerSize = sizeof(header);
+    header.format = format;
+    header.width = width;
+    header.height = height;
+    header.stride = stride;
+    header.dataOffset = dataOffset;
+    header.dataSize = (uint64_t)stride * height;
+    header.tagsOffset = tagsOffset;
+    header.tagsSize = text.size();
+    memcpy(mapping, &header, sizeof(header));
+}
+
+void ShmImage::unlink() {
+    if (!objectName.empty()) {
+        shm_unlink(objectName.c_str());
+        objectName.clear();
+    }
+}
+#endif
\ No newline at end of file
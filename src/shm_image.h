@@ -0,0 +1,93 @@
+﻿#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <string>
+
+#ifndef _WIN32
+/**
+ * @brief Header at the start of a raw image in shared memory.
+ *
+ * The pixels start at dataOffset, which is a multiple of the page size, so a
+ * consumer can map them directly. The tags follow the pixels as "key=value\n" lines.
+ * All fields are in native byte order.
+ */
+struct ShmImageHeader {
+    /// "TLGRAW1" followed by a zero byte.
+    char magic[8];
+    uint32_t headerSize;
+    /// ShmImage::Format
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    /// Bytes between the starts of two scanlines.
+    uint32_t stride;
+    uint32_t reserved;
+    uint64_t dataOffset;
+    uint64_t dataSize;
+    uint64_t tagsOffset;
+    uint64_t tagsSize;
+};
+
+/**
+ * @brief Decoded image in a POSIX shared memory object, or in a descriptor such as a memfd passed by the caller.
+ *
+ * The decoder writes the scanlines straight into the mapping, so the image
+ * is handed to another process without being copied or encoded again.
+ */
+class ShmImage {
+public:
+    enum Format {
+        BGRA = 0,
+        RGBA = 1,
+    };
+    /**
+     * @brief Creates a named POSIX shared memory object. It fails if the object already exists.
+     * @param name Object name. A leading '/' is added if missing.
+     */
+    static ShmImage* createNamed(const std::string& name);
+    /**
+     * @brief Uses an already opened descriptor, such as a memfd inherited from the caller.
+     * @param fd File descriptor. It must be opened for reading and writing.
+     * @param owned Closes the descriptor on destruction if true.
+     */
+    ShmImage(int fd, bool owned);
+    ~ShmImage();
+    ShmImage(const ShmImage&) = delete;
+    ShmImage& operator=(const ShmImage&) = delete;
+    /**
+     * @brief Sizes the region for the image and maps it. The previous contents are dropped.
+     */
+    void allocate(uint32_t width, uint32_t height);
+    /**
+     * @brief Returns the address of scanline y. Valid after allocate().
+     */
+    uint8_t* line(uint32_t y) const {
+        return pixels + (size_t)y * stride;
+    }
+    /**
+     * @brief Converts the pixels to the format, writes the tags and the header.
+     * @param format Format of the pixels. The decoder writes BGRA.
+     * @param tags Tags of the image
+     */
+    void finish(Format format, const std::map<std::string, std::string>& tags);
+    int fd() const { return descriptor; }
+    /// Name of the shared memory object. Empty for a descriptor.
+    const std::string& name() const { return objectName; }
+    /**
+     * @brief Removes the name of the shared memory object, if it has one.
+     */
+    void unlink();
+private:
+    void unmap();
+    int descriptor = -1;
+    bool owned = false;
+    std::string objectName;
+    uint8_t* mapping = nullptr;
+    size_t mappingSize = 0;
+    uint8_t* pixels = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t stride = 0;
+    uint64_t dataOffset = 0;
+};
+#endif
\ No newline at end of file
@@ -0,0 +1,126 @@
+﻿#include "stats_stream.h"
+#include <chrono>
+#include <inttypes.h>
+
+static uint64_t elapsedNanoseconds(std::chrono::steady_clock::time_point start) {
+    auto d = std::chrono::steady_clock::now() - start;
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+void IoStats::Op::add(uint64_t requested, uint64_t transferred, uint64_t ns) {
+    int cls = 0;
+    while (cls < SizeClasses - 1 && requested >> cls) cls++;
+    calls++;
+    bytes += transferred;
+    nanoseconds += ns;
+    sizes[cls]++;
+}
+
+void IoStats::Op::add(const Op& other) {
+    calls += other.calls;
+    bytes += other.bytes;
+    nanoseconds += other.nanoseconds;
+    for (int i = 0; i < SizeClasses; i++) sizes[i] += other.sizes[i];
+}
+
+void IoStats::add(const IoStats& other) {
+    reads.add(other.reads);
+    writes.add(other.writes);
+    vectorWrites.add(other.vectorWrites);
+    views.add(other.views);
+    seeks += other.seeks;
+    tells += other.tells;
+    forwardSeekBytes += other.forwardSeekBytes;
+    backwardSeekBytes += other.backwardSeekBytes;
+    seekNanoseconds += other.seekNanoseconds;
+}
+
+static void printOp(FILE* fp, const char* name, const IoStats::Op& op) {
+    if (!op.calls) return;
+    fprintf(fp, "  %-8s %10" PRIu64 " calls %14" PRIu64 " bytes %10.3f ms\n", name, op.calls, op.bytes,
+        op.nanoseconds / 1e6);
+    for (int i = 0; i < IoStats::SizeClasses; i++) {
+        if (!op.sizes[i]) continue;
+        if (i == 0) {
+            fprintf(fp, "    %21s %10" PRIu64 "\n", "0", op.sizes[i]);
+        } else {
+            char range[32];
+            snprintf(range, sizeof(range), "%" PRIu64 "-%" PRIu64, (uint64_t)1 << (i - 1), ((uint64_t)1 << i) - 1);
+            fprintf(fp, "    %21s %10" PRIu64 "\n", range, op.sizes[i]);
+        }
+    }
+}
+
+void IoStats::print(FILE* fp, const char* label) const {
+    fprintf(fp, "I/O statistics of %s:\n", label);
+    printOp(fp, "read", reads);
+    printOp(fp, "write", writes);
+    printOp(fp, "writev", vectorWrites);
+    printOp(fp, "view", views);
+    if (seeks || tells) {
+        fprintf(fp, "  %-8s %10" PRIu64 " calls %10.3f ms, %" PRIu64 " position queries\n", "seek", seeks,
+            seekNanoseconds / 1e6, tells);
+        fprintf(fp, "    %21s %10" PRIu64 " bytes\n", "forward", forwardSeekBytes);
+        fprintf(fp, "    %21s %10" PRIu64 " bytes\n", "backward", backwardSeekBytes);
+    }
+}
+
+StatsStream::StatsStream(tTJSBinaryStream* target, IoStats& stats) : target(target), stats(stats) {
+    position = target->CanSeek() ? target->GetPosition() : 0;
+}
+
+tjs_uint64 StatsStream::Seek(tjs_int64 offset, tjs_int whence) {
+    auto start = std::chrono::steady_clock::now();
+    tjs_uint64 pos = target->Seek(offset, whence);
+    uint64_t ns = elapsedNanoseconds(start);
+    stats.seekNanoseconds += ns;
+    if (pos == position) {
+        stats.tells++;
+    } else {
+        stats.seeks++;
+        if (pos > position) {
+            stats.forwardSeekBytes += pos - position;
+        } else {
+            stats.backwardSeekBytes += position - pos;
+        }
+    }
+    position = pos;
+    return pos;
+}
+
+tjs_uint StatsStream::Read(void* buffer, tjs_uint read_size) {
+    auto start = std::chrono::steady_clock::now();
+    tjs_uint n = target->Read(buffer, read_size);
+    stats.reads.add(read_size, n, elapsedNanoseconds(start));
+    position += n;
+    return n;
+}
+
+tjs_uint StatsStream::Write(const void* buffer, tjs_uint write_size) {
+    auto start = std::chrono::steady_clock::now();
+    tjs_uint n = target->Write(buffer, write_size);
+    stats.writes.add(write_size, n, elapsedNanoseconds(start));
+    position += n;
+    return n;
+}
+
+tjs_uint64 StatsStream::WriteV(const tTJSBinaryStreamVec* vecs, tjs_int count) {
+    uint64_t requested = 0;
+    for (tjs_int i = 0; i < count; i++) requested += vecs[i].size;
+    auto start = std::chrono::steady_clock::now();
+    tjs_uint64 n = target->WriteV(vecs, count);
+    stats.vectorWrites.add(requested, n, elapsedNanoseconds(start));
+    position += n;
+    return n;
+}
+
+const void* StatsStream::GetView(tjs_uint64 pos, tjs_uint& size) {
+    auto start = std::chrono::steady_clock::now();
+    const void* view = target->GetView(pos, size);
+    stats.views.add(view ? size : 0, view ? size : 0, elapsedNanoseconds(start));
+    return view;
+}
+
+bool StatsStream::CanSeek() {
+    return target->CanSeek();
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+﻿#include "stream.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * @brief I/O counters collected by StatsStream.
+*/
+struct IoStats {
+    /// Count of request size classes. Class 0 holds empty requests, class i sizes in [2^(i-1), 2^i).
+    static const int SizeClasses = 34;
+    struct Op {
+        uint64_t calls = 0;
+        uint64_t bytes = 0;
+        uint64_t nanoseconds = 0;
+        uint64_t sizes[SizeClasses] = {};
+        void add(uint64_t requested, uint64_t transferred, uint64_t ns);
+        void add(const Op& other);
+    };
+    Op reads;
+    Op writes;
+    /// WriteV calls. The size of a call is the sum of its buffers.
+    Op vectorWrites;
+    /// GetView calls. Bytes are the sizes of the returned views.
+    Op views;
+    /// Seeks which moved the position.
+    uint64_t seeks = 0;
+    /// Seeks which only asked for the position, such as GetPosition.
+    uint64_t tells = 0;
+    uint64_t forwardSeekBytes = 0;
+    uint64_t backwardSeekBytes = 0;
+    uint64_t seekNanoseconds = 0;
+    /**
+     * @brief Adds the counters of another IoStats, such as one filled on another thread.
+     */
+    void add(const IoStats& other);
+    /**
+     * @brief Prints the counters in a human readable form.
+     * @param fp Destination
+     * @param label Name of the stream printed in the heading
+     */
+    void print(FILE* fp, const char* label) const;
+};
+
+/**
+ * @brief Stream which passes every call to another stream and records it in an IoStats.
+ *
+ * Several streams may record into the same IoStats, which is not thread safe.
+*/
+class StatsStream : public tTJSBinaryStream {
+public:
+    /**
+     * @param target Stream to pass the calls to. Not owned.
+     * @param stats Counters to add to. Must outlive this stream.
+     */
+    StatsStream(tTJSBinaryStream* target, IoStats& stats);
+    virtual tjs_uint64 Seek(tjs_int64 offset, tjs_int whence) override;
+    virtual tjs_uint Read(void* buffer, tjs_uint read_size) override;
+    virtual tjs_uint Write(const void* buffer, tjs_uint write_size) override;
+    virtual tjs_uint64 WriteV(const tTJSBinaryStreamVec* vecs, tjs_int count) override;
+    virtual const void* GetView(tjs_uint64 pos, tjs_uint& size) override;
+    virtual bool CanSeek() override;
+private:
+    tTJSBinaryStream* target;
+    IoStats& stats;
+    tjs_uint64 position;
+};
\ No newline at end of file
@@ -0,0 +1,204 @@
+﻿#include "tags_command.h"
+#include "TLG.h"
+#include "fileop.h"
+#include "str_util.h"
+#include <algorithm>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "buffer_stream.h"
+#include "cli_util.h"
+#include "convert.h"
+#include "dict_file.h"
+
+/**
+ * @brief Changes to the tags made by the tags subcommand.
+ */
+struct TagEdit {
+    bool clear = false;
+    std::map<std::string, std::string> set;
+    std::vector<std::string> remove;
+    bool empty() const {
+        return !clear && set.empty() && remove.empty();
+    }
+};
+
+/**
+ * @brief Rewrites the tags of a TLG file without decoding its pixels.
+ * @param input TLG file
+ * @param output Path to write to. Empty, or the input itself, to replace the input.
+ * @return false if the tags were already as requested and nothing was written.
+ */
+static bool rewriteTags(const std::string& input, const std::string& output, const TagEdit& edit) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    // opening the output would truncate the input before it is read
+    bool inPlace = output.empty() ||
+        (input != "-" && output != "-" && fs::equivalent(fs::u8path(input), fs::u8path(output), ec));
+    std::unique_ptr<tTJSBinaryStream> in = openFileStream(input, false);
+    if (!in->CanSeek()) {
+        // the current tags are read before the file is copied
+        std::unique_ptr<BufferStream> buffered(new BufferStream());
+        std::vector<uint8_t> buf(65536);
+        tjs_uint size;
+        while ((size = in->Read(buf.data(), (tjs_uint)buf.size())) > 0) {
+            buffered->WriteBuffer(buf.data(), size);
+        }
+        in = std::move(buffered);
+    }
+    tTVPTLGInfo info;
+    if (TVPProbeTLG(in.get(), &info) != TLG_SUCCESS) {
+        throw std::runtime_error("Not a valid TLG file: " + input);
+    }
+    std::map<std::string, std::string> tags;
+    if (!edit.clear) {
+        tags = info.tags;
+    }
+    for (const auto& key : edit.remove) {
+        tags.erase(key);
+    }
+    for (const auto& tag : edit.set) {
+        tags[tag.first] = tag.second;
+    }
+    if (inPlace && tags == info.tags) {
+        return false;
+    }
+    std::string dest = inPlace ? input + ".tmp" : output;
+    {
+        auto out = openFileStream(dest, true);
+        if (TVPRewriteTLGTags(out.get(), in.get(), &tags) != TLG_SUCCESS) {
+            out.reset();
+            if (dest != "-") fileop::remove(dest);
+            throw std::runtime_error("Failed to rewrite tags of " + input);
+        }
+        if (!out->Flush()) {
+            out.reset();
+            if (dest != "-") fileop::remove(dest);
+            throw std::runtime_error("Failed to write output file: " + dest);
+        }
+    }
+    if (inPlace) {
+        in.reset();
+        // the new file is created with the default mode
+        auto perms = fs::status(fs::u8path(input), ec).permissions();
+        if (!ec) fs::permissions(fs::u8path(dest), perms, ec);
+#ifdef _WIN32
+        // rename does not replace an existing file here
+        fileop::remove(input);
+#endif
+        if (!fileop::rename(dest, input)) {
+            throw std::runtime_error("Failed to replace " + input + " with " + dest);
+        }
+    }
+    return true;
+}
+
+static void printTagsHelp() {
+    printf("Usage: tlg tags [options] <input>...\n");
+    printf("Change the tags of TLG files in place, copying the pixel data as is.\n");
+    printf("Options:\n");
+    printf("  -h, --help        Show this help message\n");
+    printf("  -t, --tags <key>=<value>\n");
+    printf("                    Set a tag. Can be used multiple times.\n");
+    printf("  -p, --tag-path <path>\n");
+    printf("                    Set the tags in a file of key=value pairs.\n");
+    printf("  -r, --remove <key>\n");
+    printf("                    Remove a tag. Can be used multiple times.\n");
+    printf("  -c, --clear       Remove all tags before setting new ones.\n");
+    printf("  -o, --output <path>\n");
+    printf("                    Write to <path> instead of replacing the input. Only with one input.\n");
+    printf("  -b, --batch <list>\n");
+    printf("                    Also change the files listed in <list>, one per line.\n");
+}
+
+int runTags(int argc, char* argv[]) {
+    TagEdit edit;
+    std::string output;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help") {
+            printTagsHelp();
+            return 0;
+        } else if (arg == "-c" || arg == "--clear") {
+            edit.clear = true;
+            continue;
+        } else if (arg.size() < 2 || arg[0] != '-') {
+            inputs.push_back(arg);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "%s needs a value.\n", arg.c_str());
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "-t" || arg == "--tags") {
+            auto re = str_util::str_splitv(value, "=", 2);
+            if (re.size() != 2) {
+                fprintf(stderr, "Invalid tag format: %s. Expected format: key=value\n", value.c_str());
+                return 1;
+            }
+            edit.set[re[0]] = re[1];
+        } else if (arg == "-p" || arg == "--tag-path") {
+            DictFile dict(value);
+            if (dict.HasError) {
+                fprintf(stderr, "Failed to load tags from file: %s\n", value.c_str());
+                return 1;
+            }
+            for (const auto& tag : dict.maps) {
+                edit.set[tag.first] = tag.second;
+            }
+        } else if (arg == "-r" || arg == "--remove") {
+            edit.remove.push_back(value);
+        } else if (arg == "-o" || arg == "--output") {
+            output = value;
+        } else if (arg == "-b" || arg == "--batch") {
+            try {
+                auto lines = readListFile(value);
+                inputs.insert(inputs.end(), lines.begin(), lines.end());
+            } catch (const std::exception& e) {
+                fprintf(stderr, "Error: %s\n", e.what());
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+            printTagsHelp();
+            return 1;
+        }
+    }
+    if (inputs.empty()) {
+        fprintf(stderr, "Input file is required.\n");
+        printTagsHelp();
+        return 1;
+    }
+    if (edit.empty()) {
+        fprintf(stderr, "No tag change is specified.\n");
+        return 1;
+    }
+    if (!output.empty() && inputs.size() > 1) {
+        fprintf(stderr, "--output can be used only with one input.\n");
+        return 1;
+    }
+    // standard input cannot be edited in place, so it is written to
+    // standard output and cannot be one of several inputs
+    if (inputs.size() > 1 && std::find(inputs.begin(), inputs.end(), "-") != inputs.end()) {
+        fprintf(stderr, "- can be used only as the only input.\n");
+        return 1;
+    }
+    if (inputs[0] == "-" && output.empty()) {
+        output = "-";
+    }
+    int result = 0;
+    for (const auto& input : inputs) {
+        try {
+            rewriteTags(input, output, edit);
+        } catch (const std::exception& e) {
+            fprintf(stderr, "Error: %s\n", e.what());
+            result = 1;
+        }
+    }
+    return result;
+}
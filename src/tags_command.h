@@ -0,0 +1,6 @@
+﻿/**
+ * @brief Runs the tags subcommand.
+ * @param argc Count of arguments, including "tags"
+ * @return Exit code
+ */
+int runTags(int argc, char* argv[]);
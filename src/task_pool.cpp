@@ -0,0 +1,135 @@
+﻿#include "task_pool.h"
+#include <exception>
+
+static thread_local const TaskPool* currentPool = nullptr;
+static thread_local size_t currentIndex = 0;
+
+TaskPool::TaskPool(unsigned threads) {
+    if (!threads) threads = std::thread::hardware_concurrency();
+    if (!threads) threads = 1;
+    for (unsigned i = 0; i < threads; i++) {
+        workers.emplace_back(new Queue());
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        this->threads.emplace_back([this, i] { work(i); });
+    }
+}
+
+TaskPool::~TaskPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& thread : threads) thread.join();
+}
+
+size_t TaskPool::current() const {
+    return currentPool == this ? currentIndex : workers.size();
+}
+
+void TaskPool::submit(Task task) {
+    size_t index = current();
+    if (index == workers.size()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        index = nextQueue++ % workers.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued++;
+    }
+    wake.notify_one();
+}
+
+bool TaskPool::take(size_t self, Task& task) {
+    bool found = false;
+    if (self < workers.size()) {
+        std::lock_guard<std::mutex> lock(workers[self]->mutex);
+        auto& tasks = workers[self]->tasks;
+        if (!tasks.empty()) {
+            task = std::move(tasks.back());
+            tasks.pop_back();
+            found = true;
+        }
+    }
+    for (size_t i = 1; !found && i <= workers.size(); i++) {
+        size_t victim = (self + i) % workers.size();
+        if (victim == self) continue;
+        std::lock_guard<std::mutex> lock(workers[victim]->mutex);
+        auto& tasks = workers[victim]->tasks;
+        if (!tasks.empty()) {
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            found = true;
+        }
+    }
+    if (found) {
+        std::lock_guard<std::mutex> lock(mutex);
+        queued--;
+    }
+    return found;
+}
+
+void TaskPool::work(size_t index) {
+    currentPool = this;
+    currentIndex = index;
+    while (true) {
+        Task task;
+        if (take(index, task)) {
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || queued; });
+        if (stopping && !queued) return;
+    }
+}
+
+void TaskPool::parallelFor(size_t count, const std::function<void(size_t)>& task) {
+    if (!count) return;
+    // remaining is only touched under the mutex, so that the last task is done
+    // with the state when the caller sees 0 and returns
+    struct State {
+        size_t remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+    } state;
+    state.remaining = count;
+    auto run = [&state, &task](size_t i) {
+        std::exception_ptr error;
+        try {
+            task(i);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (error && !state.error) state.error = error;
+        if (!--state.remaining) state.done.notify_all();
+    };
+    // queued in reverse, so that the caller takes them from the top
+    for (size_t i = count - 1; i > 0; i--) {
+        submit([&run, i] { run(i); });
+    }
+    run(0);
+    size_t self = current();
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (!state.remaining) break;
+        }
+        Task other;
+        if (take(self, other)) {
+            other();
+            continue;
+        }
+        // every part left is running on another thread
+        std::unique_lock<std::mutex> lock(state.mutex);
+        state.done.wait(lock, [&state] { return !state.remaining; });
+    }
+    if (state.error) std::rethrow_exception(state.error);
+}
\ No newline at end of file
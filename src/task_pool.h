@@ -0,0 +1,66 @@
+﻿#include <stddef.h>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Thread pool with a work-stealing scheduler.
+ *
+ * Each worker has a queue of its own. A worker runs the newest task of its
+ * queue first and, when the queue is empty, steals the oldest task of another
+ * worker. Tasks split from a task by parallelFor() stay on the worker which
+ * split it unless another worker has nothing to do.
+*/
+class TaskPool {
+public:
+    typedef std::function<void()> Task;
+    /**
+     * @param threads Count of workers. 0 for the count of hardware threads.
+     */
+    TaskPool(unsigned threads);
+    /**
+     * @brief Runs the queued tasks and stops the workers.
+     */
+    ~TaskPool();
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+    unsigned size() const { return (unsigned)workers.size(); }
+    /**
+     * @brief Queues a task. A task queued by a worker goes to the queue of that worker.
+     * @param task Task. It must not throw.
+     */
+    void submit(Task task);
+    /**
+     * @brief Runs task(0) ... task(count - 1) on the workers and returns when all of them have finished.
+     * The caller runs tasks while it waits, so tasks may call it too. The first exception thrown by a task
+     * is thrown again once all have finished.
+     */
+    void parallelFor(size_t count, const std::function<void(size_t)>& task);
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    /**
+     * @brief Takes a task from the queue of worker self, or steals one from another queue.
+     * @param self Index of the calling worker, or size() if the caller is not a worker.
+     */
+    bool take(size_t self, Task& task);
+    void work(size_t index);
+    /**
+     * @brief Index of the calling thread in this pool, or size() if it is not a worker of this pool.
+     */
+    size_t current() const;
+    std::vector<std::unique_ptr<Queue>> workers;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    /// Count of tasks in the queues.
+    size_t queued = 0;
+    size_t nextQueue = 0;
+    bool stopping = false;
+};
\ No newline at end of file
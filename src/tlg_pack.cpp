@@ -0,0 +1,309 @@
+﻿#include "tlg_pack.h"
+#include "byteorder.h"
+#include <stdexcept>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#include "wchar_util.h"
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "errno_message.h"
+#endif
+
+TlgPack::TlgPack(const std::string& path) {
+#ifdef _WIN32
+    std::wstring wpath;
+    if (!wchar_util::str_to_wstr(wpath, path, CP_UTF8)) {
+        throw std::runtime_error("Failed to convert the path to wide characters: " + path);
+    }
+    HANDLE file = CreateFileW(wpath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Failed to open file: " + path + ": error " + std::to_string(GetLastError()));
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        DWORD code = GetLastError();
+        CloseHandle(file);
+        throw std::runtime_error("Failed to get the size of file: " + path + ": error " + std::to_string(code));
+    }
+    if (size.QuadPart < TLG_PACK_HEADER_SIZE) {
+        CloseHandle(file);
+        throw std::runtime_error("Not a valid pack file: " + path);
+    }
+    HANDLE section = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    const void* p = section ? MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    DWORD code = GetLastError();
+    // the view keeps the file and the section referenced
+    if (section) CloseHandle(section);
+    CloseHandle(file);
+    if (!p) {
+        throw std::runtime_error("Failed to map file: " + path + ": error " + std::to_string(code));
+    }
+    mapping = static_cast<const uint8_t*>(p);
+    mappingSize = size.QuadPart;
+#else
+    int fd;
+    do {
+        fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    } while (fd == -1 && errno == EINTR);
+    if (fd == -1) {
+        throw std::runtime_error("Failed to open file: " + path + ": " + errnoMessage(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int code = errno;
+        ::close(fd);
+        throw std::runtime_error("Failed to get the size of file: " + path + ": " + errnoMessage(code));
+    }
+    if (st.st_size < TLG_PACK_HEADER_SIZE) {
+        ::close(fd);
+        throw std::runtime_error("Not a valid pack file: " + path);
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int code = errno;
+    // the mapping keeps the file referenced
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        throw std::runtime_error("Failed to map file: " + path + ": " + errnoMessage(code));
+    }
+    mapping = static_cast<const uint8_t*>(p);
+    mappingSize = st.st_size;
+#endif
+    try {
+        parse();
+    } catch (const std::exception& e) {
+#ifdef _WIN32
+        UnmapViewOfFile(mapping);
+#else
+        munmap(const_cast<uint8_t*>(mapping), mappingSize);
+#endif
+        throw std::runtime_error("Not a valid pack file: " + path + ": " + e.what());
+    }
+}
+
+TlgPack::~TlgPack() {
+#ifdef _WIN32
+    UnmapViewOfFile(mapping);
+#else
+    munmap(const_cast<uint8_t*>(mapping), mappingSize);
+#endif
+}
+
+void TlgPack::parse() {
+    if (mappingSize < TLG_PACK_HEADER_SIZE || memcmp(mapping, TLG_PACK_MAGIC, 8)) {
+        throw std::runtime_error("bad magic");
+    }
+    if (TVPTLGLoadInt32(mapping + 8) != TLG_PACK_HEADER_SIZE || TVPTLGLoadInt32(mapping + 12) != TLG_PACK_ENTRY_SIZE) {
+        throw std::runtime_error("unsupported header or entry size");
+    }
+    align = TVPTLGLoadInt32(mapping + 16);
+    uint32_t count = TVPTLGLoadInt32(mapping + 20);
+    uint64_t directoryOffset = TVPTLGLoadInt64(mapping + 24);
+    uint64_t stringsOffset = TVPTLGLoadInt64(mapping + 32);
+    uint64_t stringsSize = TVPTLGLoadInt64(mapping + 40);
+    if (!align || (align & (align - 1))) {
+        throw std::runtime_error("bad alignment");
+    }
+    if (directoryOffset > mappingSize || (mappingSize - directoryOffset) / TLG_PACK_ENTRY_SIZE < count) {
+        throw std::runtime_error("directory runs over the file");
+    }
+    if (stringsOffset > mappingSize || mappingSize - stringsOffset < stringsSize) {
+        throw std::runtime_error("strings run over the file");
+    }
+    const char* strings = reinterpret_cast<const char*>(mapping + stringsOffset);
+    entries.resize(count);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* p = mapping + directoryOffset + (uint64_t)i * TLG_PACK_ENTRY_SIZE;
+        TlgPackEntry& entry = entries[i];
+        uint64_t nameOffset = TVPTLGLoadInt32(p);
+        uint64_t nameSize = TVPTLGLoadInt32(p + 4);
+        uint64_t tagsSize = TVPTLGLoadInt32(p + 44);
+        if (nameOffset + nameSize + tagsSize > stringsSize) {
+            throw std::runtime_error("name or tags run over the strings");
+        }
+        entry.name = std::string_view(strings + nameOffset, nameSize);
+        entry.tags = std::string_view(strings + nameOffset + nameSize, tagsSize);
+        entry.dataOffset = TVPTLGLoadInt64(p + 8);
+        entry.dataSize = TVPTLGLoadInt64(p + 16);
+        if (entry.dataOffset < TLG_PACK_HEADER_SIZE || entry.dataOffset > mappingSize || mappingSize - entry.dataOffset < entry.dataSize) {
+            throw std::runtime_error("member data runs over the file");
+        }
+        entry.hash = TVPTLGLoadInt64(p + 24);
+        entry.width = TVPTLGLoadInt32(p + 32);
+        entry.height = TVPTLGLoadInt32(p + 36);
+        entry.version = p[40];
+        entry.colors = p[41];
+        // find() relies on the order
+        if (i && !(entries[i - 1].name < entry.name)) {
+            throw std::runtime_error("directory is not sorted");
+        }
+    }
+}
+
+ptrdiff_t TlgPack::find(std::string_view name) const {
+    size_t low = 0, high = entries.size();
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        int re = entries[mid].name.compare(name);
+        if (re == 0) return mid;
+        if (re < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return -1;
+}
+
+std::vector<tTVPTLGTagView> TlgPack::tags(size_t index) const {
+    std::vector<tTVPTLGTagView> views;
+    const auto& tags = entries[index].tags;
+    if (!TVPTLGParseTagViews(tags.data(), (tjs_uint32)tags.size(), views)) {
+        throw std::runtime_error("Malformed tags of pack member: " + std::string(entries[index].name));
+    }
+    return views;
+}
+
+std::unique_ptr<tTJSBinaryStream> TlgPack::open(size_t index) const {
+    return std::unique_ptr<tTJSBinaryStream>(new tTJSMemoryReadStream(data(index), entries[index].dataSize));
+}
+
+TlgPackWriter::TlgPackWriter(tTJSBinaryStream* out, uint32_t alignment) : out(out), alignment(alignment) {
+    if (!alignment || (alignment & (alignment - 1))) {
+        throw std::runtime_error("Pack alignment must be a power of two");
+    }
+    if (!out->CanSeek()) {
+        throw std::runtime_error("Pack file must be seekable");
+    }
+    // the header is written by finish()
+    writeZeros(TLG_PACK_HEADER_SIZE);
+}
+
+void TlgPackWriter::writeZeros(uint64_t count) {
+    static const uint8_t zeros[256] = {};
+    while (count) {
+        tjs_uint one = count > sizeof(zeros) ? (tjs_uint)sizeof(zeros) : (tjs_uint)count;
+        if (!out->WriteBuffer(zeros, one)) {
+            throw std::runtime_error("Failed to write pack file");
+        }
+        position += one;
+        count -= one;
+    }
+}
+
+bool TlgPackWriter::sameData(uint64_t offset, const std::vector<uint8_t>& data) {
+    uint8_t buf[65536];
+    bool same = true;
+    out->Seek(offset, TJS_BS_SEEK_SET);
+    for (size_t pos = 0; same && pos < data.size();) {
+        tjs_uint one = data.size() - pos > sizeof(buf) ? (tjs_uint)sizeof(buf) : (tjs_uint)(data.size() - pos);
+        if (!out->ReadBuffer(buf, one)) {
+            throw std::runtime_error("Failed to read back pack file");
+        }
+        same = !memcmp(buf, data.data() + pos, one);
+        pos += one;
+    }
+    out->Seek(position, TJS_BS_SEEK_SET);
+    return same;
+}
+
+bool TlgPackWriter::add(const std::string& name, const std::vector<uint8_t>& data) {
+    if (members.count(name)) {
+        throw std::runtime_error("Duplicate pack member name: " + name);
+    }
+    tTVPTLGInfo info;
+    tTJSMemoryReadStream probe(data.data(), data.size());
+    if (TVPProbeTLG(&probe, &info) != TLG_SUCCESS) {
+        throw std::runtime_error("Not a valid TLG file: " + name);
+    }
+    Member member;
+    member.dataSize = data.size();
+    member.hash = TVPTLGHashBytes(data.data(), data.size());
+    member.width = info.width;
+    member.height = info.height;
+    member.version = (uint8_t)info.version;
+    member.colors = (uint8_t)info.colors;
+    for (const auto& chunk : info.chunks) {
+        if (!memcmp(chunk.name, "tags", 4)) {
+            member.tags.assign(reinterpret_cast<const char*>(data.data()) + chunk.offset, chunk.size);
+        }
+    }
+    bool shared = false;
+    auto range = blobs.equal_range(member.hash);
+    for (auto it = range.first; it != range.second; it++) {
+        if (it->second.second == data.size() && sameData(it->second.first, data)) {
+            member.dataOffset = it->second.first;
+            shared = true;
+            break;
+        }
+    }
+    if (!shared) {
+        writeZeros((alignment - position % alignment) % alignment);
+        member.dataOffset = position;
+        if (!out->WriteBuffer(data.data(), data.size())) {
+            throw std::runtime_error("Failed to write pack file");
+        }
+        position += data.size();
+        stored += data.size();
+        blobs.emplace(member.hash, std::make_pair(member.dataOffset, member.dataSize));
+    }
+    members.emplace(name, std::move(member));
+    return shared;
+}
+
+void TlgPackWriter::finish() {
+    std::vector<uint8_t> directory(members.size() * TLG_PACK_ENTRY_SIZE);
+    std::string strings;
+    uint8_t* p = directory.data();
+    for (const auto& it : members) {
+        const Member& member = it.second;
+        if (strings.size() + it.first.size() + member.tags.size() > 0xffffffff) {
+            throw std::runtime_error("Too many pack members");
+        }
+        TVPTLGStoreInt32(p, (uint32_t)strings.size());
+        TVPTLGStoreInt32(p + 4, (uint32_t)it.first.size());
+        TVPTLGStoreInt64(p + 8, member.dataOffset);
+        TVPTLGStoreInt64(p + 16, member.dataSize);
+        TVPTLGStoreInt64(p + 24, member.hash);
+        TVPTLGStoreInt32(p + 32, member.width);
+        TVPTLGStoreInt32(p + 36, member.height);
+        p[40] = member.version;
+        p[41] = member.colors;
+        p[42] = p[43] = 0;
+        TVPTLGStoreInt32(p + 44, (uint32_t)member.tags.size());
+        strings += it.first;
+        strings += member.tags;
+        p += TLG_PACK_ENTRY_SIZE;
+    }
+    writeZeros((8 - position % 8) % 8);
+    uint64_t directoryOffset = position;
+    uint64_t stringsOffset = directoryOffset + directory.size();
+    tTJSBinaryStreamVec vecs[2] = {
+        { directory.data(), (tjs_uint)directory.size() },
+        { strings.data(), (tjs_uint)strings.size() },
+    };
+    if (directory.size() > TJS_BS_MAX_IO_SIZE || strings.size() > TJS_BS_MAX_IO_SIZE || !out->WriteVBuffer(vecs, 2)) {
+        throw std::runtime_error("Failed to write pack directory");
+    }
+    position = stringsOffset + strings.size();
+
+    uint8_t header[TLG_PACK_HEADER_SIZE] = {};
+    memcpy(header, TLG_PACK_MAGIC, 8);
+    TVPTLGStoreInt32(header + 8, TLG_PACK_HEADER_SIZE);
+    TVPTLGStoreInt32(header + 12, TLG_PACK_ENTRY_SIZE);
+    TVPTLGStoreInt32(header + 16, alignment);
+    TVPTLGStoreInt32(header + 20, (uint32_t)members.size());
+    TVPTLGStoreInt64(header + 24, directoryOffset);
+    TVPTLGStoreInt64(header + 32, stringsOffset);
+    TVPTLGStoreInt64(header + 40, strings.size());
+    out->Seek(0, TJS_BS_SEEK_SET);
+    if (!out->WriteBuffer(header, sizeof(header))) {
+        throw std::runtime_error("Failed to write pack header");
+    }
+    out->Seek(position, TJS_BS_SEEK_SET);
+}
\ No newline at end of file
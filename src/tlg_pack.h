@@ -0,0 +1,135 @@
+﻿#include "TLG.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Pack file layout. All integers are little endian.
+ *
+ *   header (64 bytes)
+ *   member data, each starting at a multiple of the alignment
+ *   directory: an entry of 48 bytes per member, sorted by name
+ *   strings: member names, each followed by the tags of the member
+ *
+ * Identical members are stored once and share their data.
+*/
+
+#define TLG_PACK_MAGIC "TLGPACK1"
+#define TLG_PACK_HEADER_SIZE 64
+#define TLG_PACK_ENTRY_SIZE 48
+
+/**
+ * @brief Directory entry of a pack member.
+*/
+struct TlgPackEntry {
+    std::string_view name;
+    uint64_t dataOffset = 0;
+    uint64_t dataSize = 0;
+    /// 64-bit FNV-1a hash of the member data.
+    uint64_t hash = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    /// TLG version, 5 or 6.
+    uint8_t version = 0;
+    uint8_t colors = 0;
+    /// Contents of the "tags" chunk of the member. Empty if it has none.
+    std::string_view tags;
+};
+
+/**
+ * @brief Read-only access to a pack file.
+ *
+ * The whole file is mapped into memory, so opening a member makes no system
+ * call and the decoder reads the mapped bytes directly. The dimensions and
+ * the tags of the members are kept in the directory and can be looked up
+ * without touching the member data.
+*/
+class TlgPack {
+public:
+    /**
+     * @brief Opens a pack file. It throws a runtime error if the file cannot be opened or is not a valid pack.
+     */
+    TlgPack(const std::string& path);
+    ~TlgPack();
+    TlgPack(const TlgPack&) = delete;
+    TlgPack& operator=(const TlgPack&) = delete;
+    size_t size() const { return entries.size(); }
+    const TlgPackEntry& entry(size_t index) const { return entries[index]; }
+    uint32_t alignment() const { return align; }
+    /**
+     * @brief Looks up a member by name with a binary search.
+     * @return Index of the member, or -1 if there is none.
+     */
+    ptrdiff_t find(std::string_view name) const;
+    /**
+     * @brief Parses the tags of a member. The names and values point into the mapping.
+     */
+    std::vector<tTVPTLGTagView> tags(size_t index) const;
+    /**
+     * @brief Returns the member data. Valid while the pack is open.
+     */
+    const uint8_t* data(size_t index) const { return mapping + entries[index].dataOffset; }
+    /**
+     * @brief Creates a read-only stream on the member data. The stream must not outlive the pack.
+     */
+    std::unique_ptr<tTJSBinaryStream> open(size_t index) const;
+private:
+    void parse();
+    const uint8_t* mapping = nullptr;
+    uint64_t mappingSize = 0;
+    uint32_t align = 0;
+    std::vector<TlgPackEntry> entries;
+};
+
+/**
+ * @brief Writes a pack file.
+ *
+ * Member data is written as it is added; the directory and the header are
+ * written by finish().
+*/
+class TlgPackWriter {
+public:
+    static const uint32_t DefaultAlignment = 4096;
+    /**
+     * @param out Stream to write to. Not owned. It must be seekable and readable, as duplicates are compared with the data already written.
+     * @param alignment Alignment of the member data. It must be a power of two.
+     */
+    TlgPackWriter(tTJSBinaryStream* out, uint32_t alignment = DefaultAlignment);
+    /**
+     * @brief Adds a TLG image. It throws a runtime error if the data is not a valid TLG image or the name is already used.
+     * @return true if the data was already in the pack and is shared.
+     */
+    bool add(const std::string& name, const std::vector<uint8_t>& data);
+    /**
+     * @brief Writes the directory and the header.
+     */
+    void finish();
+    size_t count() const { return members.size(); }
+    /// Total size of the member data, without duplicates and padding.
+    uint64_t storedBytes() const { return stored; }
+private:
+    struct Member {
+        std::string tags;
+        uint64_t dataOffset;
+        uint64_t dataSize;
+        uint64_t hash;
+        uint32_t width;
+        uint32_t height;
+        uint8_t version;
+        uint8_t colors;
+    };
+    bool sameData(uint64_t offset, const std::vector<uint8_t>& data);
+    void writeZeros(uint64_t count);
+    tTJSBinaryStream* out;
+    uint32_t alignment;
+    uint64_t position = 0;
+    uint64_t stored = 0;
+    // members by name, in the order of the directory
+    std::map<std::string, Member> members;
+    // offset and size of the stored data by hash
+    std::multimap<uint64_t, std::pair<uint64_t, uint64_t>> blobs;
+};
\ No newline at end of file